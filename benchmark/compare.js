@@ -0,0 +1,69 @@
+#!/usr/bin/env node
+'use strict';
+
+/* eslint-disable no-console */
+/* eslint-disable no-process-exit */
+
+// Compares two results of benchmark/run.js and reports the regressions.
+//
+// benchmark/compare.js <baseline.json> <current.json> [<threshold %>]
+//
+// Exits with 1, if a throughput dropped, or a latency or blocking time
+// grew by more than the threshold (default 20%).
+
+const fs = require('fs');
+
+if(process.argv.length < 4) {
+  console.error(`Usage: ${process.argv[1]} ` +
+    '<baseline.json> <current.json> [<threshold %>]');
+  process.exit(1);
+}
+
+const baseline  = JSON.parse(fs.readFileSync(process.argv[2], 'utf8'));
+const current   = JSON.parse(fs.readFileSync(process.argv[3], 'utf8'));
+const threshold = Number(process.argv[4] || 20) / 100;
+
+// higher is better for throughput, lower is better for everything else
+const HIGHER_IS_BETTER = ['callsPerSecond', 'bytesPerSecond',
+  'maxSustainedRate'];
+const COMPARED = HIGHER_IS_BETTER.concat(['p50', 'p99']);
+
+let regressions = 0;
+
+const compare = function(base, cur, keyPath) {
+  if(!base || !cur || typeof base !== 'object') {
+    return;
+  }
+
+  for(const key of Object.keys(base)) {
+    const name = keyPath ? `${keyPath}.${key}` : key;
+
+    if(key === 'nativeStats' || key === 'steps') {
+      continue;
+    }
+
+    if(typeof base[key] === 'object') {
+      compare(base[key], cur[key], name);
+    } else if(COMPARED.includes(key) && typeof cur[key] === 'number') {
+      const higherIsBetter = HIGHER_IS_BETTER.includes(key);
+      const change         = base[key] ? (cur[key] - base[key]) / base[key] : 0;
+      const regression     = higherIsBetter ?
+        change < -threshold :
+        change > threshold;
+
+      console.log(`${regression ? 'REGRESSION' : 'ok        '} ${name}: ` +
+        `${base[key].toFixed(1)} -> ${cur[key].toFixed(1)} ` +
+        `(${(change * 100).toFixed(1)}%)`);
+
+      if(regression) {
+        regressions++;
+      }
+    }
+  }
+};
+
+console.log(`${baseline.version} (${baseline.date}) -> ` +
+  `${current.version} (${current.date})`);
+compare(baseline, current, '');
+
+process.exit(regressions ? 1 : 0);
@@ -0,0 +1,315 @@
+#!/usr/bin/env node
+'use strict';
+
+/* eslint-disable no-console */
+/* eslint-disable no-bitwise */
+/* eslint-disable no-process-exit */
+
+// Benchmarks the bindings against the pigpiod stand-in
+// (bin/pigpiod-standin.js), started as a child process on a local port.
+//
+// benchmark/run.js [--output <file.json>] [--iterations <n>] [--port <port>]
+//
+// Measures
+// - calls/s and latency percentiles of gpio_read, gpio_write,
+//   spi_xfer (several sizes), serial_write and serial_read,
+// - the maximum sustained edge rate through callback() without drops or
+//   event loop stalls,
+// - the event loop blocking time of dht22_get and mcp3204.
+// Writes the results as JSON (to stdout, or to the output file), to be
+// compared between releases with benchmark/compare.js.
+
+const childProcess = require('child_process');
+const fs           = require('fs');
+const path         = require('path');
+
+const pigpiod     = require('../lib/pigpiod.js');
+const packageJson = require('../package.json');
+
+const GPIO_OUT      = 4;
+const GPIO_CALLBACK = 25;
+const GPIO_DHT22    = 18;
+
+const SPI_SIZES     = [3, 16, 64, 256, 1024];
+const SERIAL_SIZES  = [1, 16, 64];
+const EDGE_RATES    = [1000, 2000, 5000, 10000, 20000, 50000, 100000];
+const EDGE_DURATION = 1; // s
+const MAX_LOOP_LAG  = 20000; // us, event loop lag still counting as sustained
+
+const options = {
+  output:     null,
+  iterations: 10000,
+  port:       18888
+};
+
+for(let i = 2; i < process.argv.length; i += 2) {
+  const name = process.argv[i].replace(/^--/, '');
+
+  if(!(name in options) || i + 1 >= process.argv.length) {
+    console.error(`Usage: ${process.argv[1]} ` +
+      '[--output <file.json>] [--iterations <n>] [--port <port>]');
+    process.exit(1);
+  }
+  options[name] = process.argv[i + 1];
+}
+options.iterations = Number(options.iterations);
+
+
+
+// ###########################################################################
+// Helpers
+
+const now = function() {
+  const time = process.hrtime();
+
+  return time[0] * 1e6 + time[1] / 1e3; // us
+};
+
+const percentile = function(sorted, p) {
+  return sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+};
+
+// Runs fn <iterations> times, returns calls/s and latency percentiles [us].
+const measure = function(iterations, fn) {
+  const latencies = new Float64Array(iterations);
+  const start     = now();
+
+  for(let i = 0; i < iterations; i++) {
+    const callStart = now();
+
+    fn(i);
+    latencies[i] = now() - callStart;
+  }
+
+  const total  = now() - start;
+  const sorted = Array.from(latencies).sort((a, b) => a - b);
+
+  return {
+    iterations,
+    callsPerSecond: iterations / total * 1e6,
+    p50:  percentile(sorted, 0.5),
+    p99:  percentile(sorted, 0.99),
+    max:  sorted[sorted.length - 1],
+    mean: total / iterations
+  };
+};
+
+const delay = function(ms) {
+  return new Promise(resolve => setTimeout(resolve, ms));
+};
+
+const startStandIn = function() {
+  return new Promise((resolve, reject) => {
+    const standIn = childProcess.fork(
+      path.join(__dirname, '..', 'bin', 'pigpiod-standin.js'),
+      ['--port', String(options.port), '--host', '127.0.0.1'],
+      {stdio: ['ignore', 'ignore', 'inherit', 'ipc']});
+
+    standIn.once('message', message => {
+      if(message.listening) {
+        resolve(standIn);
+      }
+    });
+    standIn.once('error', reject);
+    standIn.once('exit', code => reject(
+      new Error(`pigpiod stand-in exited with ${code}`)));
+  });
+};
+
+
+
+// ###########################################################################
+// Benchmarks
+
+const benchmarkGpio = function(pi) {
+  pigpiod.set_mode(pi, GPIO_OUT, pigpiod.PI_OUTPUT);
+
+  return {
+    gpio_read: measure(options.iterations, () =>
+      pigpiod.gpio_read(pi, GPIO_OUT)),
+    gpio_write: measure(options.iterations, i =>
+      pigpiod.gpio_write(pi, GPIO_OUT, i & 1))
+  };
+};
+
+const benchmarkSpi = function(pi) {
+  const spi     = pigpiod.spi_open(pi, 0, 1000000, 0);
+  const results = {};
+
+  for(const size of SPI_SIZES) {
+    const txBuf = Buffer.alloc(size, 0x55);
+    const rxBuf = Buffer.alloc(size);
+
+    results[size] = measure(options.iterations, () =>
+      pigpiod.spi_xfer(pi, spi, txBuf, rxBuf, size));
+    results[size].bytesPerSecond = results[size].callsPerSecond * size;
+  }
+
+  pigpiod.spi_close(pi, spi);
+
+  return results;
+};
+
+const benchmarkSerial = function(pi) {
+  const serial = pigpiod.serial_open(pi, '/dev/ttyAMA0', 115200, 0);
+  const write  = {};
+  const read   = {};
+
+  for(const size of SERIAL_SIZES) {
+    const data  = 'x'.repeat(size);
+    const rxBuf = Buffer.alloc(size);
+
+    // the stand-in echos, so each read finds the data of one write
+    write[size] = measure(options.iterations, () =>
+      pigpiod.serial_write(pi, serial, data, size));
+    read[size] = measure(options.iterations, () =>
+      pigpiod.serial_read(pi, serial, rxBuf, size));
+  }
+
+  pigpiod.serial_close(pi, serial);
+
+  return {serial_write: write, serial_read: read};
+};
+
+// Streams edges at increasing rates and counts the callbacks.
+// The maximum sustained rate is the highest rate without drops, and without
+// stalling the event loop for more than MAX_LOOP_LAG.
+const benchmarkCallback = function(pi, standIn) {
+  const steps = [];
+  let   received = 0;
+
+  const callbackId = pigpiod.callback(pi, GPIO_CALLBACK, pigpiod.EITHER_EDGE,
+    () => {
+      received++;
+    });
+
+  pigpiod.set_mode(pi, GPIO_CALLBACK, pigpiod.PI_INPUT);
+
+  const step = function(index) {
+    if(index >= EDGE_RATES.length) {
+      pigpiod.callback_cancel(callbackId);
+
+      const sustained = steps
+        .filter(result => !result.dropped &&
+          result.received === result.sent &&
+          result.maxLoopLag <= MAX_LOOP_LAG)
+        .reduce((max, result) => Math.max(max, result.rate), 0);
+
+      return Promise.resolve({steps, maxSustainedRate: sustained});
+    }
+
+    const rate  = EDGE_RATES[index];
+    const count = rate * EDGE_DURATION;
+
+    received = 0;
+    pigpiod.callback_stats_reset(GPIO_CALLBACK);
+
+    return new Promise(resolve => {
+      // event loop lag, as a measure for stalls
+      let   maxLag   = 0;
+      let   expected = now() + 10000;
+      const lagTimer = setInterval(() => {
+        maxLag   = Math.max(maxLag, now() - expected);
+        expected = now() + 10000;
+      }, 10);
+
+      const onMessage = message => {
+        if(message.streamEnd === GPIO_CALLBACK) {
+          standIn.removeListener('message', onMessage);
+          // grace time for the last edges to be delivered
+          delay(200).then(() => {
+            clearInterval(lagTimer);
+            resolve({sent: message.sent, maxLag});
+          });
+        }
+      };
+
+      standIn.on('message', onMessage);
+      standIn.send({cmd: 'edgeStream', gpio: GPIO_CALLBACK, rate, count});
+    })
+    .then(result => {
+      const stats = pigpiod.callback_stats(GPIO_CALLBACK);
+
+      steps.push({
+        rate,
+        sent:        result.sent,
+        received,
+        dropped:     stats.dropped,
+        highWater:   stats.highWater,
+        maxLoopLag:  result.maxLag,
+        dispatchP99: stats.dispatchLatency.p99
+      });
+
+      return step(index + 1);
+    });
+  };
+
+  return step(0);
+};
+
+const benchmarkSensors = function(pi, standIn) {
+  standIn.send({cmd: 'dht22', gpio: GPIO_DHT22,
+    temperature: 21.3, humidity: 45.2});
+
+  return delay(100).then(() => {
+    const spi    = pigpiod.spi_open(pi, 0, 500000, 0);
+    const result = {
+      // both are synchronous, so the call time is the event loop block time
+      dht22_get: measure(20, () => pigpiod.dht22(pi, GPIO_DHT22)),
+      mcp3204:   measure(options.iterations, i =>
+        pigpiod.mcp3204(pi, spi, i % 4))
+    };
+
+    pigpiod.spi_close(pi, spi);
+
+    return result;
+  });
+};
+
+
+
+// ###########################################################################
+// Main
+
+startStandIn()
+.then(standIn => {
+  const pi      = pigpiod.pigpio_start('127.0.0.1', String(options.port));
+  const results = {
+    version:    packageJson.version,
+    node:       process.version,
+    date:       new Date().toISOString(),
+    iterations: options.iterations
+  };
+
+  Object.assign(results, benchmarkGpio(pi));
+  results.spi_xfer = benchmarkSpi(pi);
+  Object.assign(results, benchmarkSerial(pi));
+
+  return benchmarkCallback(pi, standIn)
+  .then(callbackResults => {
+    results.callback = callbackResults;
+
+    return benchmarkSensors(pi, standIn);
+  })
+  .then(sensorResults => {
+    Object.assign(results, sensorResults);
+    results.nativeStats = pigpiod.getStats();
+
+    pigpiod.pigpio_stop(pi);
+    standIn.kill();
+
+    const json = JSON.stringify(results, null, 2);
+
+    if(options.output) {
+      fs.writeFileSync(options.output, `${json}\n`);
+    } else {
+      console.log(json);
+    }
+
+    process.exit(0);
+  });
+})
+.catch(err => {
+  console.error(err);
+  process.exit(1);
+});
@@ -0,0 +1,111 @@
+#!/usr/bin/env node
+'use strict';
+
+/* eslint-disable no-console */
+
+// Runs the pigpiod stand-in (see lib/standin.js).
+//
+// pigpiod-standin [--port <port>] [--host <host>] [--socket <path>]
+//                 [--script <file.json>]
+//
+// The script configures the simulation:
+// {
+//   "levels": {"4": 1},
+//   "dht22":  [{"gpio": 18, "temperature": 21.3, "humidity": 45.2}],
+//   "edges":  [{"gpio": 25, "rate": 10000, "count": 100000}]
+// }
+//
+// Use the stand-in with PIGPIO_PORT=<port> (and PIGPIO_ADDR=<host>),
+// or with pigpio_start(<host>, <port>).
+
+const fs        = require('fs');
+const {StandIn} = require('../lib/standin');
+
+const options = {
+  port:   8888,
+  host:   'localhost',
+  socket: null,
+  script: null
+};
+
+for(let i = 2; i < process.argv.length; i += 2) {
+  const name = process.argv[i].replace(/^--/, '');
+
+  if(!(name in options) || i + 1 >= process.argv.length) {
+    console.error(`Usage: ${process.argv[1]} ` +
+      '[--port <port>] [--host <host>] [--socket <path>] ' +
+      '[--script <file.json>]');
+    process.exit(1);
+  }
+  options[name] = process.argv[i + 1];
+}
+
+const standIn = new StandIn();
+const script  = options.script ?
+  JSON.parse(fs.readFileSync(options.script, 'utf8')) :
+  {};
+
+for(const gpio of Object.keys(script.levels || {})) {
+  standIn.setLevel(Number(gpio), script.levels[gpio]);
+}
+
+for(const sensor of script.dht22 || []) {
+  standIn.dht22(sensor.gpio, sensor);
+}
+
+const onListening = function() {
+  const address = standIn.server.address();
+
+  console.log('pigpiod stand-in listening on', typeof address === 'string' ?
+    address :
+    `${address.address}:${address.port}`);
+
+  // started by a parent process (e.g. the benchmark)
+  if(process.send) {
+    process.send({listening: address});
+  }
+
+  for(const stream of script.edges || []) {
+    standIn.edgeStream(stream.gpio, stream);
+  }
+};
+
+if(options.socket) {
+  standIn.listen(options.socket, onListening);
+} else {
+  standIn.listen(Number(options.port), options.host, onListening);
+}
+
+// the parent (e.g. the benchmark) controls the simulation via IPC messages
+process.on('message', message => {
+  switch(message.cmd) {
+    case 'setLevel':
+      standIn.setLevel(message.gpio, message.level);
+      break;
+
+    case 'edgeStream':
+      standIn.edgeStream(message.gpio, message);
+      break;
+
+    case 'dht22':
+      standIn.dht22(message.gpio, message);
+      break;
+
+    case 'bbSerialData':
+      standIn.bbSerialData(message.gpio, message.data);
+      break;
+
+    default:
+      break;
+  }
+});
+
+standIn.on('streamEnd', (gpio, sent) => {
+  if(process.send) {
+    process.send({streamEnd: gpio, sent});
+  }
+});
+
+process.on('SIGINT', () => {
+  standIn.close(() => process.exit());
+});
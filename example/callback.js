@@ -2,7 +2,6 @@
 'use strict';
 
 /* eslint-disable no-console */
-/* eslint-disable no-process-exit */
 
 const pigpiod = require('../lib/pigpiod.js');
 
@@ -23,8 +22,10 @@ const gpioWindCallback = function(gpio, level, tick) {
   windCounter++;
 };
 
+// A queue large enough for bursts, so no pulse gets dropped.
 const callbackId =
-  pigpiod.callback(pi, GPIO_WIND, pigpiod.FALLING_EDGE, gpioWindCallback);
+  pigpiod.callback(pi, GPIO_WIND, pigpiod.FALLING_EDGE, gpioWindCallback,
+    pigpiod.CB_POLICY_QUEUE, 4096);
 
 if(callbackId < 0) {
   throw new Error('Failed to pigpiod.callback()');
@@ -45,7 +46,4 @@ setTimeout(() => {
   pigpiod.set_watchdog(pi, GPIO_WIND, 0);
   pigpiod.callback_cancel(callbackId);
   pigpiod.pigpio_stop(pi);
-
-  // TODO why is not going down automatically?
-  process.exit();
 }, 5000);
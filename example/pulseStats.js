@@ -0,0 +1,43 @@
+#!/usr/bin/env node
+'use strict';
+
+/* eslint-disable no-console */
+/* eslint-disable no-process-exit */
+
+// Reports the pulse statistics of a fan tachometer signal on GPIO 23.
+
+const pigpiod = require('../lib/pigpiod.js');
+
+const GPIO_TACHO = 23;
+
+
+
+const pi = pigpiod.pigpio_start();
+
+if(pi < 0) {
+  throw new Error('Failed to pigpiod.pidpio_start()');
+}
+
+pigpiod.set_mode(pi, GPIO_TACHO, pigpiod.PI_INPUT);
+pigpiod.pulse_stats_start(pi, GPIO_TACHO, 100, 50, 16);
+
+const interval = setInterval(() => {
+  const stats = pigpiod.pulse_stats_get(GPIO_TACHO);
+
+  if(stats.period.count) {
+    // two pulses per revolution
+    console.log(`rpm = ${Math.round(60000000 / stats.period.mean / 2)}`);
+  }
+  console.log(stats.high, stats.low, stats.widths);
+
+  pigpiod.pulse_stats_reset(GPIO_TACHO);
+}, 1000);
+
+setTimeout(() => {
+  clearInterval(interval);
+
+  pigpiod.pulse_stats_stop(GPIO_TACHO);
+  pigpiod.pigpio_stop(pi);
+
+  process.exit();
+}, 10000);
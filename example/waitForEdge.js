@@ -0,0 +1,31 @@
+#!/usr/bin/env node
+'use strict';
+
+/* eslint-disable no-console */
+
+// Waits for a button press on GPIO 22 or GPIO 27, with a timeout of 5s.
+
+const pigpiod = require('../lib/pigpiod.js');
+
+const GPIO_TASTER_RUNTER = 22;
+const GPIO_TASTER_HOCH   = 27;
+
+
+
+const pi = pigpiod.pigpio_start();
+
+if(pi < 0) {
+  throw new Error('Failed to pigpiod.pidpio_start()');
+}
+
+pigpiod.waitForEdge(pi, [GPIO_TASTER_RUNTER, GPIO_TASTER_HOCH],
+  pigpiod.FALLING_EDGE, 5000)
+.then(result => {
+  if(result.timeout) {
+    console.log('timeout');
+  } else {
+    console.log(`GPIO ${result.gpio} pressed at ${result.tick}`);
+  }
+
+  pigpiod.pigpio_stop(pi);
+});
@@ -1,6 +1,6 @@
 'use strict';
 
-// Reads the data of a DHT22 sensor, synchronous
+// Reads the data of DHT22 sensors: one synchronous, or many in a sweep.
 
 /* eslint-disable no-bitwise */
 
@@ -10,11 +10,11 @@ const DHT_GOOD         = 0;
 const DHT_BAD_CHECKSUM = 1;
 const DHT_BAD_DATA     = 2;
 
-const dht22 = function(pi, gpio) {
-  const buf = Buffer.allocUnsafe(8);
-  const dht22Data = {};
+const DEFAULT_SLOT = 6; // ms
 
-  pigpiod.dht22_get(pi, gpio, buf);
+// Decodes the 8 bytes of a sensor at offset in buf.
+const decode = function(buf, offset) {
+  const dht22Data = {};
 
   //    0      1      2      3      4
   // |0    7|8   15|16  23|24  31|32  39|
@@ -22,16 +22,16 @@ const dht22 = function(pi, gpio) {
   // | chk  |  humidityLE |temperatureLE|
   // +------+------+------+------+------+
   const chksum =
-    (buf.readUInt8(1) +
-     buf.readUInt8(2) +
-     buf.readUInt8(3) +
-     buf.readUInt8(4))
+    (buf.readUInt8(offset + 1) +
+     buf.readUInt8(offset + 2) +
+     buf.readUInt8(offset + 3) +
+     buf.readUInt8(offset + 4))
     & 0xff;
   let valid = false;
 
-  if(chksum === buf.readUInt8(0)) {
-    const temperature = buf.readInt16LE(1) / 10;
-    const humidity = buf.readInt16LE(3) / 10;
+  if(chksum === buf.readUInt8(offset)) {
+    const temperature = buf.readInt16LE(offset + 1) / 10;
+    const humidity = buf.readInt16LE(offset + 3) / 10;
 
     valid = true;
     if((temperature < -40) || (temperature > 80)) {
@@ -62,9 +62,48 @@ const dht22 = function(pi, gpio) {
   return dht22Data;
 };
 
+const dht22 = function(pi, gpio) {
+  const buf = Buffer.allocUnsafe(8);
+
+  pigpiod.dht22_get(pi, gpio, buf);
+
+  return decode(buf, 0);
+};
+
+// Reads the DHT22 sensors on gpios (of bank 1) in one sweep, off the event
+// loop, triggering one sensor each options.slot [ms]. Needs a local daemon.
+// Resolves with one {gpio, status, temperature, humidity} per GPIO.
+const dht22Sweep = function(pi, gpios, options) {
+  const opts   = options || {};
+  const list   = Array.isArray(gpios) ? gpios : [gpios];
+  const sorted = Array.from(new Set(list)).sort((a, b) => a - b);
+  let   mask   = 0;
+
+  for(const gpio of sorted) {
+    if(gpio < 0 || gpio > 31) {
+      return Promise.reject(new Error(`Invalid GPIO ${gpio}`));
+    }
+    mask |= 1 << gpio;
+  }
+
+  return new Promise((resolve, reject) => {
+    pigpiod.dht22_sweep(pi, mask >>> 0,
+      opts.slot === undefined ? DEFAULT_SLOT : opts.slot,
+      (err, buf) => {
+        if(err) {
+          return reject(err);
+        }
+
+        resolve(sorted.map((gpio, index) =>
+          Object.assign({gpio}, decode(buf, index * 8))));
+      });
+  });
+};
+
 module.exports = {
   DHT_GOOD,
   DHT_BAD_CHECKSUM,
   DHT_BAD_DATA,
-  dht22
+  dht22,
+  dht22Sweep
 };
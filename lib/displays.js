@@ -0,0 +1,68 @@
+'use strict';
+
+// PCA9685 (PWM, servos) and MAX7219 (LED matrices) with the frame in native
+// memory: javascript writes into the typed array and commit()s a completed
+// frame; refresh() (which commits itself) or the native refresh thread
+// (start(fps)) sends what changed in the committed frame.
+
+const pigpiod = require('../lib/bindings.js');
+
+const DEFAULT_FREQUENCY = 50;      // Hz, servos
+const DEFAULT_BAUD      = 1000000;
+const DEFAULT_INTENSITY = 7;
+
+const PCA9685_FULL  = 0x1000;
+const PCA9685_STEPS = 4096;
+
+// options: {frequency [Hz]}
+// channels: on and off count of each of the 16 channels. With start(fps),
+// commit() after setting the channels.
+const pca9685 = function(pi, bus, address, options) {
+  const opts   = options || {};
+  const device = new pigpiod.Pca9685(pi, bus, address,
+    opts.frequency || DEFAULT_FREQUENCY);
+  const frame  = device.frame();
+  const period = 1e6 / (opts.frequency || DEFAULT_FREQUENCY); // us
+
+  device.channels = new Uint16Array(frame.buffer, frame.byteOffset, 32);
+
+  // Duty cycle 0..1 of the channel.
+  device.setDuty = function(channel, duty) {
+    const off = Math.round(Math.min(Math.max(duty, 0), 1) * PCA9685_STEPS);
+
+    if(off >= PCA9685_STEPS) {
+      this.channels[channel * 2]     = PCA9685_FULL;
+      this.channels[channel * 2 + 1] = 0;
+    } else {
+      this.channels[channel * 2]     = 0;
+      this.channels[channel * 2 + 1] = off === 0 ? PCA9685_FULL : off;
+    }
+  };
+
+  // Pulse width [us] of the channel, e.g. 1000..2000 for a servo.
+  device.setPulse = function(channel, width) {
+    this.setDuty(channel, width / period);
+  };
+
+  return device;
+};
+
+// options: {baud, intensity (0..15)}
+// rows: 8 rows per device, device 0 first in the chain, bit 7 column 0.
+// With start(fps), commit() after drawing a frame.
+const max7219 = function(pi, channel, devices, options) {
+  const opts   = options || {};
+  const device = new pigpiod.Max7219(pi, channel, opts.baud || DEFAULT_BAUD,
+    devices,
+    opts.intensity === undefined ? DEFAULT_INTENSITY : opts.intensity);
+  const frame  = device.frame();
+
+  device.rows = new Uint8Array(frame.buffer, frame.byteOffset, frame.length);
+
+  return device;
+};
+
+module.exports = {
+  pca9685,
+  max7219
+};
@@ -1,7 +1,15 @@
 'use strict';
 
-const pigpiod = require('./bindings');
-const dht22   = require('./dht22');
-const mcp3204 = require('./mcp3204');
+const pigpiod      = require('./bindings');
+const dht22        = require('./dht22');
+const displays     = require('./displays');
+const mcp3204      = require('./mcp3204');
+const sampler      = require('./sampler');
+const schedule     = require('./schedule');
+const serialReader = require('./serialReader');
+const stats        = require('./stats');
+const transaction  = require('./transaction');
+const waitForEdge  = require('./waitForEdge');
 
-module.exports = Object.assign({}, pigpiod, dht22, mcp3204);
+module.exports = Object.assign({}, pigpiod, dht22, displays, mcp3204,
+  sampler, schedule, serialReader, stats, transaction, waitForEdge);
@@ -0,0 +1,87 @@
+'use strict';
+
+// Periodic sampling of GPIOs without reliable edges, e.g. slow comparators.
+// A native thread reads the levels on a fixed schedule; only the changes
+// get to javascript, in batches.
+
+/* eslint-disable no-bitwise */
+
+const EventEmitter = require('events');
+
+const pigpiod = require('../lib/bindings.js');
+
+const RECORD_SIZE       = 16;
+const DEFAULT_BATCH     = 1;
+const DEFAULT_MAX_DELAY = 100; // ms
+
+// Emits
+//   'change' {time, levels, changed} per sample with a changed level, with
+//            time [us] on the clock of process.hrtime(), levels and changed
+//            as bitmasks of the GPIOs; the first sample reports all GPIOs
+//            as changed,
+//   'error'  on a read error, which stops the sampler.
+class Sampler extends EventEmitter {
+  constructor(pi, mask, period, options) {
+    super();
+
+    const opts = options || {};
+
+    this.samplerId = pigpiod.sampler_start(pi, mask >>> 0, period,
+      opts.batch || DEFAULT_BATCH,
+      opts.maxDelay === undefined ? DEFAULT_MAX_DELAY : opts.maxDelay,
+      (err, records) => {
+        if(err) {
+          this.samplerId = null;
+          this.emit('error', err);
+
+          return;
+        }
+
+        for(let offset = 0; offset < records.length; offset += RECORD_SIZE) {
+          this.emit('change', {
+            time: records.readUInt32LE(offset + 4) * 0x100000000 +
+                  records.readUInt32LE(offset),
+            levels:  records.readUInt32LE(offset + 8),
+            changed: records.readUInt32LE(offset + 12)
+          });
+        }
+      });
+  }
+
+  // {samples, records, dropped, missed, buffered, jitter, read}, see
+  // sampler_stats().
+  stats() {
+    return this.samplerId === null ?
+      null :
+      pigpiod.sampler_stats(this.samplerId);
+  }
+
+  stop() {
+    if(this.samplerId !== null) {
+      pigpiod.sampler_stop(this.samplerId);
+      this.samplerId = null;
+    }
+  }
+}
+
+// Samples gpios (a GPIO or an array of GPIOs of bank 1) every period [us].
+// options: {batch [records], maxDelay [ms]}, a batch is delivered once
+// complete, or when its oldest record waited maxDelay.
+const sampler = function(pi, gpios, period, options) {
+  const gpioList = Array.isArray(gpios) ? gpios : [gpios];
+  let   mask     = 0;
+
+  for(const gpio of gpioList) {
+    if(gpio < 0 || gpio > 31) {
+      throw new Error(`Invalid GPIO ${gpio}`);
+    }
+    mask |= 1 << gpio;
+  }
+
+  return new Sampler(pi, mask, period, options);
+};
+
+module.exports = {
+  Sampler,
+  sampler
+};
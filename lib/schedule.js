@@ -0,0 +1,122 @@
+'use strict';
+
+// Output schedules: timed changes of GPIO levels, run natively in a
+// dedicated thread, or as daemon waves where the timing is tighter than the
+// host can guarantee (see schedule_run()).
+
+/* eslint-disable no-bitwise */
+
+const pigpiod = require('../lib/bindings.js');
+
+const ENTRY_SIZE  = 24;
+const RESULT_SIZE = 12;
+
+const DEFAULT_WAVE_THRESHOLD = 2000; // us
+
+class Schedule {
+  constructor() {
+    this.entries    = [];
+    this.scheduleId = null;
+  }
+
+  // levels: {gpio: level, ...} of GPIOs of bank 1
+  add(flags, time, levels) {
+    let mask = 0;
+    let bits = 0;
+
+    for(const key of Object.keys(levels)) {
+      const gpio = Number(key);
+
+      if(!Number.isInteger(gpio) || gpio < 0 || gpio > 31) {
+        throw new Error(`Invalid GPIO ${key}`);
+      }
+      mask |= 1 << gpio;
+      if(levels[key]) {
+        bits |= 1 << gpio;
+      }
+    }
+
+    this.entries.push({flags, time, mask: mask >>> 0, levels: bits >>> 0});
+
+    return this;
+  }
+
+  // Changes the levels delay [us] after the previous entry (or the start).
+  after(delay, levels) {
+    return this.add(0, delay, levels);
+  }
+
+  // Changes the levels at the extended tick (see clock_get(), callback()).
+  at(tick64, levels) {
+    return this.add(pigpiod.SCHED_FLAG_TICK, tick64, levels);
+  }
+
+  toBuffer() {
+    const list = Buffer.alloc(this.entries.length * ENTRY_SIZE);
+
+    this.entries.forEach((entry, index) => {
+      const offset = index * ENTRY_SIZE;
+
+      list.writeUInt8(entry.flags, offset);
+      list.writeUInt32LE(entry.mask, offset + 4);
+      list.writeUInt32LE(entry.levels, offset + 8);
+      list.writeUInt32LE(entry.time % 0x100000000, offset + 16);
+      list.writeUInt32LE(Math.floor(entry.time / 0x100000000), offset + 20);
+    });
+
+    return list;
+  }
+
+  // options: {waveThreshold [us]}, entries closer together are sent as a
+  // daemon wave, 0 to never use waves.
+  // Resolves with one {rc, lateness [us], wave} per executed entry.
+  run(pi, options) {
+    const opts = options || {};
+    const list = this.toBuffer();
+
+    return new Promise((resolve, reject) => {
+      this.scheduleId = pigpiod.schedule_run(pi, list,
+        opts.waveThreshold === undefined ?
+          DEFAULT_WAVE_THRESHOLD :
+          opts.waveThreshold,
+        (err, results, executed) => {
+          this.scheduleId = null;
+          if(err) {
+            return reject(err);
+          }
+
+          const parsed = [];
+
+          for(let i = 0; i < executed; i++) {
+            const offset = i * RESULT_SIZE;
+
+            parsed.push({
+              rc:       results.readInt32LE(offset),
+              lateness: results.readInt32LE(offset + 4),
+              wave:     Boolean(results.readUInt32LE(offset + 8) &
+                                pigpiod.SCHED_RESULT_WAVE)
+            });
+          }
+
+          resolve(parsed);
+        });
+    });
+  }
+
+  // Skips the rest of a running schedule, run() resolves with the results
+  // so far.
+  cancel() {
+    if(this.scheduleId !== null) {
+      pigpiod.schedule_cancel(this.scheduleId);
+    }
+  }
+}
+
+const schedule = function() {
+  return new Schedule();
+};
+
+module.exports = {
+  Schedule,
+  schedule
+};
@@ -0,0 +1,101 @@
+'use strict';
+
+// Readable streams of serial data, from a UART (serial_open()) or from a
+// GPIO with bit-banged serial (bb_serial_read_open()).
+// The data is drained natively in a background thread, so javascript
+// neither polls nor blocks on the daemon.
+
+const stream = require('stream');
+
+const pigpiod = require('../lib/bindings.js');
+
+const DEFAULT_RING_SIZE = 8192; // bytes
+const DEFAULT_INTERVAL  = 10;   // ms
+
+class SerialReader extends stream.Readable {
+  // source: pigpiod.SERIAL_SOURCE_TTY with a serial handle, or
+  //         pigpiod.SERIAL_SOURCE_BB with a GPIO.
+  // close:  function to release the handle, called on close().
+  constructor(pi, source, handle, options, close) {
+    super();
+
+    const opts = options || {};
+
+    this.pi          = pi;
+    this.handle      = handle;
+    this.closeHandle = close;
+    this.readerId    = pigpiod.serial_reader_start(pi, source, handle,
+      opts.ringSize || DEFAULT_RING_SIZE, opts.interval || DEFAULT_INTERVAL,
+      (err, data) => {
+        if(err) {
+          this.readerId = null;
+          this.close();
+          this.emit('error', err);
+        } else {
+          this.push(data);
+        }
+      });
+  }
+
+  _read() {
+    // the data is pushed as it arrives
+  }
+
+  // {buffered, received, dropped} in bytes, dropped on ring overflow.
+  stats() {
+    return this.readerId === null ?
+      null :
+      pigpiod.serial_reader_stats(this.readerId);
+  }
+
+  close() {
+    if(this.readerId !== null) {
+      pigpiod.serial_reader_stop(this.readerId);
+      this.readerId = null;
+    }
+    if(this.closeHandle) {
+      this.closeHandle();
+      this.closeHandle = null;
+      this.push(null);
+    }
+  }
+}
+
+// options: {flags, ringSize [bytes], interval [ms]}
+const serialReader = function(pi, tty, baud, options) {
+  const opts   = options || {};
+  const handle = pigpiod.serial_open(pi, tty, baud, opts.flags || 0);
+
+  try {
+    return new SerialReader(pi, pigpiod.SERIAL_SOURCE_TTY, handle, opts,
+      () => pigpiod.serial_close(pi, handle));
+  } catch(err) {
+    pigpiod.serial_close(pi, handle);
+    throw err;
+  }
+};
+
+// options: {dataBits (default 8), invert, ringSize [bytes], interval [ms]}
+const bbSerialReader = function(pi, gpio, baud, options) {
+  const opts = options || {};
+
+  pigpiod.bb_serial_read_open(pi, gpio, baud, opts.dataBits || 8);
+
+  try {
+    if(opts.invert) {
+      pigpiod.bb_serial_invert(pi, gpio, 1);
+    }
+
+    return new SerialReader(pi, pigpiod.SERIAL_SOURCE_BB, gpio, opts,
+      () => pigpiod.bb_serial_read_close(pi, gpio));
+  } catch(err) {
+    pigpiod.bb_serial_read_close(pi, gpio);
+    throw err;
+  }
+};
+
+module.exports = {
+  SerialReader,
+  serialReader,
+  bbSerialReader
+};
@@ -0,0 +1,874 @@
+'use strict';
+
+// Stand-in for the pigpio daemon, to test and benchmark without a
+// Raspberry Pi. It speaks the pigpiod socket protocol (as used by
+// pigpiod_if2 and so by this module), listening on a TCP port or on
+// a Unix socket, and simulates
+// - GPIO levels, modes, pull up/down, watchdogs and trigger pulses,
+// - SPI as loopback (the received data is the transmitted data),
+// - serial devices as echo (the written data can be read back),
+// - bit bang serial reads of scripted data,
+// - bit bang SPI as loopback, bit bang I2C with simulated devices,
+// - scripted edge streams at configurable rates,
+// - DHT22 sensors, answering the read trigger with the DHT22 pulse train.
+//
+// The stand-in has to run in a separate process from the code using
+// the bindings, as the bindings block the event loop while waiting for
+// the daemon's response.
+
+/* eslint-disable no-bitwise */
+
+const EventEmitter = require('events');
+const net          = require('net');
+
+// Command codes, see pigpio.h
+const PI_CMD_MODES = 0;
+const PI_CMD_MODEG = 1;
+const PI_CMD_PUD   = 2;
+const PI_CMD_READ  = 3;
+const PI_CMD_WRITE = 4;
+const PI_CMD_WDOG  = 9;
+const PI_CMD_BR1   = 10;
+const PI_CMD_BR2   = 11;
+const PI_CMD_BC1   = 12;
+const PI_CMD_BS1   = 14;
+const PI_CMD_TICK  = 16;
+const PI_CMD_HWVER = 17;
+const PI_CMD_NO    = 18;
+const PI_CMD_NB    = 19;
+const PI_CMD_NP    = 20;
+const PI_CMD_NC    = 21;
+const PI_CMD_PIGPV = 26;
+const PI_CMD_TRIG  = 37;
+const PI_CMD_SLRO  = 42;
+const PI_CMD_SLR   = 43;
+const PI_CMD_SLRC  = 44;
+const PI_CMD_SPIO  = 71;
+const PI_CMD_SPIC  = 72;
+const PI_CMD_SPIR  = 73;
+const PI_CMD_SPIW  = 74;
+const PI_CMD_SPIX  = 75;
+const PI_CMD_SERO  = 76;
+const PI_CMD_SERC  = 77;
+const PI_CMD_SERRB = 78;
+const PI_CMD_SERWB = 79;
+const PI_CMD_SERR  = 80;
+const PI_CMD_SERW  = 81;
+const PI_CMD_SERDA = 82;
+const PI_CMD_BI2CC = 89;
+const PI_CMD_BI2CO = 90;
+const PI_CMD_BI2CZ = 91;
+const PI_CMD_FG    = 97;
+const PI_CMD_FN    = 98;
+const PI_CMD_SLRI  = 94;
+const PI_CMD_NOIB  = 99;
+const PI_CMD_BSPIC = 111;
+const PI_CMD_BSPIO = 112;
+const PI_CMD_BSPIX = 113;
+
+// Error codes, see pigpio.h
+const PI_BAD_USER_GPIO     = -2;
+const PI_BAD_GPIO          = -3;
+const PI_BAD_MODE          = -4;
+const PI_BAD_LEVEL         = -5;
+const PI_BAD_PUD           = -6;
+const PI_BAD_WDOG_TIMEOUT  = -15;
+const PI_BAD_HANDLE        = -25;
+const PI_NOT_SERIAL_GPIO   = -38;
+const PI_GPIO_IN_USE       = -50;
+const PI_I2C_WRITE_FAILED  = -82;
+const PI_I2C_READ_FAILED   = -83;
+const PI_SER_READ_NO_DATA  = -87;
+const PI_UNKNOWN_COMMAND   = -88;
+const PI_NOT_SPI_GPIO      = -142;
+const PI_NOT_I2C_GPIO      = -143;
+
+// bb_i2c_zip() commands
+const I2C_END   = 0;
+const I2C_START = 2;
+const I2C_STOP  = 3;
+const I2C_ADDR  = 4;
+const I2C_READ  = 6;
+const I2C_WRITE = 7;
+
+const PI_INPUT  = 0;
+const PI_OUTPUT = 1;
+
+const PI_PUD_OFF  = 0;
+const PI_PUD_DOWN = 1;
+const PI_PUD_UP   = 2;
+
+const PI_MAX_USER_GPIO = 31;
+const PI_MAX_GPIO      = 53;
+
+const PI_NTFY_FLAGS_WDOG = 1 << 5;
+
+const HEADER_SIZE = 16;
+const REPORT_SIZE = 12;
+
+// Raspberry Pi 3 Model B, pigpio V79
+const DEFAULT_HW_REVISION    = 0xa02082;
+const DEFAULT_PIGPIO_VERSION = 79;
+
+
+
+class StandIn extends EventEmitter {
+  constructor(options) {
+    super();
+
+    const opts = options || {};
+
+    this.hwRevision    = opts.hwRevision || DEFAULT_HW_REVISION;
+    this.pigpioVersion = opts.pigpioVersion || DEFAULT_PIGPIO_VERSION;
+
+    this.startTime = process.hrtime();
+    this.levels    = 0; // bank 1
+    this.modes     = new Array(PI_MAX_GPIO + 1).fill(PI_INPUT);
+    this.puds      = new Array(PI_MAX_GPIO + 1).fill(PI_PUD_OFF);
+    this.watchdogs = {};
+    this.sensors   = {};
+    this.streams   = new Set();
+
+    this.notifyHandles  = new Map();
+    this.spiHandles     = new Map();
+    this.serialHandles  = new Map();
+    this.bbSerial       = {};
+    this.bbSpi          = {};
+    this.bbI2c          = {};
+    this.i2cDevices     = {};
+    this.nextHandle     = 0;
+
+    this.server  = net.createServer(socket => this.connection(socket));
+    this.sockets = new Set();
+  }
+
+  // port: TCP port number, or path of a Unix socket (without host)
+  listen(port, host, callback) {
+    const onListening = () => {
+      this.emit('listening', this.server.address());
+      if(callback) {
+        callback();
+      }
+    };
+
+    if(typeof host === 'function') {
+      return this.listen(port, undefined, host);
+    }
+
+    if(host === undefined) {
+      this.server.listen(port, onListening);
+    } else {
+      this.server.listen(port, host, onListening);
+    }
+
+    return this;
+  }
+
+  close(callback) {
+    for(const stream of this.streams) {
+      stream.stop();
+    }
+    for(const gpio of Object.keys(this.watchdogs)) {
+      clearTimeout(this.watchdogs[gpio].timer);
+    }
+    for(const socket of this.sockets) {
+      socket.destroy();
+    }
+    this.server.close(callback);
+  }
+
+  // Current tick, microseconds since the start, wrapping at 32 bit.
+  tick() {
+    const time = process.hrtime(this.startTime);
+
+    return (time[0] * 1000000 + Math.floor(time[1] / 1000)) >>> 0;
+  }
+
+
+
+  // #########################################################################
+  // Simulation control
+
+  // Sets the level of a GPIO, as if driven by external hardware.
+  setLevel(gpio, level, tick) {
+    const reportTick = tick === undefined ? this.tick() : tick;
+    const mask       = 1 << gpio;
+    const levels     = (level ? this.levels | mask : this.levels & ~mask) >>> 0;
+
+    if(gpio > PI_MAX_USER_GPIO || levels === this.levels) {
+      return;
+    }
+
+    this.levels = levels;
+    this.report(0, reportTick, mask);
+    this.restartWatchdog(gpio);
+  }
+
+  getLevel(gpio) {
+    if(gpio > PI_MAX_USER_GPIO) {
+      return 0;
+    }
+
+    return (this.levels >>> gpio) & 1;
+  }
+
+  // Sends a sequence of level changes on a GPIO at once, with the ticks
+  // spaced as given by the delays [us]: edges = [[level, delay], ...]
+  pulseTrain(gpio, edges) {
+    let tick = this.tick();
+
+    for(const edge of edges) {
+      tick = (tick + edge[1]) >>> 0;
+      this.setLevel(gpio, edge[0], tick);
+    }
+  }
+
+  // Toggles a GPIO with <rate> edges per second, with evenly spaced ticks.
+  // The edges are sent in batches, each millisecond.
+  // Returns an object with stop() and the number of edges sent so far.
+  edgeStream(gpio, options) {
+    const opts      = options || {};
+    const rate      = opts.rate || 1000;
+    const count     = opts.count === undefined ? Infinity : opts.count;
+    const startTick = this.tick();
+    const startTime = process.hrtime();
+    const stream    = {sent: 0};
+
+    const interval = setInterval(() => {
+      const elapsed = process.hrtime(startTime);
+      const due     = Math.min(count,
+        Math.floor((elapsed[0] + elapsed[1] / 1e9) * rate));
+
+      while(stream.sent < due) {
+        stream.sent++;
+        this.setLevel(gpio, this.getLevel(gpio) ? 0 : 1,
+          (startTick + Math.round(stream.sent * 1e6 / rate)) >>> 0);
+      }
+
+      if(stream.sent >= count) {
+        stream.stop();
+        this.emit('streamEnd', gpio, stream.sent);
+      }
+    }, 1);
+
+    stream.stop = () => {
+      clearInterval(interval);
+      this.streams.delete(stream);
+    };
+    this.streams.add(stream);
+
+    return stream;
+  }
+
+  // Queues data for a bit bang serial read (bb_serial_read_open) on a GPIO,
+  // as if received from a device. Data written before the GPIO has been
+  // opened is discarded.
+  bbSerialData(gpio, data) {
+    const reader = this.bbSerial[gpio];
+
+    if(reader) {
+      reader.rx.push(...Buffer.from(data));
+    }
+  }
+
+  // Attaches a simulated device to a bit bang I2C bus. Reads return the
+  // bytes of data, cyclically; the written bytes are collected in written.
+  i2cDevice(sda, address, data) {
+    const device = {data: Buffer.from(data || [0]), pos: 0, written: []};
+
+    this.i2cDevices[`${sda}:${address}`] = device;
+
+    return device;
+  }
+
+  // Runs the bb_i2c_zip() commands, returns the result and the data read.
+  i2cZip(sda, commands) {
+    const read = [];
+    let   device;
+
+    for(let i = 0; i < commands.length; i++) {
+      switch(commands[i]) {
+        case I2C_END:
+          return {res: read.length, data: Buffer.from(read)};
+
+        case I2C_START:
+        case I2C_STOP:
+          break;
+
+        case I2C_ADDR:
+          device = this.i2cDevices[`${sda}:${commands[++i]}`];
+          break;
+
+        case I2C_READ: {
+          const count = commands[++i];
+
+          if(!device) {
+            return {res: PI_I2C_READ_FAILED};
+          }
+          for(let byte = 0; byte < count; byte++) {
+            read.push(device.data[device.pos]);
+            device.pos = (device.pos + 1) % device.data.length;
+          }
+          break;
+        }
+
+        case I2C_WRITE: {
+          const count = commands[++i];
+
+          if(!device) {
+            return {res: PI_I2C_WRITE_FAILED};
+          }
+          device.written.push(...commands.slice(i + 1, i + 1 + count));
+          i += count;
+          break;
+        }
+
+        default:
+          return {res: PI_UNKNOWN_COMMAND};
+      }
+    }
+
+    return {res: read.length, data: Buffer.from(read)};
+  }
+
+  // Attaches a simulated DHT22 sensor to a GPIO. It answers the read
+  // trigger (GPIO set to output, low, and back to input) with a pulse train.
+  dht22(gpio, values) {
+    this.sensors[gpio] = Object.assign(
+      {type: 'dht22', temperature: 20, humidity: 50}, values);
+    this.puds[gpio] = PI_PUD_UP;
+    this.setLevel(gpio, 1);
+  }
+
+  dht22Response(gpio) {
+    const sensor      = this.sensors[gpio];
+    const humidity    = Math.round(sensor.humidity * 10) & 0xffff;
+    const temperature = sensor.temperature < 0 ?
+      0x8000 | Math.round(-sensor.temperature * 10) :
+      Math.round(sensor.temperature * 10);
+    const bytes = [
+      humidity >> 8, humidity & 0xff,
+      temperature >> 8, temperature & 0xff
+    ];
+    const edges = [];
+
+    bytes.push((bytes[0] + bytes[1] + bytes[2] + bytes[3]) & 0xff);
+
+    // released by the host, the sensor answers with 80us low, 80us high
+    edges.push([1, 0], [0, 30], [1, 80], [0, 80]);
+
+    // 40 bits, each 50us low and 26us (0) or 70us (1) high
+    for(const byte of bytes) {
+      for(let bit = 7; bit >= 0; bit--) {
+        edges.push([1, 50], [0, (byte >> bit) & 1 ? 70 : 26]);
+      }
+    }
+
+    // end of transmission, 50us low and release the line
+    edges.push([1, 50]);
+
+    this.pulseTrain(gpio, edges);
+  }
+
+
+
+  // #########################################################################
+  // Notifications
+
+  // Sends a report to all notification handles watching one of the
+  // GPIOs in mask (all for 0).
+  report(flags, tick, mask) {
+    for(const handle of this.notifyHandles.values()) {
+      if(handle.paused || (mask && !(handle.bits & mask))) {
+        continue;
+      }
+
+      const report = Buffer.allocUnsafe(REPORT_SIZE);
+
+      report.writeUInt16LE(handle.seqno, 0);
+      report.writeUInt16LE(flags, 2);
+      report.writeUInt32LE(tick >>> 0, 4);
+      report.writeUInt32LE(this.levels, 8);
+      handle.seqno = (handle.seqno + 1) & 0xffff;
+
+      handle.pending.push(report);
+      if(handle.pending.length === 1) {
+        // send the reports of this event loop iteration in one write
+        setImmediate(() => {
+          if(!handle.socket.destroyed) {
+            handle.socket.write(Buffer.concat(handle.pending));
+          }
+          handle.pending = [];
+        });
+      }
+    }
+  }
+
+  restartWatchdog(gpio) {
+    const watchdog = this.watchdogs[gpio];
+
+    if(!watchdog) {
+      return;
+    }
+
+    clearTimeout(watchdog.timer);
+    watchdog.timer = setTimeout(() => {
+      this.report(PI_NTFY_FLAGS_WDOG | gpio, this.tick(), 1 << gpio);
+      this.restartWatchdog(gpio);
+    }, watchdog.timeout);
+  }
+
+
+
+  // #########################################################################
+  // Socket protocol
+
+  connection(socket) {
+    let buffer = Buffer.alloc(0);
+
+    this.sockets.add(socket);
+    socket.setNoDelay(true);
+
+    socket.on('data', data => {
+      buffer = buffer.length ? Buffer.concat([buffer, data]) : data;
+
+      while(buffer.length >= HEADER_SIZE) {
+        // p3 is the length of the extension following the header
+        const extLength = buffer.readUInt32LE(12);
+
+        if(buffer.length < HEADER_SIZE + extLength) {
+          break;
+        }
+
+        const cmd = buffer.readUInt32LE(0);
+        const p1  = buffer.readUInt32LE(4);
+        const p2  = buffer.readUInt32LE(8);
+        const ext = buffer.slice(HEADER_SIZE, HEADER_SIZE + extLength);
+
+        buffer = buffer.slice(HEADER_SIZE + extLength);
+
+        const result   = this.command(socket, cmd, p1, p2, ext);
+        const response = Buffer.allocUnsafe(HEADER_SIZE);
+
+        response.writeUInt32LE(cmd, 0);
+        response.writeUInt32LE(p1, 4);
+        response.writeUInt32LE(p2, 8);
+        response.writeUInt32LE(result.res >>> 0, 12);
+
+        socket.write(result.data ?
+          Buffer.concat([response, result.data]) : response);
+
+        if(result.after) {
+          result.after();
+        }
+      }
+    });
+
+    socket.on('close', () => {
+      this.sockets.delete(socket);
+      for(const [handle, notify] of this.notifyHandles) {
+        if(notify.socket === socket) {
+          this.notifyHandles.delete(handle);
+        }
+      }
+    });
+
+    socket.on('error', () => {
+      // the client went away, handled by 'close'
+    });
+  }
+
+  command(socket, cmd, p1, p2, ext) {
+    const gpio = p1;
+
+    this.emit('command', cmd, p1, p2, ext);
+
+    switch(cmd) {
+      case PI_CMD_MODES: {
+        if(gpio > PI_MAX_GPIO) {
+          return {res: PI_BAD_GPIO};
+        }
+        if(p2 > 7) {
+          return {res: PI_BAD_MODE};
+        }
+
+        const previous = this.modes[gpio];
+
+        this.modes[gpio] = p2;
+
+        if(p2 === PI_INPUT && previous === PI_OUTPUT) {
+          const sensor = this.sensors[gpio];
+
+          if(sensor && !this.getLevel(gpio)) {
+            return {res: 0, after: () => this.dht22Response(gpio)};
+          }
+
+          return {res: 0, after: () => this.applyPud(gpio)};
+        }
+
+        return {res: 0};
+      }
+
+      case PI_CMD_MODEG:
+        if(gpio > PI_MAX_GPIO) {
+          return {res: PI_BAD_GPIO};
+        }
+
+        return {res: this.modes[gpio]};
+
+      case PI_CMD_PUD:
+        if(gpio > PI_MAX_GPIO) {
+          return {res: PI_BAD_GPIO};
+        }
+        if(p2 > PI_PUD_UP) {
+          return {res: PI_BAD_PUD};
+        }
+        this.puds[gpio] = p2;
+
+        return {res: 0, after: () => this.applyPud(gpio)};
+
+      case PI_CMD_READ:
+        if(gpio > PI_MAX_GPIO) {
+          return {res: PI_BAD_GPIO};
+        }
+
+        return {res: this.getLevel(gpio)};
+
+      case PI_CMD_WRITE:
+        if(gpio > PI_MAX_GPIO) {
+          return {res: PI_BAD_GPIO};
+        }
+        if(p2 > 1) {
+          return {res: PI_BAD_LEVEL};
+        }
+        // like pigpio, writing switches the GPIO to output
+        this.modes[gpio] = PI_OUTPUT;
+
+        return {res: 0, after: () => this.setLevel(gpio, p2)};
+
+      case PI_CMD_WDOG:
+        if(gpio > PI_MAX_USER_GPIO) {
+          return {res: PI_BAD_USER_GPIO};
+        }
+        if(p2 > 60000) {
+          return {res: PI_BAD_WDOG_TIMEOUT};
+        }
+        if(this.watchdogs[gpio]) {
+          clearTimeout(this.watchdogs[gpio].timer);
+          delete this.watchdogs[gpio];
+        }
+        if(p2) {
+          this.watchdogs[gpio] = {timeout: p2};
+          this.restartWatchdog(gpio);
+        }
+
+        return {res: 0};
+
+      case PI_CMD_BR1:
+        return {res: this.levels};
+
+      case PI_CMD_BR2:
+        return {res: 0};
+
+      case PI_CMD_BC1:
+      case PI_CMD_BS1:
+        return {res: 0, after: () => {
+          for(let bit = 0; bit <= PI_MAX_USER_GPIO; bit++) {
+            if(p1 & (1 << bit)) {
+              this.setLevel(bit, cmd === PI_CMD_BS1 ? 1 : 0);
+            }
+          }
+        }};
+
+      case PI_CMD_TICK:
+        return {res: this.tick()};
+
+      case PI_CMD_HWVER:
+        return {res: this.hwRevision};
+
+      case PI_CMD_PIGPV:
+        return {res: this.pigpioVersion};
+
+      case PI_CMD_NO:
+        // pigpiod reports to the pipe /dev/pigpioN on its own host, which
+        // the stand-in doesn't create. Reporting on the socket instead would
+        // mix the reports into the command responses.
+        return {res: PI_UNKNOWN_COMMAND};
+
+      case PI_CMD_NOIB: {
+        const handle = this.nextHandle++;
+
+        this.notifyHandles.set(handle,
+          {socket, bits: 0, paused: true, seqno: 0, pending: []});
+
+        return {res: handle};
+      }
+
+      case PI_CMD_NB: {
+        const handle = this.notifyHandles.get(p1);
+
+        if(!handle) {
+          return {res: PI_BAD_HANDLE};
+        }
+        handle.bits   = p2;
+        handle.paused = false;
+
+        return {res: 0};
+      }
+
+      case PI_CMD_NP: {
+        const handle = this.notifyHandles.get(p1);
+
+        if(!handle) {
+          return {res: PI_BAD_HANDLE};
+        }
+        handle.paused = true;
+
+        return {res: 0};
+      }
+
+      case PI_CMD_NC:
+        if(!this.notifyHandles.delete(p1)) {
+          return {res: PI_BAD_HANDLE};
+        }
+
+        return {res: 0};
+
+      case PI_CMD_TRIG: {
+        if(gpio > PI_MAX_USER_GPIO) {
+          return {res: PI_BAD_USER_GPIO};
+        }
+
+        const level = ext.length >= 4 ? ext.readUInt32LE(0) : 1;
+
+        return {res: 0, after: () => {
+          const tick = this.tick();
+
+          this.setLevel(gpio, level, tick);
+          this.setLevel(gpio, level ? 0 : 1, (tick + p2) >>> 0);
+        }};
+      }
+
+      case PI_CMD_FG:
+      case PI_CMD_FN:
+        if(gpio > PI_MAX_USER_GPIO) {
+          return {res: PI_BAD_USER_GPIO};
+        }
+
+        return {res: 0};
+
+      case PI_CMD_SPIO:
+        return {res: this.openHandle(this.spiHandles, {channel: p1})};
+
+      case PI_CMD_SPIC:
+        return {res: this.closeHandle(this.spiHandles, p1)};
+
+      case PI_CMD_SPIR:
+        if(!this.spiHandles.has(p1)) {
+          return {res: PI_BAD_HANDLE};
+        }
+
+        return {res: p2, data: Buffer.alloc(p2)};
+
+      case PI_CMD_SPIW:
+        if(!this.spiHandles.has(p1)) {
+          return {res: PI_BAD_HANDLE};
+        }
+
+        return {res: ext.length};
+
+      case PI_CMD_SPIX:
+        if(!this.spiHandles.has(p1)) {
+          return {res: PI_BAD_HANDLE};
+        }
+
+        // loopback, MISO connected to MOSI
+        return {res: ext.length, data: Buffer.from(ext)};
+
+      case PI_CMD_SLRO:
+        if(gpio > PI_MAX_USER_GPIO) {
+          return {res: PI_BAD_USER_GPIO};
+        }
+        if(this.bbSerial[gpio]) {
+          return {res: PI_GPIO_IN_USE};
+        }
+        this.bbSerial[gpio] = {baud: p2, rx: [], invert: 0};
+
+        return {res: 0};
+
+      case PI_CMD_SLR: {
+        const reader = this.bbSerial[gpio];
+
+        if(!reader) {
+          return {res: PI_NOT_SERIAL_GPIO};
+        }
+
+        const data = Buffer.from(reader.rx.splice(0, p2));
+
+        return {res: data.length, data};
+      }
+
+      case PI_CMD_SLRC:
+      case PI_CMD_SLRI:
+        if(!this.bbSerial[gpio]) {
+          return {res: PI_NOT_SERIAL_GPIO};
+        }
+        if(cmd === PI_CMD_SLRC) {
+          delete this.bbSerial[gpio];
+        } else {
+          this.bbSerial[gpio].invert = p2;
+        }
+
+        return {res: 0};
+
+      case PI_CMD_BSPIO:
+        if(this.bbSpi[p1]) {
+          return {res: PI_GPIO_IN_USE};
+        }
+        this.bbSpi[p1] = {baud: p2};
+
+        return {res: 0};
+
+      case PI_CMD_BSPIC:
+        if(!this.bbSpi[p1]) {
+          return {res: PI_NOT_SPI_GPIO};
+        }
+        delete this.bbSpi[p1];
+
+        return {res: 0};
+
+      case PI_CMD_BSPIX:
+        if(!this.bbSpi[p1]) {
+          return {res: PI_NOT_SPI_GPIO};
+        }
+
+        // loopback, MISO connected to MOSI
+        return {res: ext.length, data: Buffer.from(ext)};
+
+      case PI_CMD_BI2CO:
+        if(this.bbI2c[p1]) {
+          return {res: PI_GPIO_IN_USE};
+        }
+        this.bbI2c[p1] = {scl: p2};
+
+        return {res: 0};
+
+      case PI_CMD_BI2CC:
+        if(!this.bbI2c[p1]) {
+          return {res: PI_NOT_I2C_GPIO};
+        }
+        delete this.bbI2c[p1];
+
+        return {res: 0};
+
+      case PI_CMD_BI2CZ:
+        if(!this.bbI2c[p1]) {
+          return {res: PI_NOT_I2C_GPIO};
+        }
+
+        return this.i2cZip(p1, ext);
+
+      case PI_CMD_SERO:
+        return {res: this.openHandle(this.serialHandles,
+          {tty: ext.toString(), rx: []})};
+
+      case PI_CMD_SERC:
+        return {res: this.closeHandle(this.serialHandles, p1)};
+
+      case PI_CMD_SERWB:
+      case PI_CMD_SERW: {
+        const serial = this.serialHandles.get(p1);
+
+        if(!serial) {
+          return {res: PI_BAD_HANDLE};
+        }
+
+        // echo, TX connected to RX
+        if(cmd === PI_CMD_SERWB) {
+          serial.rx.push(p2 & 0xff);
+        } else {
+          serial.rx.push(...ext);
+        }
+
+        return {res: 0};
+      }
+
+      case PI_CMD_SERRB:
+      case PI_CMD_SERR: {
+        const serial = this.serialHandles.get(p1);
+
+        if(!serial) {
+          return {res: PI_BAD_HANDLE};
+        }
+        if(!serial.rx.length) {
+          return {res: PI_SER_READ_NO_DATA};
+        }
+        if(cmd === PI_CMD_SERRB) {
+          return {res: serial.rx.shift()};
+        }
+
+        const data = Buffer.from(serial.rx.splice(0, p2));
+
+        return {res: data.length, data};
+      }
+
+      case PI_CMD_SERDA: {
+        const serial = this.serialHandles.get(p1);
+
+        if(!serial) {
+          return {res: PI_BAD_HANDLE};
+        }
+
+        return {res: serial.rx.length};
+      }
+
+      default:
+        return {res: PI_UNKNOWN_COMMAND};
+    }
+  }
+
+  // Input without external driver, the level follows the pull up/down.
+  applyPud(gpio) {
+    if(this.modes[gpio] !== PI_INPUT) {
+      return;
+    }
+
+    switch(this.puds[gpio]) {
+      case PI_PUD_UP:
+        this.setLevel(gpio, 1);
+        break;
+
+      case PI_PUD_DOWN:
+        this.setLevel(gpio, 0);
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  openHandle(handles, data) {
+    let handle = 0;
+
+    while(handles.has(handle)) {
+      handle++;
+    }
+    handles.set(handle, data);
+
+    return handle;
+  }
+
+  closeHandle(handles, handle) {
+    if(!handles.delete(handle)) {
+      return PI_BAD_HANDLE;
+    }
+
+    return 0;
+  }
+}
+
+
+
+module.exports = {
+  StandIn
+};
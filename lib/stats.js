@@ -0,0 +1,26 @@
+'use strict';
+
+// Snapshot of the native instrumentation.
+
+const pigpiod = require('../lib/bindings.js');
+
+// Returns
+//   calls:     per binding {calls, errors, latency} of the daemon round-trip
+//   callbacks: per GPIO the callback counters, the queue high-water mark and
+//              the dispatchLatency from receiving an edge to calling js
+//   waits:     {pending} waitForEdge() calls
+//   resources: per pi the number of live callbacks and spi, serial, i2c,
+//              bbSerial, bbSpi and bbI2c handles
+// All latencies are {count, mean, min, max, p50, p90, p99, p999} in us.
+const getStats = function() {
+  return pigpiod.stats_get();
+};
+
+const resetStats = function() {
+  pigpiod.stats_reset();
+};
+
+module.exports = {
+  getStats,
+  resetStats
+};
@@ -0,0 +1,147 @@
+'use strict';
+
+// Transaction lists: runs a list of SPI and bit bang SPI / I2C transfers
+// with one native call, off the event loop (see transaction_run()).
+
+/* eslint-disable no-bitwise */
+
+const pigpiod = require('../lib/bindings.js');
+
+// bb_i2c_zip() commands
+const I2C_END   = 0;
+const I2C_START = 2;
+const I2C_STOP  = 3;
+const I2C_ADDR  = 4;
+const I2C_READ  = 6;
+const I2C_WRITE = 7;
+
+const ENTRY_SIZE  = 12;
+const RESULT_SIZE = 8;
+
+class Transaction {
+  constructor() {
+    this.entries = [];
+  }
+
+  add(op, handle, tx, rxLen, flags) {
+    const data = tx ? Buffer.from(tx) : Buffer.alloc(0);
+
+    if(data.length > 0xffff || (rxLen || 0) > 0xffff) {
+      throw new Error('Transfer too long');
+    }
+
+    this.entries.push({op, handle, data, rxLen: rxLen || 0, flags: flags || 0});
+
+    return this;
+  }
+
+  // Full duplex transfer on a hardware SPI handle (spi_open()).
+  spiXfer(handle, tx, flags) {
+    return this.add(pigpiod.TX_OP_SPI_XFER, handle, tx, 0, flags);
+  }
+
+  // Full duplex transfer on a bit bang SPI bus (bb_spi_open()).
+  bbSpiXfer(cs, tx, flags) {
+    return this.add(pigpiod.TX_OP_BB_SPI_XFER, cs, tx, 0, flags);
+  }
+
+  // bb_i2c_zip() command sequence on a bit bang I2C bus (bb_i2c_open()),
+  // reading up to rxLen bytes.
+  bbI2cZip(sda, commands, rxLen, flags) {
+    return this.add(pigpiod.TX_OP_BB_I2C_ZIP, sda, commands, rxLen, flags);
+  }
+
+  // Write to, then read from an I2C device, e.g. a register address and
+  // its value.
+  bbI2cWriteRead(sda, address, tx, rxLen, flags) {
+    const commands = [I2C_ADDR, address];
+
+    if(tx && tx.length) {
+      commands.push(I2C_START, I2C_WRITE, tx.length, ...tx);
+    }
+    if(rxLen) {
+      commands.push(I2C_START, I2C_READ, rxLen);
+    }
+    commands.push(I2C_STOP, I2C_END);
+
+    return this.bbI2cZip(sda, commands, rxLen, flags);
+  }
+
+  delay(us) {
+    return this.add(pigpiod.TX_OP_DELAY, us);
+  }
+
+  toBuffer() {
+    const length = this.entries.reduce(
+      (total, entry) => total + ENTRY_SIZE + entry.data.length, 0);
+    const list   = Buffer.alloc(length);
+    let   offset = 0;
+
+    for(const entry of this.entries) {
+      list.writeUInt8(entry.op, offset);
+      list.writeUInt8(entry.flags, offset + 1);
+      list.writeUInt16LE(entry.data.length, offset + 2);
+      list.writeUInt16LE(entry.rxLen, offset + 4);
+      list.writeUInt32LE(entry.handle >>> 0, offset + 8);
+      entry.data.copy(list, offset + ENTRY_SIZE);
+      offset += ENTRY_SIZE + entry.data.length;
+    }
+
+    return list;
+  }
+
+  // Resolves with one {rc, data} per executed transfer; rc is the result
+  // of the pigpiod call (negative on error), data the bytes read.
+  run(pi) {
+    const list = this.toBuffer();
+
+    return new Promise((resolve, reject) => {
+      pigpiod.transaction_run(pi, list, (err, results, executed) => {
+        if(err) {
+          return reject(err);
+        }
+
+        const parsed = [];
+        let   offset = 0;
+
+        for(let i = 0; i < executed; i++) {
+          const rc     = results.readInt32LE(offset);
+          const length = results.readUInt32LE(offset + 4);
+
+          offset += RESULT_SIZE;
+          parsed.push({rc, data: results.slice(offset, offset + length)});
+          offset += length;
+        }
+
+        resolve(parsed);
+      });
+    });
+  }
+}
+
+const transaction = function() {
+  return new Transaction();
+};
+
+// Resolves with the addresses of the devices answering on a bit bang I2C
+// bus, probing with a one byte read, in one native call.
+const bbI2cScan = function(pi, sda, first, last) {
+  const from = first === undefined ? 0x03 : first;
+  const to   = last === undefined ? 0x77 : last;
+  const scan = new Transaction();
+
+  for(let address = from; address <= to; address++) {
+    scan.bbI2cWriteRead(sda, address, null, 1);
+  }
+
+  return scan.run(pi)
+  .then(results => results
+    .map((result, index) => (result.rc >= 0 ? from + index : null))
+    .filter(address => address !== null));
+};
+
+module.exports = {
+  Transaction,
+  transaction,
+  bbI2cScan
+};
@@ -0,0 +1,48 @@
+'use strict';
+
+// Waits for an edge on one or more GPIOs, without blocking the event loop.
+
+/* eslint-disable no-bitwise */
+
+const pigpiod = require('../lib/bindings.js');
+
+// Resolves with
+//   {timeout: false, gpio, level, tick, tick64, time} on the first matching
+//                                                     edge,
+//   {timeout: true, gpio, level: PI_TIMEOUT, tick, tick64, time} on a
+//                                  watchdog report (see set_watchdog()),
+//   {timeout: true} when timeout [ms] expired.
+// tick64 is the tick extended to 64 bit, time its time [ms since the epoch]
+// (see clock_get()).
+// gpios is a single GPIO or an array of GPIOs, e.g. to wait for
+// "any of these GPIOs goes low" with FALLING_EDGE.
+const waitForEdge = function(pi, gpios, edge, timeout) {
+  const gpioList = Array.isArray(gpios) ? gpios : [gpios];
+  let   mask     = 0;
+
+  for(const gpio of gpioList) {
+    if(gpio < 0 || gpio > pigpiod.PI_MAX_USER_GPIO) {
+      return Promise.reject(new Error(`Invalid GPIO ${gpio}`));
+    }
+    mask |= 1 << gpio;
+  }
+
+  return new Promise((resolve, reject) => {
+    try {
+      pigpiod.wait_for_edge_async(pi, mask >>> 0, edge, timeout || 0,
+        (timedOut, gpio, level, tick, tick64, time) => {
+          if(gpio === undefined) {
+            resolve({timeout: timedOut});
+          } else {
+            resolve({timeout: timedOut, gpio, level, tick, tick64, time});
+          }
+        });
+    } catch(err) {
+      reject(err);
+    }
+  });
+};
+
+module.exports = {
+  waitForEdge
+};
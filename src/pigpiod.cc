@@ -1,4 +1,16 @@
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+#include <linux/gpio.h> // v2 uAPI, for the GPIO character device
+#endif
 #include <pigpiod_if2.h>
 #include <nan.h>
 
@@ -8,9 +20,13 @@
 
 #if NODE_VERSION_AT_LEAST(0, 11, 13)
 static void gpioISREventLoopHandler(uv_async_t* handle);
+static void gpioISRTimerHandler(uv_timer_t* handle);
 #else
 static void gpioISREventLoopHandler(uv_async_t* handle, int status);
+static void gpioISRTimerHandler(uv_timer_t* handle, int status);
 #endif
+static void gpioISRHandler(int pi, unsigned gpio, unsigned level, uint32_t tick);
+static void ClockReset(int pi);
 
 // TODO errors returned by uv calls are ignored
 
@@ -20,6 +36,11 @@ static void gpioISREventLoopHandler(uv_async_t* handle, int status);
 // Generic
 // ###########################################################################
 
+// pigpiod_if2 supports up to 32 connections, see pigpio_start()
+#ifndef MAX_PI
+#define MAX_PI 32
+#endif
+
 char *v8ToCharPtr(v8::Local<v8::Value> v8Value) {
   v8::String::Utf8Value string(v8Value);
   char *charPtr = (char *) malloc(string.length() + 1);
@@ -28,11 +49,36 @@ char *v8ToCharPtr(v8::Local<v8::Value> v8Value) {
 }
 
 
+static void SetNumber(v8::Local<v8::Object> object, const char *name, double value) {
+  Nan::Set(object,
+    Nan::New<v8::String>(name).ToLocalChecked(),
+    Nan::New<v8::Number>(value)
+  );
+}
+
+
+// Sleeps until the uv_hrtime() value <until> is reached.
+static void SleepUntil(uint64_t until) {
+  struct timespec ts;
+
+  ts.tv_sec  = until / 1000000000;
+  ts.tv_nsec = until % 1000000000;
+
+  // uv_hrtime() is based on CLOCK_MONOTONIC
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+}
+
+
 
 // ###########################################################################
 // Error handling
 // ###########################################################################
 
+// pigpiod(_if2) errors are in this range, which tells them from the bank
+// levels returned by read_bank_1() as uint32_t.
+#define PIGPIOD_ERROR_MIN -10000
+
 void ThrowPigpiodError(int err, const char *pigpiodcall) {
   char buf[128];
 
@@ -44,347 +90,4995 @@ void ThrowPigpiodError(int err, const char *pigpiodcall) {
 
 
 // ###########################################################################
-// Callback handling from C -> javascript
+// Statistics
+// Counters and latency histograms, cheap enough to be always on.
+// The histograms are log-linear (HDR style): 8 sub-buckets per power of two,
+// so each value is recorded with a precision of about 12%, over the whole
+// range of uint64_t nanoseconds, in a fixed array without allocation.
 // ###########################################################################
 
-class GpioCallback_t {
-public:
-  GpioCallback_t() : callback_(0) {
-  }
-
-  virtual ~GpioCallback_t() {
-    if (callback_) {
-      uv_unref((uv_handle_t *) &async_);
-      delete callback_;
-    }
-
-    uv_close((uv_handle_t *) &async_, 0);
+#define HIST_SUB_BITS 3
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
 
-    callback_ = 0;
+class LatencyHistogram_t {
+public:
+  LatencyHistogram_t() {
+    Reset();
   }
 
-  void AsyncSend() {
-    uv_async_send(&async_);
+  void Reset() {
+    memset(counts_, 0, sizeof(counts_));
+    count_ = 0;
+    sum_   = 0;
+    min_   = 0;
+    max_   = 0;
   }
 
-  void SetCallback(Nan::Callback *callback) {
-    if (callback_) {
-      uv_unref((uv_handle_t *) &async_);
-      delete callback_;
+  void Record(uint64_t ns) {
+    counts_[BucketIndex(ns)]++;
+    if (!count_ || ns < min_) {
+      min_ = ns;
     }
-
-    callback_ = callback;
-
-    if (callback_) {
-      uv_ref((uv_handle_t *) &async_);
+    if (ns > max_) {
+      max_ = ns;
     }
+    count_++;
+    sum_ += ns;
   }
 
-  Nan::Callback *Callback() {
-    return callback_;
+  double Count() {
+    return count_;
   }
 
-protected:
-  uv_async_t async_;
-
-private:
-  Nan::Callback *callback_;
-};
+  // Value [ns] below which the fraction <p> of the recorded values are.
+  double Percentile(double p) {
+    double threshold = p * count_;
+    double seen      = 0;
 
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+      seen += counts_[i];
+      if (counts_[i] && seen >= threshold) {
+        double value = BucketValue(i);
 
-class GpioISR_t : public GpioCallback_t {
-public:
-  GpioISR_t() : GpioCallback_t() {
-    uv_async_init(uv_default_loop(), &async_, gpioISREventLoopHandler);
+        return value > max_ ? max_ : value;
+      }
+    }
 
-    // Prevent async from keeping event loop alive, for the time being.
-    uv_unref((uv_handle_t *) &async_);
+    return max_;
   }
-};
-
 
-static GpioISR_t gpioISR_g[PI_MAX_USER_GPIO + 1];
+  // Statistics in microseconds.
+  v8::Local<v8::Object> ToObject() {
+    v8::Local<v8::Object> object = Nan::New<v8::Object>();
 
-// Globals, protected by semaphore, passing the callback parameters
-// from the C-handler into the js-event-loop
-static int gpio_g;
-static int level_g;
-static uint32_t tick_g;
-static uv_sem_t sem_g;
+    SetNumber(object, "count", count_);
+    SetNumber(object, "mean",  count_ ? sum_ / count_ / 1000 : 0);
+    SetNumber(object, "min",   min_ / 1000.0);
+    SetNumber(object, "max",   max_ / 1000.0);
+    SetNumber(object, "p50",   Percentile(0.5) / 1000);
+    SetNumber(object, "p90",   Percentile(0.9) / 1000);
+    SetNumber(object, "p99",   Percentile(0.99) / 1000);
+    SetNumber(object, "p999",  Percentile(0.999) / 1000);
 
+    return object;
+  }
 
-// gpioISRHandler is not executed in the event loop thread
-static void gpioISRHandler(int pi, unsigned gpio, unsigned level, uint32_t tick) {
-  uv_sem_wait(&sem_g);
+private:
+  static unsigned BucketIndex(uint64_t value) {
+    if (value < HIST_SUB) {
+      return value;
+    }
 
-  gpio_g  = gpio;
-  level_g = level;
-  tick_g  = tick;
+    unsigned msb   = 63 - __builtin_clzll(value);
+    unsigned shift = msb - HIST_SUB_BITS;
 
-  gpioISR_g[gpio].AsyncSend();
-}
+    return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+      ((value >> shift) & (HIST_SUB - 1));
+  }
 
+  // Middle of the value range covered by the bucket.
+  static double BucketValue(unsigned index) {
+    if (index < HIST_SUB) {
+      return index;
+    }
 
-// gpioISREventLoopHandler is executed in the event loop thread.
-#if NODE_VERSION_AT_LEAST(0, 11, 13)
-static void gpioISREventLoopHandler(uv_async_t* handle) {
-#else
-static void gpioISREventLoopHandler(uv_async_t* handle, int status) {
-#endif
-  Nan::HandleScope scope;
+    unsigned msb   = (index >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    unsigned shift = msb - HIST_SUB_BITS;
+    double   low   = (double) ((uint64_t) (HIST_SUB + (index & (HIST_SUB - 1))) << shift);
 
-  if (gpioISR_g[gpio_g].Callback()) {
-    v8::Local<v8::Value> args[3] = {
-      Nan::New<v8::Integer>(gpio_g),
-      Nan::New<v8::Integer>(level_g),
-      Nan::New<v8::Integer>(tick_g)
-    };
-    gpioISR_g[gpio_g].Callback()->Call(3, args);
+    return low + (double) ((uint64_t) 1 << shift) / 2;
   }
 
-  uv_sem_post(&sem_g);
-}
+  uint32_t counts_[HIST_BUCKETS];
+  double   count_;
+  double   sum_;
+  uint64_t min_;
+  uint64_t max_;
+};
 
 
-static NAN_METHOD(callback) {
-  if(info.Length() < 4    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // gpio
-     !info[2]->IsUint32() || // edge
-     !info[3]->IsFunction()  // handler
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "callback", ""));
+// Per binding statistics of the daemon round-trips.
+// Only used in the event loop thread; each binding has a function-local
+// static instance, which adds itself to the list on the first call.
+class CallStats_t {
+public:
+  explicit CallStats_t(const char *name) : name_(name), calls_(0), errors_(0) {
+    next_ = first_;
+    first_ = this;
   }
 
-  int      pi   = info[0]->Int32Value();
-  unsigned gpio = info[1]->Uint32Value();
-  unsigned edge = info[2]->Uint32Value();
-  Nan::Callback *nanCallback = new Nan::Callback(info[3].As<v8::Function>());
-  CBFunc_t callbackFunc = gpioISRHandler;
-  gpioISR_g[gpio].SetCallback(nanCallback);
+  void Record(uint64_t start, bool error) {
+    latency_.Record(uv_hrtime() - start);
+    calls_++;
+    if (error) {
+      errors_++;
+    }
+  }
 
-  int rc = callback(pi, gpio, edge, callbackFunc);
-  if(rc < 0) {
-    return ThrowPigpiodError(rc, "callback");
+  void Reset() {
+    calls_  = 0;
+    errors_ = 0;
+    latency_.Reset();
   }
 
-  info.GetReturnValue().Set(rc);
-}
+  v8::Local<v8::Object> ToObject() {
+    v8::Local<v8::Object> object = Nan::New<v8::Object>();
 
+    SetNumber(object, "calls",  calls_);
+    SetNumber(object, "errors", errors_);
+    Nan::Set(object, Nan::New("latency").ToLocalChecked(), latency_.ToObject());
 
-static NAN_METHOD(callback_cancel) {
-  if(info.Length() < 1    ||
-     !info[0]->IsUint32()    // callback_id
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "callback_cancel", ""));
+    return object;
   }
 
-  unsigned callback_id = info[0]->Uint32Value();
+  static CallStats_t *First() {
+    return first_;
+  }
 
-  int rc = callback_cancel(callback_id);
-  if(rc != 0) {
-    return ThrowPigpiodError(rc, "callback_cancel");
+  CallStats_t *Next() {
+    return next_;
   }
 
-  info.GetReturnValue().Set(rc);
-}
+  const char *Name() {
+    return name_;
+  }
+
+private:
+  static CallStats_t *first_;
+
+  const char         *name_;
+  CallStats_t        *next_;
+  double              calls_;
+  double              errors_;
+  LatencyHistogram_t  latency_;
+};
+
+CallStats_t *CallStats_t::first_ = 0;
 
 
 
 // ###########################################################################
-// Essential
+// Resources
+// Registry of what has been opened through a pi (or a chip handle): the
+// callbacks and the SPI, serial and I2C handles. Closing or cancelling
+// removes the entry; pigpio_stop(), gpiochip_close() and the exit of the
+// process release whatever is left, so a forgotten close leaks neither
+// daemon handles, nor file descriptors, nor javascript closures.
+// Only used in the event loop thread.
 // ###########################################################################
 
-NAN_METHOD(pigpio_start) {
-  if(info.Length() < 2    ||
-     !info[0]->IsString() || // addStr
-     !info[1]->IsString()    // portStr
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "pigpio_start", ""));
-  }
+#define RES_CALLBACK  0
+#define RES_SPI       1
+#define RES_SERIAL    2
+#define RES_I2C       3
+#define RES_BB_SERIAL 4 // handle is the GPIO
+#define RES_BB_SPI    5 // handle is CS
+#define RES_BB_I2C    6 // handle is SDA
+#define RES_TYPES     7
+
+static const char *resourceNames_g[RES_TYPES] = {
+  "callbacks", "spi", "serial", "i2c", "bbSerial", "bbSpi", "bbI2c"
+};
 
-  char* addrStr = v8ToCharPtr(info[0]->ToString());
-  char* portStr = v8ToCharPtr(info[1]->ToString());
+typedef struct Resource_s
+{
+  struct Resource_s *next;
+  unsigned           id;     // unique, handles get reused
+  int                pi;
+  int                type;
+  unsigned           handle;
+  unsigned           gpio;   // RES_CALLBACK only
+  unsigned          *owner;  // id of the handle object, zeroed on removal
+} Resource_t;
+
+static Resource_t *resources_g;
+static unsigned    resourceNextId_g = 1;
+static bool        piOpen_g[MAX_PI];
+
+static void ResourceReleasePi(int pi, bool atExit);
+static v8::Local<v8::Object> ResourcesToObject();
+
+
+// Returns the id of the entry, 0 if out of memory. A handle object passes
+// where it keeps the id as <owner>, so it sees the removal of the entry (by
+// pigpio_stop() or a close through the pi) without a lookup.
+static unsigned ResourceAdd(int pi, int type, unsigned handle, unsigned gpio = 0,
+  unsigned *owner = 0)
+{
+  Resource_t *res = (Resource_t *) malloc(sizeof(Resource_t));
 
-  int rc = pigpio_start(addrStr, portStr);
-  if (rc < 0) {
-    return ThrowPigpiodError(rc, "pigpio_start");
+  if (!res) {
+    return 0;
   }
 
-  info.GetReturnValue().Set(rc);
+  res->id     = resourceNextId_g++;
+  res->pi     = pi;
+  res->type   = type;
+  res->handle = handle;
+  res->gpio   = gpio;
+  res->owner  = owner;
+  res->next   = resources_g;
+  resources_g = res;
+
+  return res->id;
 }
 
 
-NAN_METHOD(pigpio_stop) {
-  if(info.Length() < 1 ||
-     !info[0]->IsInt32() // pi
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "pigpio_stop", ""));
-  }
+// Removes the entry, pi -1 matches any pi (callback ids are unique).
+// Returns true, and the removed entry in <removed>, if found.
+static bool ResourceRemove(int pi, int type, unsigned handle,
+  Resource_t *removed = 0)
+{
+  for (Resource_t **link = &resources_g; *link; link = &(*link)->next) {
+    Resource_t *res = *link;
 
-  int pi = info[0]->Int32Value();
+    if ((pi < 0 || res->pi == pi) && res->type == type && res->handle == handle) {
+      *link = res->next;
+      if (removed) {
+        *removed = *res;
+      }
+      if (res->owner) {
+        *res->owner = 0;
+      }
+      free(res);
+      return true;
+    }
+  }
 
-  pigpio_stop(pi);
+  return false;
 }
 
 
+// Removes the entry with the id, returns true if it was still registered.
+static bool ResourceRemoveId(unsigned id) {
+  for (Resource_t **link = &resources_g; *link; link = &(*link)->next) {
+    Resource_t *res = *link;
 
-// ###########################################################################
-// Beginner
-// ###########################################################################
-
-NAN_METHOD(set_mode) {
-  if(info.Length() < 3 ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // gpio
-     !info[2]->IsUint32()    // mode
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "set_mode", ""));
+    if (res->id == id) {
+      *link = res->next;
+      if (res->owner) {
+        *res->owner = 0;
+      }
+      free(res);
+      return true;
+    }
   }
 
-  int      pi   = info[0]->Int32Value();
-  unsigned gpio = info[1]->Uint32Value();
-  unsigned mode = info[2]->Uint32Value();
-
-  int rc = set_mode(pi, gpio, mode);
-  if (rc != 0) {
-    return ThrowPigpiodError(rc, "set_mode");
-  }
+  return false;
 }
 
 
-NAN_METHOD(get_mode) {
-  if(info.Length() < 2   ||
-     !info[0]->IsInt32() || // pi
-     !info[1]->IsUint32()   // gpio
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "get_mode", ""));
-  }
-
-  int      pi   = info[0]->Int32Value();
-  unsigned gpio = info[1]->Uint32Value();
+static unsigned ResourceCount(int pi, int type) {
+  unsigned count = 0;
 
-  int rc = get_mode(pi, gpio);
-  if (rc < 0) {
-    return ThrowPigpiodError(rc, "get_mode");
+  for (Resource_t *res = resources_g; res; res = res->next) {
+    if (res->pi == pi && res->type == type) {
+      count++;
+    }
   }
 
-  info.GetReturnValue().Set(rc);
+  return count;
 }
 
 
-NAN_METHOD(set_pull_up_down) {
-  if(info.Length() < 2    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // gpio
-     !info[2]->IsUint32()    // pud
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "set_pull_up_down", ""));
+// Whether any callback is still registered for the GPIO, on any pi.
+static bool ResourceGpioHasCallback(unsigned gpio) {
+  for (Resource_t *res = resources_g; res; res = res->next) {
+    if (res->type == RES_CALLBACK && res->gpio == gpio) {
+      return true;
+    }
   }
 
-  int      pi   = info[0]->Int32Value();
-  unsigned gpio = info[1]->Uint32Value();
-  unsigned pud  = info[2]->Uint32Value();
+  return false;
+}
 
-  int rc = set_pull_up_down(pi, gpio, pud);
-  if(rc < 0) {
-    return ThrowPigpiodError(rc, "set_pull_up_down");
-  }
 
-  info.GetReturnValue().Set(rc);
-}
 
+// ###########################################################################
+// Thread pool work
+// The lists queued to the libuv thread pool (transaction lists, DHT22
+// sweeps) keep using the pi until done. pigpio_stop() ends them first: it
+// advances the generation of the pi, which the workers check between their
+// steps, and waits for the running ones. Later work gets the new
+// generation, so a reused pi handle isn't affected.
+// ###########################################################################
 
-NAN_METHOD(gpio_read) {
-  if(info.Length() < 2   ||
-     !info[0]->IsInt32() || // pi
-     !info[1]->IsUint32()   // gpio
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "gpio_read", ""));
-  }
+#define WORK_SLICE 10000000 // ns, longest sleep without a stop check
 
-  int      pi   = info[0]->Int32Value();
-  unsigned gpio = info[1]->Uint32Value();
+static uv_mutex_t workMutex_g;
+static uv_cond_t  workCond_g;
+static unsigned   workCount_g[MAX_PI];
+static unsigned   workGeneration_g[MAX_PI];
 
-  int rc = gpio_read(pi, gpio);
-  if(rc < 0) {
-    return ThrowPigpiodError(rc, "gpio_read");
-  }
 
-  info.GetReturnValue().Set(rc);
+// Called in the event loop when queueing work for the pi, returns its
+// generation.
+static unsigned WorkBegin(int pi) {
+  uv_mutex_lock(&workMutex_g);
+  workCount_g[pi]++;
+  unsigned generation = workGeneration_g[pi];
+  uv_mutex_unlock(&workMutex_g);
+
+  return generation;
 }
 
 
-NAN_METHOD(gpio_write) {
-  if(info.Length() < 3    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // gpio
-     !info[2]->IsUint32()    // level
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "gpio_write", ""));
-  }
+// Called by the worker when done.
+static void WorkEnd(int pi) {
+  uv_mutex_lock(&workMutex_g);
+  workCount_g[pi]--;
+  uv_cond_broadcast(&workCond_g);
+  uv_mutex_unlock(&workMutex_g);
+}
 
-  int      pi    = info[0]->Int32Value();
-  unsigned gpio  = info[1]->Uint32Value();
-  unsigned level = info[2]->Uint32Value();
 
-  int rc = gpio_write(pi, gpio, level);
-  if(rc != 0) {
-    return ThrowPigpiodError(rc, "gpio_write");
-  }
+// Whether pigpio_stop() ended the work of the generation.
+static bool WorkStopped(int pi, unsigned generation) {
+  uv_mutex_lock(&workMutex_g);
+  bool stopped = workGeneration_g[pi] != generation;
+  uv_mutex_unlock(&workMutex_g);
 
-  info.GetReturnValue().Set(rc);
+  return stopped;
 }
 
 
+// Sleeps until the uv_hrtime() value <until>, returns false if the work got
+// stopped meanwhile.
+static bool WorkSleep(int pi, unsigned generation, uint64_t until) {
+  for (;;) {
+    if (WorkStopped(pi, generation)) {
+      return false;
+    }
 
-// ###########################################################################
-// Intermediate
-// ###########################################################################
+    uint64_t now = uv_hrtime();
 
-NAN_METHOD(set_watchdog) {
-  if(info.Length() < 3    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // gpio
-     !info[2]->IsUint32()    // timeout
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "set_watchdog", ""));
+    if (now >= until) {
+      return true;
+    }
+    SleepUntil(until - now > WORK_SLICE ? now + WORK_SLICE : until);
   }
+}
 
-  int      pi      = info[0]->Int32Value();
-  unsigned gpio    = info[1]->Uint32Value();
-  unsigned timeout = info[2]->Uint32Value();
 
-  int rc = set_watchdog(pi, gpio, timeout);
-  if(rc != 0) {
-    return ThrowPigpiodError(rc, "set_watchdog");
+// Stops the work of the pi and waits for the running workers.
+static void WorkStopPi(int pi) {
+  if (pi < 0 || pi >= MAX_PI) {
+    return;
   }
 
-  info.GetReturnValue().Set(rc);
+  uv_mutex_lock(&workMutex_g);
+  workGeneration_g[pi]++;
+  while (workCount_g[pi]) {
+    uv_cond_wait(&workCond_g, &workMutex_g);
+  }
+  uv_mutex_unlock(&workMutex_g);
 }
 
 
 
 // ###########################################################################
-// Advanced
+// GPIO character device
+// A local alternative to the daemon: gpiochip_open() returns a handle, to be
+// used in place of the pi with gpio_read, gpio_write, set_mode, get_mode,
+// set_pull_up_down and callback. These then use the kernel GPIO character
+// device (v2 uAPI) directly, without a round-trip to pigpiod.
+//
+// Each line in use has its own line request, so the first use of a line
+// leaves the others alone. A line is requested as-is (keeping direction
+// and level) unless the call sets them; later changes reconfigure the
+// request in place, so outputs don't glitch and edges aren't lost. Edges
+// are read in batches by one thread per chip and passed to the callback
+// queues, with the kernel timestamp as tick (microseconds, CLOCK_MONOTONIC,
+// wraps like the pigpio tick).
+//
+// Errors of the chip handles are reported as errno exceptions.
+// Built without the v2 uAPI (kernel headers before 5.10), gpiochip_open()
+// throws ENOSYS.
 // ###########################################################################
 
-NAN_METHOD(set_glitch_filter) {
-  if(info.Length() < 3    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // gpio
-     !info[2]->IsUint32()    // steady
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "set_glitch_filter", ""));
-  }
+#define GPIOCHIP_MAX     8
+#define GPIOCHIP_BASE    MAX_PI     // chip handles follow the pi handles
+#define GPIOCHIP_CB_BASE 0x40000000 // callback ids of the chip handles
+#define GPIOCHIP_EVENTS  64         // events read at once
 
-  int      pi     = info[0]->Int32Value();
-  unsigned gpio   = info[1]->Uint32Value();
-  unsigned steady = info[2]->Uint32Value();
+#ifdef GPIO_V2_LINES_MAX
 
-  int rc = set_glitch_filter(pi, gpio, steady);
-  if(rc != 0) {
-    return ThrowPigpiodError(rc, "set_glitch_filter");
+#define GPIOCHIP_DIRECTION (GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_OUTPUT)
+#define GPIOCHIP_EDGES     (GPIO_V2_LINE_FLAG_EDGE_RISING | \
+                            GPIO_V2_LINE_FLAG_EDGE_FALLING)
+
+class GpioChip_t {
+public:
+  GpioChip_t(int handle) :
+    handle_(handle), chipFd_(-1), numLines_(0), numChipLines_(0), values_(0),
+    threadRunning_(false), stop_(0)
+  {
+    uv_mutex_init(&mutex_);
+    wake_[0] = -1;
+    wake_[1] = -1;
+  }
+
+  ~GpioChip_t() {
+    if (threadRunning_) {
+      char c = 0;
+
+      stop_ = 1;
+      if (write(wake_[1], &c, 1) < 0) {
+        // the thread sees stop_ on its next wakeup anyway
+      }
+      uv_thread_join(&thread_);
+    }
+    if (wake_[0] >= 0) {
+      close(wake_[0]);
+      close(wake_[1]);
+    }
+    for (unsigned index = 0; index < numLines_; index++) {
+      close(reqFds_[index]);
+    }
+    if (chipFd_ >= 0) {
+      close(chipFd_);
+    }
+    uv_mutex_destroy(&mutex_);
+  }
+
+  // Returns 0, or -errno.
+  int Open(const char *path) {
+    struct gpiochip_info chipInfo;
+
+    chipFd_ = open(path, O_RDWR | O_CLOEXEC);
+    if (chipFd_ < 0 || ioctl(chipFd_, GPIO_GET_CHIPINFO_IOCTL, &chipInfo) < 0) {
+      return -errno;
+    }
+    numChipLines_ = chipInfo.lines;
+
+    return 0;
+  }
+
+  int SetMode(unsigned gpio, unsigned mode) {
+    if (mode != PI_INPUT && mode != PI_OUTPUT) {
+      return -EINVAL;
+    }
+
+    int index = Line(gpio);
+    if (index < 0) {
+      return index;
+    }
+
+    int rc = Adopt(index);
+    if (rc < 0) {
+      return rc;
+    }
+
+    uint64_t flags = flags_[index] & ~(GPIOCHIP_DIRECTION | GPIOCHIP_EDGES);
+
+    return Configure(index, flags |
+      (mode == PI_OUTPUT ? GPIO_V2_LINE_FLAG_OUTPUT : GPIO_V2_LINE_FLAG_INPUT));
+  }
+
+  int GetMode(unsigned gpio) {
+    int index = Find(gpio);
+
+    if (index >= 0 && (flags_[index] & GPIOCHIP_DIRECTION)) {
+      return flags_[index] & GPIO_V2_LINE_FLAG_OUTPUT ? PI_OUTPUT : PI_INPUT;
+    }
+
+    // not requested (yet), or as-is, ask the kernel
+    uint64_t flags;
+
+    int rc = LineInfo(gpio, &flags);
+    if (rc < 0) {
+      return rc;
+    }
+
+    return flags & GPIO_V2_LINE_FLAG_OUTPUT ? PI_OUTPUT : PI_INPUT;
+  }
+
+  int SetPullUpDown(unsigned gpio, unsigned pud) {
+    uint64_t bias;
+
+    switch(pud) {
+      case PI_PUD_OFF:  bias = GPIO_V2_LINE_FLAG_BIAS_DISABLED;  break;
+      case PI_PUD_DOWN: bias = GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN; break;
+      case PI_PUD_UP:   bias = GPIO_V2_LINE_FLAG_BIAS_PULL_UP;   break;
+      default:          return -EINVAL;
+    }
+
+    int index = Line(gpio);
+    if (index < 0) {
+      return index;
+    }
+
+    // the bias needs an explicit direction
+    int rc = Adopt(index);
+    if (rc < 0) {
+      return rc;
+    }
+
+    uint64_t flags = flags_[index] &
+      ~(GPIO_V2_LINE_FLAG_BIAS_DISABLED | GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN |
+        GPIO_V2_LINE_FLAG_BIAS_PULL_UP);
+
+    return Configure(index, flags | bias);
+  }
+
+  int Read(unsigned gpio) {
+    int index = Line(gpio);
+    if (index < 0) {
+      return index;
+    }
+
+    return Value(index);
+  }
+
+  // Like the daemon, switches the GPIO to output.
+  int Write(unsigned gpio, unsigned level) {
+    if (level > 1) {
+      return -EINVAL;
+    }
+
+    int index = Line(gpio, GPIO_V2_LINE_FLAG_OUTPUT, level);
+    if (index < 0) {
+      return index;
+    }
+
+    if (!(flags_[index] & GPIO_V2_LINE_FLAG_OUTPUT)) {
+      uint64_t flags    = flags_[index] & ~(GPIOCHIP_DIRECTION | GPIOCHIP_EDGES);
+      uint64_t previous = values_;
+
+      SetValue(index, level);
+
+      int rc = Configure(index, flags | GPIO_V2_LINE_FLAG_OUTPUT);
+      if (rc < 0) {
+        values_ = previous;
+      }
+
+      return rc;
+    }
+
+    struct gpio_v2_line_values values;
+
+    values.bits = level;
+    values.mask = 1;
+    if (ioctl(reqFds_[index], GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0) {
+      return -errno;
+    }
+    SetValue(index, level);
+
+    return 0;
+  }
+
+  // edge RISING_EDGE, FALLING_EDGE, EITHER_EDGE, or -1 to stop reporting
+  int SetEdge(unsigned gpio, int edge) {
+    uint64_t edgeFlags;
+
+    switch(edge) {
+      case RISING_EDGE:  edgeFlags = GPIO_V2_LINE_FLAG_EDGE_RISING;  break;
+      case FALLING_EDGE: edgeFlags = GPIO_V2_LINE_FLAG_EDGE_FALLING; break;
+      case EITHER_EDGE:  edgeFlags = GPIOCHIP_EDGES;                 break;
+      case -1:           edgeFlags = 0;                              break;
+      default:           return -EINVAL;
+    }
+
+    int index = Line(gpio);
+    if (index < 0) {
+      return index;
+    }
+
+    if (edgeFlags && !threadRunning_) {
+      if (pipe2(wake_, O_CLOEXEC | O_NONBLOCK) < 0) {
+        return -errno;
+      }
+      uv_thread_create(&thread_, EventThread, this);
+      threadRunning_ = true;
+    }
+
+    uint64_t flags = flags_[index] & ~GPIOCHIP_EDGES;
+
+    // edge detection needs an input
+    if (edgeFlags) {
+      flags = (flags & ~GPIO_V2_LINE_FLAG_OUTPUT) | GPIO_V2_LINE_FLAG_INPUT;
+    }
+
+    return Configure(index, flags | edgeFlags);
+  }
+
+  unsigned Lines() {
+    return numChipLines_;
+  }
+
+private:
+  // Index of the line, or -1.
+  int Find(unsigned gpio) {
+    for (unsigned index = 0; index < numLines_; index++) {
+      if (offsets_[index] == gpio) {
+        return index;
+      }
+    }
+
+    return -1;
+  }
+
+  // Index of the line, requests it when not in use yet: as-is by default,
+  // that is without changing its direction.
+  int Line(unsigned gpio, uint64_t flags = 0, unsigned level = 0) {
+    int index = Find(gpio);
+
+    if (index >= 0) {
+      return index;
+    }
+    if (gpio >= numChipLines_) {
+      return -EINVAL;
+    }
+    if (numLines_ == GPIO_V2_LINES_MAX) {
+      return -ENOSPC;
+    }
+
+    struct gpio_v2_line_request request;
+    uint64_t                    previous = values_;
+
+    index = numLines_;
+    SetValue(index, level);
+
+    memset(&request, 0, sizeof(request));
+    request.offsets[0] = gpio;
+    request.num_lines  = 1;
+    strncpy(request.consumer, "pigpiod", sizeof(request.consumer) - 1);
+    BuildConfig(index, flags, &request.config);
+
+    if (ioctl(chipFd_, GPIO_V2_GET_LINE_IOCTL, &request) < 0) {
+      values_ = previous;
+      return -errno;
+    }
+
+    offsets_[index] = gpio;
+    flags_[index]   = flags;
+
+    // The event thread polls the requests.
+    uv_mutex_lock(&mutex_);
+    reqFds_[index] = request.fd;
+    numLines_++;
+    uv_mutex_unlock(&mutex_);
+
+    Wake();
+
+    return index;
+  }
+
+  // The flags of the line, as the kernel reports them.
+  int LineInfo(unsigned gpio, uint64_t *flags) {
+    struct gpio_v2_line_info lineInfo;
+
+    memset(&lineInfo, 0, sizeof(lineInfo));
+    lineInfo.offset = gpio;
+    if (ioctl(chipFd_, GPIO_V2_GET_LINEINFO_IOCTL, &lineInfo) < 0) {
+      return -errno;
+    }
+    *flags = lineInfo.flags;
+
+    return 0;
+  }
+
+  int Value(unsigned index) {
+    struct gpio_v2_line_values values;
+
+    values.bits = 0;
+    values.mask = 1;
+    if (ioctl(reqFds_[index], GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+      return -errno;
+    }
+
+    return values.bits & 1;
+  }
+
+  // Takes over the direction (and the level of an output) of a line
+  // requested as-is, before flags that need an explicit direction.
+  int Adopt(unsigned index) {
+    if (flags_[index] & GPIOCHIP_DIRECTION) {
+      return 0;
+    }
+
+    uint64_t flags;
+
+    int rc = LineInfo(offsets_[index], &flags);
+    if (rc < 0) {
+      return rc;
+    }
+
+    if (flags & GPIO_V2_LINE_FLAG_OUTPUT) {
+      int level = Value(index);
+      if (level < 0) {
+        return level;
+      }
+      SetValue(index, level);
+      flags_[index] |= GPIO_V2_LINE_FLAG_OUTPUT;
+    } else {
+      flags_[index] |= GPIO_V2_LINE_FLAG_INPUT;
+    }
+
+    return 0;
+  }
+
+  void SetValue(unsigned index, unsigned level) {
+    if (level) {
+      values_ |= (uint64_t) 1 << index;
+    } else {
+      values_ &= ~((uint64_t) 1 << index);
+    }
+  }
+
+  void BuildConfig(unsigned index, uint64_t flags,
+    struct gpio_v2_line_config *config)
+  {
+    memset(config, 0, sizeof(*config));
+    config->flags = flags;
+
+    if (flags & GPIO_V2_LINE_FLAG_OUTPUT) {
+      config->attrs[0].attr.id     = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+      config->attrs[0].attr.values = (values_ >> index) & 1;
+      config->attrs[0].mask        = 1;
+      config->num_attrs            = 1;
+    }
+  }
+
+  // Reconfigures the request of the line in place.
+  int Configure(unsigned index, uint64_t flags) {
+    struct gpio_v2_line_config config;
+
+    BuildConfig(index, flags, &config);
+    if (ioctl(reqFds_[index], GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0) {
+      return -errno;
+    }
+    flags_[index] = flags;
+
+    return 0;
+  }
+
+  // Makes the event thread pick up a new request.
+  void Wake() {
+    char c = 0;
+
+    if (threadRunning_ && write(wake_[1], &c, 1) < 0) {
+      // the pipe is full, so the thread is going to wake up anyway
+    }
+  }
+
+  // The requests stay open while the thread runs, so it polls them
+  // without holding the mutex.
+  static void EventThread(void *arg) {
+    GpioChip_t              *self = (GpioChip_t *) arg;
+    struct gpio_v2_line_event events[GPIOCHIP_EVENTS];
+    struct pollfd             fds[GPIO_V2_LINES_MAX + 1];
+
+    while (!self->stop_) {
+      unsigned num;
+
+      uv_mutex_lock(&self->mutex_);
+      num = self->numLines_;
+      for (unsigned index = 0; index < num; index++) {
+        fds[index].fd     = self->reqFds_[index];
+        fds[index].events = POLLIN;
+      }
+      uv_mutex_unlock(&self->mutex_);
+      fds[num].fd     = self->wake_[0];
+      fds[num].events = POLLIN;
+
+      if (poll(fds, num + 1, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+
+      for (unsigned index = 0; index <= num; index++) {
+        if (fds[index].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+          // the chip is gone
+          return;
+        }
+      }
+
+      if (fds[num].revents) {
+        char buf[16];
+
+        while (read(self->wake_[0], buf, sizeof(buf)) > 0) {
+        }
+        continue;
+      }
+
+      for (unsigned index = 0; index < num; index++) {
+        if (!(fds[index].revents & POLLIN)) {
+          continue;
+        }
+
+        ssize_t size = read(fds[index].fd, events, sizeof(events));
+
+        for (ssize_t i = 0; i < size / (ssize_t) sizeof(events[0]); i++) {
+          if (events[i].offset > PI_MAX_USER_GPIO) {
+            continue;
+          }
+
+          gpioISRHandler(self->handle_, events[i].offset,
+            events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE ? 1 : 0,
+            (uint32_t) (events[i].timestamp_ns / 1000));
+        }
+      }
+    }
+  }
+
+  int          handle_;
+  int          chipFd_;
+
+  unsigned     numLines_;
+  unsigned     numChipLines_;
+  unsigned     offsets_[GPIO_V2_LINES_MAX];
+  uint64_t     flags_[GPIO_V2_LINES_MAX];
+  int          reqFds_[GPIO_V2_LINES_MAX];
+  uint64_t     values_;
+
+  // Guards numLines_ and reqFds_ against the event thread.
+  uv_mutex_t   mutex_;
+  int          wake_[2];
+  uv_thread_t  thread_;
+  bool         threadRunning_;
+  volatile int stop_;
+};
+
+#else // GPIO_V2_LINES_MAX
+
+// Without the v2 uAPI no chip gets opened; this only keeps the callers.
+class GpioChip_t {
+public:
+  GpioChip_t(int handle) {
+  }
+
+  int Open(const char *path) {
+    return -ENOSYS;
+  }
+
+  int SetMode(unsigned gpio, unsigned mode) {
+    return -ENOSYS;
+  }
+
+  int GetMode(unsigned gpio) {
+    return -ENOSYS;
+  }
+
+  int SetPullUpDown(unsigned gpio, unsigned pud) {
+    return -ENOSYS;
+  }
+
+  int Read(unsigned gpio) {
+    return -ENOSYS;
+  }
+
+  int Write(unsigned gpio, unsigned level) {
+    return -ENOSYS;
+  }
+
+  int SetEdge(unsigned gpio, int edge) {
+    return -ENOSYS;
+  }
+
+  unsigned Lines() {
+    return 0;
+  }
+};
+
+#endif // GPIO_V2_LINES_MAX
+
+static GpioChip_t *gpioChip_g[GPIOCHIP_MAX];
+
+
+// The chip for a handle, or 0 if the handle is a pi.
+static GpioChip_t *GpioChip(int handle) {
+  if (handle < GPIOCHIP_BASE || handle >= GPIOCHIP_BASE + GPIOCHIP_MAX) {
+    return 0;
+  }
+
+  return gpioChip_g[handle - GPIOCHIP_BASE];
+}
+
+
+// Errors of the chip handles are -errno, the others pigpiod error codes.
+static void ThrowGpioError(GpioChip_t *chip, int err, const char *call) {
+  if (chip) {
+    Nan::ThrowError(Nan::ErrnoException(-err, call, ""));
+  } else {
+    ThrowPigpiodError(err, call);
+  }
+}
+
+
+static NAN_METHOD(gpiochip_open) {
+  if(info.Length() < 1    ||
+     !info[0]->IsString()    // path, e.g. /dev/gpiochip0
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "gpiochip_open", ""));
+  }
+
+  unsigned index;
+
+  for (index = 0; index < GPIOCHIP_MAX && gpioChip_g[index]; index++) {
+  }
+  if (index == GPIOCHIP_MAX) {
+    return Nan::ThrowError(Nan::ErrnoException(EMFILE, "gpiochip_open", ""));
+  }
+
+  GpioChip_t *chip = new GpioChip_t(GPIOCHIP_BASE + index);
+  char       *path = v8ToCharPtr(info[0]->ToString());
+
+  int rc = chip->Open(path);
+  if (rc < 0) {
+    delete chip;
+    Nan::ThrowError(Nan::ErrnoException(-rc, "gpiochip_open", "", path));
+    free(path);
+    return;
+  }
+  free(path);
+
+  ClockReset(GPIOCHIP_BASE + index);
+  gpioChip_g[index] = chip;
+
+  info.GetReturnValue().Set(GPIOCHIP_BASE + index);
+}
+
+
+// Releases all the lines; the callbacks of the chip end.
+static NAN_METHOD(gpiochip_close) {
+  if(info.Length() < 1   ||
+     !info[0]->IsInt32() || // handle
+     !GpioChip(info[0]->Int32Value())
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "gpiochip_close", ""));
+  }
+
+  int handle = info[0]->Int32Value();
+
+  ResourceReleasePi(handle, false);
+  delete gpioChip_g[handle - GPIOCHIP_BASE];
+  gpioChip_g[handle - GPIOCHIP_BASE] = 0;
+}
+
+
+
+// ###########################################################################
+// Clock correlation
+// Relates the daemon ticks (32 bit microseconds, wrapping every ~72 minutes)
+// of each pi or chip handle to the host clock, without extra daemon calls:
+// each edge (and each get_current_tick()) is an observation of a tick at a
+// host time, which is later than the tick by the (varying, positive)
+// delivery latency. The model keeps the lowest latency observation of the
+// current and of the previous window of CLOCK_WINDOW ticks; the drift is
+// derived from these two, and the offset at a tick is the lower of their
+// projections.
+// The ticks are extended to 64 bit on the way, to the wrap closest to the
+// tick predicted for the host time, so that this holds after any pause.
+// ###########################################################################
+
+#define CLOCK_WINDOW 10000000 // us
+#define CLOCK_MODELS (GPIOCHIP_BASE + GPIOCHIP_MAX)
+
+class ClockModel_t {
+public:
+  ClockModel_t() {
+    Reset();
+  }
+
+  void Reset() {
+    samples_   = 0;
+    drift_     = 0;
+    hasDrift_  = false;
+    curValid_  = false;
+    prevValid_ = false;
+  }
+
+  // Records that the tick was seen at the host time [ns, uv_hrtime()],
+  // returns the extended tick.
+  uint64_t Observe(uint32_t tick, uint64_t host) {
+    uint64_t tick64 = curValid_ ? Nearest(tick, ToTick(host)) : tick;
+    int64_t  offset = (int64_t) (host - tick64 * 1000);
+
+    samples_++;
+
+    if (!curValid_) {
+      curValid_ = true;
+      curStart_ = tick64;
+      curTick_  = tick64;
+      curOffset_ = offset;
+    } else if (tick64 >= curStart_ + CLOCK_WINDOW) {
+      if (prevValid_ && curTick_ > prevTick_) {
+        double drift = (double) (curOffset_ - prevOffset_) /
+                       (double) (curTick_ - prevTick_);
+
+        // smoothed, as a single window might have seen no fast delivery
+        drift_    = hasDrift_ ? drift_ + (drift - drift_) / 4 : drift;
+        hasDrift_ = true;
+      }
+      prevValid_  = true;
+      prevTick_   = curTick_;
+      prevOffset_ = curOffset_;
+      curStart_   = tick64;
+      curTick_    = tick64;
+      curOffset_  = offset;
+    } else if (offset < Project(curTick_, curOffset_, tick64)) {
+      curTick_   = tick64;
+      curOffset_ = offset;
+    }
+
+    return tick64;
+  }
+
+  // The host time [ns, uv_hrtime()] of the extended tick.
+  uint64_t ToHost(uint64_t tick64) {
+    if (!curValid_) {
+      return 0;
+    }
+
+    double offset = Project(curTick_, curOffset_, tick64);
+
+    if (prevValid_) {
+      double prev = Project(prevTick_, prevOffset_, tick64);
+
+      if (prev < offset) {
+        offset = prev;
+      }
+    }
+
+    return tick64 * 1000 + (int64_t) offset;
+  }
+
+  // The extended tick at the host time [ns, uv_hrtime()].
+  uint64_t ToTick(uint64_t host) {
+    if (!curValid_) {
+      return 0;
+    }
+
+    // The offset changes by less than a microsecond per microsecond, so
+    // one correction step is exact enough.
+    uint64_t tick64 = (host - curOffset_) / 1000;
+
+    return (host - (ToHost(tick64) - tick64 * 1000)) / 1000;
+  }
+
+  // Statistics {samples, drift [ppm]}.
+  v8::Local<v8::Object> ToObject() {
+    v8::Local<v8::Object> object = Nan::New<v8::Object>();
+
+    SetNumber(object, "samples", samples_);
+    SetNumber(object, "drift",   drift_ * 1000); // ns per us -> ppm
+
+    return object;
+  }
+
+private:
+  double Project(uint64_t tick, int64_t offset, uint64_t tick64) {
+    return offset + drift_ * (double) (int64_t) (tick64 - tick);
+  }
+
+  // The extended tick with the low 32 bits <tick> closest to <predicted>.
+  static uint64_t Nearest(uint32_t tick, uint64_t predicted) {
+    int32_t delta = (int32_t) (tick - (uint32_t) predicted);
+
+    if (delta < 0 && (uint64_t) -(int64_t) delta > predicted) {
+      // not before the first tick
+      return predicted + (uint32_t) delta;
+    }
+
+    return predicted + delta;
+  }
+
+  double         samples_;
+  double         drift_;   // offset change [ns] per tick [us]
+  bool           hasDrift_;
+
+  bool           curValid_;
+  uint64_t       curStart_;
+  uint64_t       curTick_;
+  int64_t        curOffset_;
+
+  bool           prevValid_;
+  uint64_t       prevTick_;
+  int64_t        prevOffset_;
+};
+
+// Shared by the pigpiod callback threads, the chip threads and the event
+// loop.
+static uv_mutex_t   clockMutex_g;
+static ClockModel_t clockModel_g[CLOCK_MODELS];
+
+
+static void ClockReset(int pi) {
+  if (pi < 0 || pi >= CLOCK_MODELS) {
+    return;
+  }
+
+  uv_mutex_lock(&clockMutex_g);
+  clockModel_g[pi].Reset();
+  uv_mutex_unlock(&clockMutex_g);
+}
+
+
+// Records the observation, returns the extended tick, and its host time
+// [ns, uv_hrtime()] in <host>.
+static uint64_t ClockObserve(int pi, uint32_t tick, uint64_t received,
+  uint64_t *host)
+{
+  if (pi < 0 || pi >= CLOCK_MODELS) {
+    *host = received;
+    return tick;
+  }
+
+  uv_mutex_lock(&clockMutex_g);
+  uint64_t tick64 = clockModel_g[pi].Observe(tick, received);
+  *host = clockModel_g[pi].ToHost(tick64);
+  uv_mutex_unlock(&clockMutex_g);
+
+  return tick64;
+}
+
+
+// Offset [ns] of the realtime clock to uv_hrtime() (CLOCK_MONOTONIC).
+static int64_t RealtimeOffset() {
+  struct timespec realtime;
+  struct timespec monotonic;
+
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+  return (int64_t) (realtime.tv_sec - monotonic.tv_sec) * 1000000000 +
+    (realtime.tv_nsec - monotonic.tv_nsec);
+}
+
+
+// Javascript time [ms since the epoch] of a host time.
+static double HostToTime(uint64_t host, int64_t realtimeOffset) {
+  return (double) (int64_t) (host + realtimeOffset) / 1000000;
+}
+
+
+// Returns {tick, tick64, time, samples, drift}: the current (extended) tick
+// and time [ms since the epoch] as estimated by the model, without asking
+// the daemon, and the model statistics, drift in ppm.
+static NAN_METHOD(clock_get) {
+  if(info.Length() < 1    ||
+     !info[0]->IsInt32()  || // pi
+     info[0]->Int32Value() < 0 ||
+     info[0]->Int32Value() >= CLOCK_MODELS
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "clock_get", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  uint64_t now    = uv_hrtime();
+  int64_t  offset = RealtimeOffset();
+
+  uv_mutex_lock(&clockMutex_g);
+  uint64_t              tick64 = clockModel_g[pi].ToTick(now);
+  v8::Local<v8::Object> result = clockModel_g[pi].ToObject();
+  uv_mutex_unlock(&clockMutex_g);
+
+  Nan::Set(result, Nan::New("tick").ToLocalChecked(),
+    Nan::New<v8::Uint32>((uint32_t) tick64));
+  SetNumber(result, "tick64", tick64);
+  SetNumber(result, "time",   HostToTime(now, offset));
+
+  info.GetReturnValue().Set(result);
+}
+
+
+// Returns the time [ms since the epoch] of an extended tick.
+static NAN_METHOD(clock_tick_to_time) {
+  if(info.Length() < 2    ||
+     !info[0]->IsInt32()  || // pi
+     info[0]->Int32Value() < 0 ||
+     info[0]->Int32Value() >= CLOCK_MODELS ||
+     !info[1]->IsNumber()    // tick64
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "clock_tick_to_time", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  uint64_t tick64 = (uint64_t) info[1]->NumberValue();
+
+  uv_mutex_lock(&clockMutex_g);
+  uint64_t host = clockModel_g[pi].ToHost(tick64);
+  uv_mutex_unlock(&clockMutex_g);
+
+  info.GetReturnValue().Set(HostToTime(host, RealtimeOffset()));
+}
+
+
+
+// ###########################################################################
+// Callback handling from C -> javascript
+//
+// Each GPIO has its own event queue, filled by gpioISRHandler in the
+// pigpiod callback thread and drained by gpioISREventLoopHandler in the
+// event loop. The handler never blocks on javascript, so a busy pin can only
+// overflow its own queue, it can't stall the delivery for other pins.
+//
+// Each registration selects a policy for what to do with the edges:
+// CB_POLICY_QUEUE     deliver every edge; drop (and count) when more than
+//                     <param> (default CB_QUEUE_SIZE) are queued
+// CB_POLICY_COALESCE  keep only the latest level not yet seen by javascript
+// CB_POLICY_RATE      deliver at most <param> events per second; edges in
+//                     between are coalesced, the latest is delivered late
+// CB_POLICY_DEBOUNCE  deliver a level only once it has been stable for
+//                     <param> microseconds
+// ###########################################################################
+
+#define CB_POLICY_QUEUE    0
+#define CB_POLICY_COALESCE 1
+#define CB_POLICY_RATE     2
+#define CB_POLICY_DEBOUNCE 3
+
+#define CB_QUEUE_SIZE 256   // default queue capacity, events per delivery
+#define CB_QUEUE_MAX  65536
+
+typedef struct
+{
+  unsigned level;
+  uint32_t tick;
+  uint64_t tick64;
+  uint64_t host;     // uv_hrtime() of the tick, from the clock model
+  uint64_t received; // uv_hrtime(), to measure the dispatch latency
+} GpioEvent_t;
+
+class GpioCallback_t {
+public:
+  GpioCallback_t() : callback_(0) {
+  }
+
+  virtual ~GpioCallback_t() {
+    if (callback_) {
+      uv_unref((uv_handle_t *) &async_);
+      delete callback_;
+    }
+
+    uv_close((uv_handle_t *) &async_, 0);
+
+    callback_ = 0;
+  }
+
+  void AsyncSend() {
+    uv_async_send(&async_);
+  }
+
+  void SetCallback(Nan::Callback *callback) {
+    if (callback_) {
+      uv_unref((uv_handle_t *) &async_);
+      delete callback_;
+    }
+
+    callback_ = callback;
+
+    if (callback_) {
+      uv_ref((uv_handle_t *) &async_);
+    }
+  }
+
+  Nan::Callback *Callback() {
+    return callback_;
+  }
+
+protected:
+  uv_async_t async_;
+
+private:
+  Nan::Callback *callback_;
+};
+
+
+class GpioISR_t : public GpioCallback_t {
+public:
+  GpioISR_t() : GpioCallback_t(), queue_(0), capacity_(0) {
+    uv_mutex_init(&mutex_);
+
+    uv_async_init(uv_default_loop(), &async_, gpioISREventLoopHandler);
+    async_.data = this;
+
+    // Prevent async from keeping event loop alive, for the time being.
+    uv_unref((uv_handle_t *) &async_);
+
+    uv_timer_init(uv_default_loop(), &timer_);
+    timer_.data = this;
+
+    SetPolicy(CB_POLICY_QUEUE, 0);
+    ResetStats();
+  }
+
+  // Called in the event loop, once the daemon callback is registered. Edges
+  // queued meanwhile are kept, as far as the new queue holds them.
+  // Returns false if out of memory for the queue.
+  bool SetPolicy(unsigned policy, unsigned param) {
+    unsigned     capacity = policy == CB_POLICY_QUEUE && param ?
+                            param : CB_QUEUE_SIZE;
+    GpioEvent_t *queue    = 0;
+
+    if (capacity != capacity_) {
+      queue = (GpioEvent_t *) malloc(capacity * sizeof(GpioEvent_t));
+      if (!queue) {
+        return false;
+      }
+    }
+
+    uv_mutex_lock(&mutex_);
+    if (queue) {
+      unsigned num = count_ < capacity ? count_ : capacity;
+
+      for (unsigned i = 0; i < num; i++) {
+        queue[i] = queue_[(head_ + i) % capacity_];
+      }
+      statDropped_ += count_ - num;
+      head_  = 0;
+      count_ = num;
+
+      // swapped, so queue ends up with the old one
+      GpioEvent_t *old = queue_;
+
+      queue_    = queue;
+      capacity_ = capacity;
+      queue     = old;
+    }
+    policy_     = policy;
+    param_      = param;
+    pending_    = 0;
+    pendingSeq_ = 0;
+    armedSeq_   = 0;
+    delivered_  = 0;
+    lastLevel_  = 0;
+    lastTick_   = 0;
+    uv_mutex_unlock(&mutex_);
+
+    free(queue);
+    uv_timer_stop(&timer_);
+
+    return true;
+  }
+
+  // Drops the queued events, once no registration is left.
+  void Clear() {
+    uv_mutex_lock(&mutex_);
+    head_    = 0;
+    count_   = 0;
+    pending_ = 0;
+    uv_mutex_unlock(&mutex_);
+  }
+
+  void ResetStats() {
+    uv_mutex_lock(&mutex_);
+    statDelivered_ = 0;
+    statDropped_   = 0;
+    statCoalesced_ = 0;
+    statFiltered_  = 0;
+    statHighWater_ = count_;
+    uv_mutex_unlock(&mutex_);
+
+    dispatchLatency_.Reset();
+  }
+
+  // Executed in the pigpiod callback thread.
+  void Push(const GpioEvent_t &event) {
+    bool     signal = true;
+    uint32_t tick   = event.tick;
+
+    uv_mutex_lock(&mutex_);
+
+    switch(policy_) {
+      case CB_POLICY_COALESCE:
+        if (count_) {
+          // Javascript didn't pick up the previous one yet, replace it.
+          queue_[(head_ + count_ - 1) % capacity_] = event;
+          statCoalesced_++;
+          signal = false;
+        } else {
+          Enqueue(event);
+        }
+        break;
+
+      case CB_POLICY_RATE:
+        if (!pending_ &&
+            (!delivered_ ||
+             tick - lastTick_ >= 1000000 / (param_ ? param_ : 1))
+        ) {
+          Enqueue(event);
+          delivered_ = 1;
+          lastTick_  = tick;
+        } else {
+          if (pending_) {
+            statCoalesced_++;
+            signal = false;
+          }
+          Hold(event);
+        }
+        break;
+
+      case CB_POLICY_DEBOUNCE:
+        if (pending_) {
+          if (tick - pendingEvent_.tick >= param_) {
+            // The held level has been stable long enough.
+            Commit();
+          } else {
+            statFiltered_++;
+          }
+        }
+        Hold(event);
+        break;
+
+      default:
+        Enqueue(event);
+        break;
+    }
+
+    uv_mutex_unlock(&mutex_);
+
+    if (signal) {
+      AsyncSend();
+    }
+  }
+
+  // Executed in the event loop thread, takes over up to CB_QUEUE_SIZE of
+  // the queued events, <more> tells if there are more.
+  unsigned Drain(GpioEvent_t *events, bool *more, bool *armTimer,
+    uint64_t *timeoutMs)
+  {
+    unsigned num;
+
+    uv_mutex_lock(&mutex_);
+
+    for (num = 0; num < count_ && num < CB_QUEUE_SIZE; num++) {
+      events[num] = queue_[(head_ + num) % capacity_];
+    }
+    head_   = (head_ + num) % capacity_;
+    count_ -= num;
+    *more   = count_ > 0;
+    statDelivered_ += num;
+
+    *armTimer = pending_ && pendingSeq_ != armedSeq_;
+    if (*armTimer) {
+      armedSeq_ = pendingSeq_;
+
+      if (policy_ == CB_POLICY_RATE) {
+        uint32_t interval = 1000000 / (param_ ? param_ : 1);
+        uint32_t elapsed  = pendingEvent_.tick - lastTick_;
+
+        *timeoutMs = elapsed < interval ? (interval - elapsed + 999) / 1000 : 0;
+      } else {
+        *timeoutMs = (param_ + 999) / 1000;
+      }
+    }
+
+    uv_mutex_unlock(&mutex_);
+
+    return num;
+  }
+
+  // Executed in the event loop thread, when the hold time has passed.
+  void Expire() {
+    uv_mutex_lock(&mutex_);
+
+    if (policy_ == CB_POLICY_RATE) {
+      // Deliver the latest of the coalesced edges. The interval counts from
+      // the delivery, that is the held tick plus the time it was held.
+      if (pending_) {
+        Commit();
+        lastTick_ = pendingEvent_.tick +
+          (uint32_t) ((uv_hrtime() - pendingEvent_.received) / 1000);
+      }
+    } else if (pending_ && pendingSeq_ == armedSeq_) {
+      // No further edge since the timer got armed, so the level is stable.
+      Commit();
+    }
+
+    uv_mutex_unlock(&mutex_);
+
+    AsyncSend();
+  }
+
+  void ArmTimer(uint64_t timeoutMs) {
+    uv_timer_start(&timer_, gpioISRTimerHandler, timeoutMs, 0);
+  }
+
+  v8::Local<v8::Object> Stats() {
+    v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+
+    uv_mutex_lock(&mutex_);
+    SetNumber(stats, "policy",    policy_);
+    SetNumber(stats, "delivered", statDelivered_);
+    SetNumber(stats, "dropped",   statDropped_);
+    SetNumber(stats, "coalesced", statCoalesced_);
+    SetNumber(stats, "filtered",  statFiltered_);
+    SetNumber(stats, "queued",    count_);
+    SetNumber(stats, "highWater", statHighWater_);
+    uv_mutex_unlock(&mutex_);
+
+    Nan::Set(stats, Nan::New("dispatchLatency").ToLocalChecked(),
+      dispatchLatency_.ToObject());
+
+    return stats;
+  }
+
+  // Executed in the event loop thread, right before calling javascript.
+  void RecordDispatch(uint64_t received) {
+    dispatchLatency_.Record(uv_hrtime() - received);
+  }
+
+  bool Used() {
+    return Callback() || dispatchLatency_.Count();
+  }
+
+private:
+  // The helpers below expect mutex_ to be locked.
+  void Enqueue(const GpioEvent_t &event) {
+    if (count_ == capacity_) {
+      statDropped_++;
+      return;
+    }
+
+    queue_[(head_ + count_) % capacity_] = event;
+    count_++;
+    if (count_ > statHighWater_) {
+      statHighWater_ = count_;
+    }
+  }
+
+  void Hold(const GpioEvent_t &event) {
+    pendingEvent_ = event;
+    pending_ = 1;
+    pendingSeq_++;
+  }
+
+  void Commit() {
+    // Debouncing suppresses levels that javascript has already seen.
+    if (policy_ != CB_POLICY_DEBOUNCE ||
+        !delivered_ ||
+        pendingEvent_.level != lastLevel_
+    ) {
+      Enqueue(pendingEvent_);
+      delivered_ = 1;
+      lastLevel_ = pendingEvent_.level;
+    } else {
+      statFiltered_++;
+    }
+    pending_ = 0;
+  }
+
+  uv_mutex_t  mutex_;
+  uv_timer_t  timer_;
+
+  unsigned    policy_;
+  unsigned    param_;
+
+  GpioEvent_t *queue_;
+  unsigned    capacity_;
+  unsigned    head_;
+  unsigned    count_;
+
+  GpioEvent_t pendingEvent_;
+  int         pending_;
+  unsigned    pendingSeq_;
+  unsigned    armedSeq_;
+
+  int         delivered_;
+  unsigned    lastLevel_;
+  uint32_t    lastTick_;
+
+  double      statDelivered_;
+  double      statDropped_;
+  double      statCoalesced_;
+  double      statFiltered_;
+  unsigned    statHighWater_;
+
+  // Only used in the event loop thread.
+  LatencyHistogram_t dispatchLatency_;
+};
+
+
+static GpioISR_t gpioISR_g[PI_MAX_USER_GPIO + 1];
+
+
+// gpioISRHandler is not executed in the event loop thread
+static void gpioISRHandler(int pi, unsigned gpio, unsigned level, uint32_t tick) {
+  GpioEvent_t event;
+
+  event.level    = level;
+  event.tick     = tick;
+  event.received = uv_hrtime();
+  event.tick64   = ClockObserve(pi, tick, event.received, &event.host);
+
+  gpioISR_g[gpio].Push(event);
+}
+
+
+// gpioISREventLoopHandler is executed in the event loop thread.
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void gpioISREventLoopHandler(uv_async_t* handle) {
+#else
+static void gpioISREventLoopHandler(uv_async_t* handle, int status) {
+#endif
+  Nan::HandleScope scope;
+
+  GpioISR_t   *gpioISR = (GpioISR_t *) handle->data;
+  unsigned     gpio    = gpioISR - gpioISR_g;
+  GpioEvent_t  events[CB_QUEUE_SIZE];
+  bool         more;
+  bool         armTimer;
+  uint64_t     timeoutMs;
+
+  unsigned num = gpioISR->Drain(events, &more, &armTimer, &timeoutMs);
+
+  if (more) {
+    // The rest in the next loop iteration, so other handles get their turn.
+    gpioISR->AsyncSend();
+  }
+  if (armTimer) {
+    gpioISR->ArmTimer(timeoutMs);
+  }
+
+  int64_t realtimeOffset = num ? RealtimeOffset() : 0;
+
+  for (unsigned i = 0; i < num; i++) {
+    // The handler might have been cancelled by a previous event.
+    if (!gpioISR->Callback()) {
+      break;
+    }
+
+    v8::Local<v8::Value> args[5] = {
+      Nan::New<v8::Integer>(gpio),
+      Nan::New<v8::Integer>(events[i].level),
+      Nan::New<v8::Uint32>(events[i].tick),
+      Nan::New<v8::Number>(events[i].tick64),
+      Nan::New<v8::Number>(HostToTime(events[i].host, realtimeOffset))
+    };
+    gpioISR->RecordDispatch(events[i].received);
+    gpioISR->Callback()->Call(5, args);
+  }
+}
+
+
+// gpioISRTimerHandler is executed in the event loop thread.
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void gpioISRTimerHandler(uv_timer_t* handle) {
+#else
+static void gpioISRTimerHandler(uv_timer_t* handle, int status) {
+#endif
+  ((GpioISR_t *) handle->data)->Expire();
+}
+
+
+// Drops the javascript handler of the GPIO, once no registration is left,
+// so neither the closure nor the (ref'd) async handle stay around.
+static void GpioISRRelease(unsigned gpio) {
+  if (!ResourceGpioHasCallback(gpio)) {
+    gpioISR_g[gpio].SetCallback(0);
+    gpioISR_g[gpio].SetPolicy(CB_POLICY_QUEUE, 0);
+    gpioISR_g[gpio].Clear();
+  }
+}
+
+
+static NAN_METHOD(callback) {
+  if(info.Length() < 4    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // gpio
+     !info[2]->IsUint32() || // edge
+     !info[3]->IsFunction()  // handler
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "callback", ""));
+  }
+  if(info.Length() > 4 &&
+     (!info[4]->IsUint32() || // policy
+      (info.Length() > 5 && !info[5]->IsUint32())) // policy param
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "callback", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  unsigned gpio   = info[1]->Uint32Value();
+  unsigned edge   = info[2]->Uint32Value();
+  unsigned policy = info.Length() > 4 ? info[4]->Uint32Value() : CB_POLICY_QUEUE;
+  unsigned param  = info.Length() > 5 ? info[5]->Uint32Value() : 0;
+
+  if(gpio > PI_MAX_USER_GPIO ||
+     policy > CB_POLICY_DEBOUNCE ||
+     (policy == CB_POLICY_QUEUE && param > CB_QUEUE_MAX) ||
+     (policy == CB_POLICY_RATE && param == 0)
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "callback", ""));
+  }
+
+  CBFunc_t callbackFunc = gpioISRHandler;
+
+  static CallStats_t stats("callback");
+  uint64_t start = uv_hrtime();
+
+  GpioChip_t *chip = GpioChip(pi);
+  int rc = chip ?
+    chip->SetEdge(gpio, edge) : callback(pi, gpio, edge, callbackFunc);
+  stats.Record(start, rc < 0);
+  if(rc < 0) {
+    // An earlier registration of the GPIO keeps its handler and queue.
+    return ThrowGpioError(chip, rc, "callback");
+  }
+
+  int id = chip ? (int) (GPIOCHIP_CB_BASE | (pi - GPIOCHIP_BASE) << 8 | gpio) : rc;
+
+  // The async handler can't run before this returns, so the edges queued
+  // meanwhile go to the new handler.
+  if(!ResourceAdd(pi, RES_CALLBACK, id, gpio) ||
+     !gpioISR_g[gpio].SetPolicy(policy, param)
+  ) {
+    ResourceRemove(pi, RES_CALLBACK, id, 0);
+    if(chip) {
+      chip->SetEdge(gpio, -1);
+    } else {
+      callback_cancel(rc);
+    }
+    GpioISRRelease(gpio);
+    return Nan::ThrowError(Nan::ErrnoException(ENOMEM, "callback", ""));
+  }
+  gpioISR_g[gpio].SetCallback(new Nan::Callback(info[3].As<v8::Function>()));
+
+  info.GetReturnValue().Set(id);
+}
+
+
+static NAN_METHOD(callback_cancel) {
+  if(info.Length() < 1    ||
+     !info[0]->IsUint32()    // callback_id
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "callback_cancel", ""));
+  }
+
+  unsigned callback_id = info[0]->Uint32Value();
+
+  static CallStats_t stats("callback_cancel");
+  uint64_t start = uv_hrtime();
+
+  GpioChip_t *chip = callback_id >= GPIOCHIP_CB_BASE ?
+    GpioChip(GPIOCHIP_BASE + ((callback_id >> 8) & 0xff)) : 0;
+
+  if(callback_id >= GPIOCHIP_CB_BASE && !chip) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "callback_cancel", ""));
+  }
+
+  int rc = chip ?
+    chip->SetEdge(callback_id & 0xff, -1) : callback_cancel(callback_id);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowGpioError(chip, rc, "callback_cancel");
+  }
+
+  Resource_t res;
+
+  if(ResourceRemove(-1, RES_CALLBACK, callback_id, &res)) {
+    GpioISRRelease(res.gpio);
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+static NAN_METHOD(callback_stats) {
+  if(info.Length() < 1    ||
+     !info[0]->IsUint32() || // gpio
+     info[0]->Uint32Value() > PI_MAX_USER_GPIO
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "callback_stats", ""));
+  }
+
+  unsigned gpio = info[0]->Uint32Value();
+
+  info.GetReturnValue().Set(gpioISR_g[gpio].Stats());
+}
+
+
+static NAN_METHOD(callback_stats_reset) {
+  if(info.Length() < 1    ||
+     !info[0]->IsUint32() || // gpio
+     info[0]->Uint32Value() > PI_MAX_USER_GPIO
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "callback_stats_reset", ""));
+  }
+
+  unsigned gpio = info[0]->Uint32Value();
+
+  gpioISR_g[gpio].ResetStats();
+}
+
+
+
+// ###########################################################################
+// Essential
+// ###########################################################################
+
+// addrStr and portStr are optional, pigpiod_if2 then uses the environment
+// variables PIGPIO_ADDR and PIGPIO_PORT, or localhost:8888.
+NAN_METHOD(pigpio_start) {
+  if((info.Length() > 0 &&
+      !info[0]->IsString() && !info[0]->IsUndefined()) || // addStr
+     (info.Length() > 1 &&
+      !info[1]->IsString() && !info[1]->IsUndefined())    // portStr
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "pigpio_start", ""));
+  }
+
+  char* addrStr = info.Length() > 0 && info[0]->IsString() ?
+    v8ToCharPtr(info[0]->ToString()) : NULL;
+  char* portStr = info.Length() > 1 && info[1]->IsString() ?
+    v8ToCharPtr(info[1]->ToString()) : NULL;
+
+  static CallStats_t stats("pigpio_start");
+  uint64_t start = uv_hrtime();
+
+  int rc = pigpio_start(addrStr, portStr);
+  stats.Record(start, rc < 0);
+  free(addrStr);
+  free(portStr);
+  if (rc < 0) {
+    return ThrowPigpiodError(rc, "pigpio_start");
+  }
+
+  if (rc < MAX_PI) {
+    piOpen_g[rc] = true;
+  }
+  ClockReset(rc);
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(pigpio_stop) {
+  if(info.Length() < 1 ||
+     !info[0]->IsInt32() // pi
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "pigpio_stop", ""));
+  }
+
+  int pi = info[0]->Int32Value();
+
+  ResourceReleasePi(pi, false);
+
+  static CallStats_t stats("pigpio_stop");
+  uint64_t start = uv_hrtime();
+
+  pigpio_stop(pi);
+  stats.Record(start, false);
+
+  if (pi >= 0 && pi < MAX_PI) {
+    piOpen_g[pi] = false;
+  }
+}
+
+
+
+// ###########################################################################
+// Beginner
+// ###########################################################################
+
+NAN_METHOD(set_mode) {
+  if(info.Length() < 3 ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // gpio
+     !info[2]->IsUint32()    // mode
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "set_mode", ""));
+  }
+
+  int      pi   = info[0]->Int32Value();
+  unsigned gpio = info[1]->Uint32Value();
+  unsigned mode = info[2]->Uint32Value();
+
+  static CallStats_t stats("set_mode");
+  uint64_t start = uv_hrtime();
+
+  GpioChip_t *chip = GpioChip(pi);
+  int rc = chip ? chip->SetMode(gpio, mode) : set_mode(pi, gpio, mode);
+  stats.Record(start, rc != 0);
+  if (rc != 0) {
+    return ThrowGpioError(chip, rc, "set_mode");
+  }
+}
+
+
+NAN_METHOD(get_mode) {
+  if(info.Length() < 2   ||
+     !info[0]->IsInt32() || // pi
+     !info[1]->IsUint32()   // gpio
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "get_mode", ""));
+  }
+
+  int      pi   = info[0]->Int32Value();
+  unsigned gpio = info[1]->Uint32Value();
+
+  static CallStats_t stats("get_mode");
+  uint64_t start = uv_hrtime();
+
+  GpioChip_t *chip = GpioChip(pi);
+  int rc = chip ? chip->GetMode(gpio) : get_mode(pi, gpio);
+  stats.Record(start, rc < 0);
+  if (rc < 0) {
+    return ThrowGpioError(chip, rc, "get_mode");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(set_pull_up_down) {
+  if(info.Length() < 2    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // gpio
+     !info[2]->IsUint32()    // pud
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "set_pull_up_down", ""));
+  }
+
+  int      pi   = info[0]->Int32Value();
+  unsigned gpio = info[1]->Uint32Value();
+  unsigned pud  = info[2]->Uint32Value();
+
+  static CallStats_t stats("set_pull_up_down");
+  uint64_t start = uv_hrtime();
+
+  GpioChip_t *chip = GpioChip(pi);
+  int rc = chip ? chip->SetPullUpDown(gpio, pud) : set_pull_up_down(pi, gpio, pud);
+  stats.Record(start, rc < 0);
+  if(rc < 0) {
+    return ThrowGpioError(chip, rc, "set_pull_up_down");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(gpio_read) {
+  if(info.Length() < 2   ||
+     !info[0]->IsInt32() || // pi
+     !info[1]->IsUint32()   // gpio
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "gpio_read", ""));
+  }
+
+  int      pi   = info[0]->Int32Value();
+  unsigned gpio = info[1]->Uint32Value();
+
+  static CallStats_t stats("gpio_read");
+  uint64_t start = uv_hrtime();
+
+  GpioChip_t *chip = GpioChip(pi);
+  int rc = chip ? chip->Read(gpio) : gpio_read(pi, gpio);
+  stats.Record(start, rc < 0);
+  if(rc < 0) {
+    return ThrowGpioError(chip, rc, "gpio_read");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(gpio_write) {
+  if(info.Length() < 3    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // gpio
+     !info[2]->IsUint32()    // level
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "gpio_write", ""));
+  }
+
+  int      pi    = info[0]->Int32Value();
+  unsigned gpio  = info[1]->Uint32Value();
+  unsigned level = info[2]->Uint32Value();
+
+  static CallStats_t stats("gpio_write");
+  uint64_t start = uv_hrtime();
+
+  GpioChip_t *chip = GpioChip(pi);
+  int rc = chip ? chip->Write(gpio, level) : gpio_write(pi, gpio, level);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowGpioError(chip, rc, "gpio_write");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+
+// ###########################################################################
+// Intermediate
+// ###########################################################################
+
+NAN_METHOD(set_watchdog) {
+  if(info.Length() < 3    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // gpio
+     !info[2]->IsUint32()    // timeout
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "set_watchdog", ""));
+  }
+
+  int      pi      = info[0]->Int32Value();
+  unsigned gpio    = info[1]->Uint32Value();
+  unsigned timeout = info[2]->Uint32Value();
+
+  static CallStats_t stats("set_watchdog");
+  uint64_t start = uv_hrtime();
+
+  int rc = set_watchdog(pi, gpio, timeout);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "set_watchdog");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(gpio_trigger) {
+  if(info.Length() < 4    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // user_gpio
+     !info[2]->IsUint32() || // pulseLen [us]
+     !info[3]->IsUint32()    // level
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "gpio_trigger", ""));
+  }
+
+  int      pi       = info[0]->Int32Value();
+  unsigned gpio     = info[1]->Uint32Value();
+  unsigned pulseLen = info[2]->Uint32Value();
+  unsigned level    = info[3]->Uint32Value();
+
+  static CallStats_t stats("gpio_trigger");
+  uint64_t start = uv_hrtime();
+
+  int rc = gpio_trigger(pi, gpio, pulseLen, level);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "gpio_trigger");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+
+// ###########################################################################
+// Advanced
+// ###########################################################################
+
+NAN_METHOD(set_glitch_filter) {
+  if(info.Length() < 3    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // gpio
+     !info[2]->IsUint32()    // steady
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "set_glitch_filter", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  unsigned gpio   = info[1]->Uint32Value();
+  unsigned steady = info[2]->Uint32Value();
+
+  static CallStats_t stats("set_glitch_filter");
+  uint64_t start = uv_hrtime();
+
+  int rc = set_glitch_filter(pi, gpio, steady);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "set_glitch_filter");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+
+NAN_METHOD(set_noise_filter) {
+  if(info.Length() < 4    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // gpio
+     !info[2]->IsUint32() || // steady
+     !info[3]->IsUint32()    // active
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "set_noise_filter", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  unsigned gpio   = info[1]->Uint32Value();
+  unsigned steady = info[2]->Uint32Value();
+  unsigned active = info[3]->Uint32Value();
+
+  static CallStats_t stats("set_noise_filter");
+  uint64_t start = uv_hrtime();
+
+  int rc = set_noise_filter(pi, gpio, steady, active);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "set_noise_filter");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+
+// ###########################################################################
+// SPI
+// ###########################################################################
+
+NAN_METHOD(spi_open) {
+  if(info.Length() < 4    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // spi_channel
+     !info[2]->IsUint32() || // baud
+     !info[3]->IsUint32()    // spi_flags
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "spi_open", ""));
+  }
+
+  int      pi          = info[0]->Int32Value();
+  unsigned spi_channel = info[1]->Uint32Value();
+  unsigned baud        = info[2]->Uint32Value();
+  unsigned spi_flags   = info[3]->Uint32Value();
+
+  static CallStats_t stats("spi_open");
+  uint64_t start = uv_hrtime();
+
+  int rc = spi_open(pi, spi_channel, baud, spi_flags);
+  stats.Record(start, rc < 0);
+  if(rc < 0) {
+    return ThrowPigpiodError(rc, "spi_open");
+  }
+  ResourceAdd(pi, RES_SPI, rc);
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(spi_close) {
+  if(info.Length() < 2    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32()    // handle
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "spi_close", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  unsigned handle = info[1]->Uint32Value();
+
+  static CallStats_t stats("spi_close");
+  uint64_t start = uv_hrtime();
+
+  int rc = spi_close(pi, handle);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "spi_close");
+  }
+  ResourceRemove(pi, RES_SPI, handle);
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+// printBits() - helper function for dumping binary values
+void printBits(int numBytes, char *bytePtr) {
+  char byte;
+  int i, j;
+
+  for(i = 0; i < numBytes; i++) {
+    for(j = 7; j >= 0; j--) {
+      byte = bytePtr[i] & (1<<j);
+      byte >>= j;
+      printf("%u", byte);
+    }
+  }
+  printf("\n");
+}
+
+
+NAN_METHOD(spi_xfer) {
+  if(info.Length() < 5    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // handle
+     !info[2]->IsObject() || // txBuf
+     !info[3]->IsObject() || // rxBuf    -> output buffer
+     !info[4]->IsUint32()    // count
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "spi_xfer", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  unsigned handle = info[1]->Uint32Value();
+  char*    txBuf  = node::Buffer::Data(info[2]->ToObject());
+  char*    rxBuf  = node::Buffer::Data(info[3]->ToObject());
+  int      count  = (int)info[4]->Uint32Value();
+
+//  printBits(count, txBuf); // debugging
+
+  static CallStats_t stats("spi_xfer");
+  uint64_t start = uv_hrtime();
+
+  int rc = spi_xfer(pi, handle, txBuf, rxBuf, count);
+  stats.Record(start, rc != count);
+  if(rc != count) {
+    printf("Error from spi_xfer count=%d, rc=%d\n", count, rc);
+    printBits(count, rxBuf); // debugging
+    return ThrowPigpiodError(rc, "spi_xfer");
+  }
+
+//  printBits(count, rxBuf); // debugging
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+
+// ###########################################################################
+// Serial
+// ###########################################################################
+
+NAN_METHOD(serial_open) {
+  if(info.Length() < 4    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsString() || // ser_tty
+     !info[2]->IsUint32() || // baud
+     !info[3]->IsUint32()    // ser_flags
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_open", ""));
+  }
+
+  int      pi        = info[0]->Int32Value();
+  char*    ser_tty   = v8ToCharPtr(info[1]->ToString());
+  unsigned baud      = info[2]->Uint32Value();
+  unsigned ser_flags = info[3]->Uint32Value();
+
+  static CallStats_t stats("serial_open");
+  uint64_t start = uv_hrtime();
+
+  int rc = serial_open(pi, ser_tty, baud, ser_flags);
+  stats.Record(start, rc < 0);
+  free(ser_tty);
+  if(rc < 0) {
+    return ThrowPigpiodError(rc, "serial_open");
+  }
+  ResourceAdd(pi, RES_SERIAL, rc);
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(serial_close) {
+  if(info.Length() < 2    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32()    // handle
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_close", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  unsigned handle = info[1]->Uint32Value();
+
+  static CallStats_t stats("serial_close");
+  uint64_t start = uv_hrtime();
+
+  int rc = serial_close(pi, handle);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "serial_close");
+  }
+  ResourceRemove(pi, RES_SERIAL, handle);
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(serial_write_byte) {
+  if(info.Length() < 3    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // handle
+     !info[2]->IsUint32()    // bVal
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_write_byte", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  unsigned handle = info[1]->Uint32Value();
+  unsigned bVal   = info[2]->Uint32Value();
+
+  static CallStats_t stats("serial_write_byte");
+  uint64_t start = uv_hrtime();
+
+  int rc = serial_write_byte(pi, handle, bVal);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "serial_write_byte");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(serial_read_byte) {
+  if(info.Length() < 2    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32()    // handle
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_read_byte", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  unsigned handle = info[1]->Uint32Value();
+
+  static CallStats_t stats("serial_read_byte");
+  uint64_t start = uv_hrtime();
+
+  int rc = serial_read_byte(pi, handle);
+  stats.Record(start, rc < 0);
+  if(rc < 0) {
+    return ThrowPigpiodError(rc, "serial_read_byte");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(serial_write) {
+  if(info.Length() < 4    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // handle
+     !info[2]->IsString() || // buf
+     !info[3]->IsUint32()    // count
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_write", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  unsigned handle = info[1]->Uint32Value();
+  char*    buf    = v8ToCharPtr(info[2]->ToString());
+  unsigned count  = info[3]->Uint32Value();
+
+  static CallStats_t stats("serial_write");
+  uint64_t start = uv_hrtime();
+
+  int rc = serial_write(pi, handle, buf, count);
+  stats.Record(start, rc != 0);
+  free(buf);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "serial_write");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(serial_read) {
+  if(info.Length() < 4    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // handle
+     !info[2]->IsObject() || // buf    -> output buffer
+     !info[3]->IsUint32()    // count
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_read", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  unsigned handle = info[1]->Uint32Value();
+  char*    buf    = node::Buffer::Data(info[2]->ToObject());
+  unsigned count  = info[3]->Uint32Value();
+
+  static CallStats_t stats("serial_read");
+  uint64_t start = uv_hrtime();
+
+  int rc = serial_read(pi, handle, buf, count);
+  stats.Record(start, rc <= 0);
+  if(rc <= 0) {
+    return ThrowPigpiodError(rc, "serial_read");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(serial_data_available) {
+  if(info.Length() < 2    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32()    // handle
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_data_available", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  unsigned handle = info[1]->Uint32Value();
+
+  static CallStats_t stats("serial_data_available");
+  uint64_t start = uv_hrtime();
+
+  int rc = serial_data_available(pi, handle);
+  stats.Record(start, rc < 0);
+  if(rc < 0) {
+    return ThrowPigpiodError(rc, "serial_data_available");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(bb_serial_read_open) {
+  if(info.Length() < 4    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // user_gpio
+     !info[2]->IsUint32() || // baud
+     !info[3]->IsUint32()    // data_bits
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_serial_read_open", ""));
+  }
+
+  int      pi        = info[0]->Int32Value();
+  unsigned user_gpio = info[1]->Uint32Value();
+  unsigned baud      = info[2]->Uint32Value();
+  unsigned data_bits = info[3]->Uint32Value();
+
+  static CallStats_t stats("bb_serial_read_open");
+  uint64_t start = uv_hrtime();
+
+  int rc = bb_serial_read_open(pi, user_gpio, baud, data_bits);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "bb_serial_read_open");
+  }
+  ResourceAdd(pi, RES_BB_SERIAL, user_gpio);
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(bb_serial_read) {
+  if(info.Length() < 4    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // user_gpio
+     !info[2]->IsObject() || // buf    -> output buffer
+     !info[3]->IsUint32()    // bufSize
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_serial_read", ""));
+  }
+
+  int      pi        = info[0]->Int32Value();
+  unsigned user_gpio = info[1]->Uint32Value();
+  char*    buf       = node::Buffer::Data(info[2]->ToObject());
+  unsigned bufSize   = info[3]->Uint32Value();
+
+  if(bufSize > node::Buffer::Length(info[2]->ToObject())) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_serial_read", ""));
+  }
+
+  static CallStats_t stats("bb_serial_read");
+  uint64_t start = uv_hrtime();
+
+  int rc = bb_serial_read(pi, user_gpio, buf, bufSize);
+  stats.Record(start, rc < 0);
+  if(rc < 0) {
+    return ThrowPigpiodError(rc, "bb_serial_read");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(bb_serial_read_close) {
+  if(info.Length() < 2    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32()    // user_gpio
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_serial_read_close", ""));
+  }
+
+  int      pi        = info[0]->Int32Value();
+  unsigned user_gpio = info[1]->Uint32Value();
+
+  static CallStats_t stats("bb_serial_read_close");
+  uint64_t start = uv_hrtime();
+
+  int rc = bb_serial_read_close(pi, user_gpio);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "bb_serial_read_close");
+  }
+  ResourceRemove(pi, RES_BB_SERIAL, user_gpio);
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(bb_serial_invert) {
+  if(info.Length() < 3    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // user_gpio
+     !info[2]->IsUint32()    // invert
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_serial_invert", ""));
+  }
+
+  int      pi        = info[0]->Int32Value();
+  unsigned user_gpio = info[1]->Uint32Value();
+  unsigned invert    = info[2]->Uint32Value();
+
+  static CallStats_t stats("bb_serial_invert");
+  uint64_t start = uv_hrtime();
+
+  int rc = bb_serial_invert(pi, user_gpio, invert);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "bb_serial_invert");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+
+// ###########################################################################
+// Serial reader
+// Drains serial sources (serial_open() handles, or GPIOs opened with
+// bb_serial_read_open()) in a background thread into a ring per source, so
+// javascript neither polls nor blocks on the daemon. The event loop takes
+// the buffered data and passes it to the handler of the source, as Buffer.
+//
+// The slots are owned by the event loop; the thread only touches the ring
+// and the state of a slot, under serialMutex_g. The daemon calls happen
+// without holding the mutex, with serialBusy_g marking the slot in use.
+// ###########################################################################
+
+#define SERIAL_SOURCE_TTY 0
+#define SERIAL_SOURCE_BB  1
+
+#define SERIAL_READERS_MAX 32
+#define SERIAL_CHUNK       1024
+
+#define SERIAL_FREE     0
+#define SERIAL_ACTIVE   1
+#define SERIAL_STOPPING 2 // stopped while the thread reads it
+#define SERIAL_ERROR    3
+
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void serialReaderEventLoopHandler(uv_async_t* handle);
+#else
+static void serialReaderEventLoopHandler(uv_async_t* handle, int status);
+#endif
+
+typedef struct
+{
+  int       state;
+  int       pi;
+  unsigned  source;
+  unsigned  handle;      // serial handle, or GPIO
+  uint64_t  interval;    // ns between reads
+  uint64_t  due;         // uv_hrtime() of the next read
+  int       error;
+  uint8_t  *ring;
+  unsigned  size;
+  unsigned  head;
+  unsigned  count;
+  double    received;
+  double    dropped;
+} SerialReader_t;
+
+static uv_mutex_t      serialMutex_g;
+static uv_async_t      serialAsync_g;
+static SerialReader_t  serialReaders_g[SERIAL_READERS_MAX];
+static Nan::Callback  *serialCallbacks_g[SERIAL_READERS_MAX]; // event loop only
+static int             serialBusy_g = -1;
+static unsigned        serialActive_g;
+static bool            serialThreadRunning_g;
+static bool            serialThreadJoinable_g;
+static uv_thread_t     serialThread_g;
+
+
+// Reads a chunk from the source, returns the number of bytes or an error.
+static int SerialReadSource(int pi, unsigned source, unsigned handle,
+  uint8_t *buf, unsigned size)
+{
+  if (source == SERIAL_SOURCE_BB) {
+    return bb_serial_read(pi, handle, buf, size);
+  }
+
+  int rc = serial_read(pi, handle, (char *) buf, size);
+
+  return rc == PI_SER_READ_NO_DATA ? 0 : rc;
+}
+
+
+// Appends to the ring, expects serialMutex_g to be locked.
+static void SerialRingPut(SerialReader_t *reader, uint8_t *data, unsigned len) {
+  for (unsigned i = 0; i < len; i++) {
+    if (reader->count == reader->size) {
+      reader->dropped += len - i;
+      break;
+    }
+    reader->ring[(reader->head + reader->count) % reader->size] = data[i];
+    reader->count++;
+  }
+  reader->received += len;
+}
+
+
+static void SerialReaderThread(void *arg) {
+  uint8_t buf[SERIAL_CHUNK];
+
+  for (;;) {
+    uint64_t now  = uv_hrtime();
+    uint64_t next = now + 10000000; // look for new readers at least each 10ms
+    bool     data = false;
+
+    for (int slot = 0; slot < SERIAL_READERS_MAX; slot++) {
+      SerialReader_t *reader = &serialReaders_g[slot];
+
+      uv_mutex_lock(&serialMutex_g);
+      if (reader->state != SERIAL_ACTIVE) {
+        uv_mutex_unlock(&serialMutex_g);
+        continue;
+      }
+      if (reader->due > now) {
+        if (reader->due < next) {
+          next = reader->due;
+        }
+        uv_mutex_unlock(&serialMutex_g);
+        continue;
+      }
+
+      int      pi     = reader->pi;
+      unsigned source = reader->source;
+      unsigned handle = reader->handle;
+
+      serialBusy_g = slot;
+      uv_mutex_unlock(&serialMutex_g);
+
+      int rc = SerialReadSource(pi, source, handle, buf, sizeof(buf));
+
+      uv_mutex_lock(&serialMutex_g);
+      serialBusy_g = -1;
+      if (reader->state == SERIAL_STOPPING) {
+        free(reader->ring);
+        reader->ring  = 0;
+        reader->state = SERIAL_FREE;
+      } else if (rc < 0) {
+        reader->error = rc;
+        reader->state = SERIAL_ERROR;
+        data = true;
+      } else {
+        SerialRingPut(reader, buf, rc);
+        data = data || rc > 0;
+
+        // a full chunk suggests there is more, read again right away
+        reader->due = rc == (int) sizeof(buf) ? now : now + reader->interval;
+        if (reader->due < next) {
+          next = reader->due;
+        }
+      }
+      uv_mutex_unlock(&serialMutex_g);
+    }
+
+    if (data) {
+      uv_async_send(&serialAsync_g);
+    }
+
+    // End when idle; a reader started later creates a new thread.
+    int slot;
+
+    uv_mutex_lock(&serialMutex_g);
+    for (slot = 0;
+         slot < SERIAL_READERS_MAX && serialReaders_g[slot].state == SERIAL_FREE;
+         slot++) {
+    }
+    if (slot == SERIAL_READERS_MAX) {
+      serialThreadRunning_g = false;
+      uv_mutex_unlock(&serialMutex_g);
+      return;
+    }
+    uv_mutex_unlock(&serialMutex_g);
+
+    SleepUntil(next);
+  }
+}
+
+
+// Frees the slot, or leaves that to the thread if it is reading it.
+// At exit javascript can't be called any more, so the handler and the
+// async handle are left alone.
+static void SerialReaderStop(int slot, bool atExit = false) {
+  SerialReader_t *reader = &serialReaders_g[slot];
+
+  if (!atExit) {
+    delete serialCallbacks_g[slot];
+    serialCallbacks_g[slot] = 0;
+  }
+
+  uv_mutex_lock(&serialMutex_g);
+  if (serialBusy_g == slot) {
+    reader->state = SERIAL_STOPPING;
+  } else {
+    free(reader->ring);
+    reader->ring  = 0;
+    reader->state = SERIAL_FREE;
+  }
+  uv_mutex_unlock(&serialMutex_g);
+
+  if (!atExit && --serialActive_g == 0) {
+    uv_unref((uv_handle_t *) &serialAsync_g);
+  }
+}
+
+
+// Stops the readers of the pi. At exit, as the connection gets closed
+// next, also waits for a read of the pi in progress, and for the thread
+// once no reader is left.
+static void SerialReaderStopPi(int pi, bool atExit) {
+  for (int slot = 0; slot < SERIAL_READERS_MAX; slot++) {
+    if (serialCallbacks_g[slot] && serialReaders_g[slot].pi == pi) {
+      SerialReaderStop(slot, atExit);
+    }
+  }
+
+  if (!atExit) {
+    return;
+  }
+
+  int slot;
+
+  uv_mutex_lock(&serialMutex_g);
+  while (serialBusy_g >= 0 && serialReaders_g[serialBusy_g].pi == pi) {
+    uv_mutex_unlock(&serialMutex_g);
+    SleepUntil(uv_hrtime() + 1000000);
+    uv_mutex_lock(&serialMutex_g);
+  }
+  for (slot = 0;
+       slot < SERIAL_READERS_MAX && serialReaders_g[slot].state == SERIAL_FREE;
+       slot++) {
+  }
+  bool join = slot == SERIAL_READERS_MAX && serialThreadJoinable_g;
+
+  serialThreadJoinable_g = serialThreadJoinable_g && !join;
+  uv_mutex_unlock(&serialMutex_g);
+
+  if (join) {
+    // the thread ends as it finds no reader
+    uv_thread_join(&serialThread_g);
+  }
+}
+
+
+// serialReaderEventLoopHandler is executed in the event loop thread.
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void serialReaderEventLoopHandler(uv_async_t* handle) {
+#else
+static void serialReaderEventLoopHandler(uv_async_t* handle, int status) {
+#endif
+  Nan::HandleScope scope;
+
+  for (int slot = 0; slot < SERIAL_READERS_MAX; slot++) {
+    SerialReader_t *reader = &serialReaders_g[slot];
+    char           *data   = 0;
+    unsigned        len    = 0;
+    int             error  = 0;
+
+    if (!serialCallbacks_g[slot]) {
+      continue;
+    }
+
+    uv_mutex_lock(&serialMutex_g);
+    if (reader->count) {
+      len  = reader->count;
+      data = (char *) malloc(len);
+      if (data) {
+        for (unsigned i = 0; i < len; i++) {
+          data[i] = reader->ring[(reader->head + i) % reader->size];
+        }
+        reader->head  = (reader->head + len) % reader->size;
+        reader->count = 0;
+      } else {
+        len = 0;
+      }
+    }
+    if (reader->state == SERIAL_ERROR) {
+      error = reader->error;
+    }
+    uv_mutex_unlock(&serialMutex_g);
+
+    if (len) {
+      v8::Local<v8::Value> args[2] = {
+        Nan::Null(),
+        Nan::NewBuffer(data, len).ToLocalChecked()
+      };
+      serialCallbacks_g[slot]->Call(2, args);
+    }
+
+    // The handler might have stopped the reader meanwhile.
+    if (error && serialCallbacks_g[slot]) {
+      char buf[128];
+
+      snprintf(buf, sizeof(buf), "pigpiod error %d in serial_reader", error);
+
+      Nan::Callback *callback = serialCallbacks_g[slot];
+
+      serialCallbacks_g[slot] = 0;
+      SerialReaderStop(slot);
+
+      v8::Local<v8::Value> args[1] = {
+        Nan::Error(buf)
+      };
+      callback->Call(1, args);
+      delete callback;
+    }
+  }
+}
+
+
+// Starts draining a source: source SERIAL_SOURCE_TTY with a serial handle,
+// or SERIAL_SOURCE_BB with a GPIO opened by bb_serial_read_open().
+// handler(err, data) gets the data as Buffer, or the read error, after
+// which the reader is stopped. Returns the reader id.
+static NAN_METHOD(serial_reader_start) {
+  if(info.Length() < 6    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // source
+     !info[2]->IsUint32() || // handle, or GPIO
+     !info[3]->IsUint32() || // ring size [bytes]
+     !info[4]->IsUint32() || // interval [ms]
+     !info[5]->IsFunction()  // handler
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_reader_start", ""));
+  }
+
+  int      pi       = info[0]->Int32Value();
+  unsigned source   = info[1]->Uint32Value();
+  unsigned handle   = info[2]->Uint32Value();
+  unsigned size     = info[3]->Uint32Value();
+  unsigned interval = info[4]->Uint32Value();
+  int      slot;
+
+  if(source > SERIAL_SOURCE_BB || size == 0) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_reader_start", ""));
+  }
+
+  uv_mutex_lock(&serialMutex_g);
+  for (slot = 0;
+       slot < SERIAL_READERS_MAX && serialReaders_g[slot].state != SERIAL_FREE;
+       slot++) {
+  }
+  uv_mutex_unlock(&serialMutex_g);
+
+  if(slot == SERIAL_READERS_MAX) {
+    return Nan::ThrowError(Nan::ErrnoException(EMFILE, "serial_reader_start", ""));
+  }
+
+  SerialReader_t *reader = &serialReaders_g[slot];
+  uint8_t        *ring   = (uint8_t *) malloc(size);
+
+  if(!ring) {
+    return Nan::ThrowError(Nan::ErrnoException(ENOMEM, "serial_reader_start", ""));
+  }
+
+  serialCallbacks_g[slot] = new Nan::Callback(info[5].As<v8::Function>());
+  if (serialActive_g++ == 0) {
+    uv_ref((uv_handle_t *) &serialAsync_g);
+  }
+
+  uv_mutex_lock(&serialMutex_g);
+  reader->pi       = pi;
+  reader->source   = source;
+  reader->handle   = handle;
+  reader->interval = (uint64_t) (interval ? interval : 1) * 1000000;
+  reader->due      = 0;
+  reader->error    = 0;
+  reader->ring     = ring;
+  reader->size     = size;
+  reader->head     = 0;
+  reader->count    = 0;
+  reader->received = 0;
+  reader->dropped  = 0;
+  reader->state    = SERIAL_ACTIVE;
+
+  if (!serialThreadRunning_g) {
+    if (serialThreadJoinable_g) {
+      // the previous thread has ended, or is about to
+      uv_thread_join(&serialThread_g);
+    }
+    serialThreadRunning_g  = true;
+    serialThreadJoinable_g = true;
+    uv_thread_create(&serialThread_g, SerialReaderThread, 0);
+  }
+  uv_mutex_unlock(&serialMutex_g);
+
+  info.GetReturnValue().Set(slot);
+}
+
+
+static NAN_METHOD(serial_reader_stop) {
+  if(info.Length() < 1    ||
+     !info[0]->IsUint32() || // reader id
+     info[0]->Uint32Value() >= SERIAL_READERS_MAX ||
+     !serialCallbacks_g[info[0]->Uint32Value()]
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_reader_stop", ""));
+  }
+
+  SerialReaderStop(info[0]->Uint32Value());
+}
+
+
+// Returns {buffered, received, dropped} [bytes].
+static NAN_METHOD(serial_reader_stats) {
+  if(info.Length() < 1    ||
+     !info[0]->IsUint32() || // reader id
+     info[0]->Uint32Value() >= SERIAL_READERS_MAX ||
+     !serialCallbacks_g[info[0]->Uint32Value()]
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_reader_stats", ""));
+  }
+
+  SerialReader_t       *reader = &serialReaders_g[info[0]->Uint32Value()];
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+
+  uv_mutex_lock(&serialMutex_g);
+  SetNumber(result, "buffered", reader->count);
+  SetNumber(result, "received", reader->received);
+  SetNumber(result, "dropped",  reader->dropped);
+  uv_mutex_unlock(&serialMutex_g);
+
+  info.GetReturnValue().Set(result);
+}
+
+
+
+// ###########################################################################
+// Bit bang SPI and I2C
+// ###########################################################################
+
+NAN_METHOD(bb_spi_open) {
+  if(info.Length() < 7    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // CS
+     !info[2]->IsUint32() || // MISO
+     !info[3]->IsUint32() || // MOSI
+     !info[4]->IsUint32() || // SCLK
+     !info[5]->IsUint32() || // baud
+     !info[6]->IsUint32()    // spi_flags
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_spi_open", ""));
+  }
+
+  int      pi        = info[0]->Int32Value();
+  unsigned CS        = info[1]->Uint32Value();
+  unsigned MISO      = info[2]->Uint32Value();
+  unsigned MOSI      = info[3]->Uint32Value();
+  unsigned SCLK      = info[4]->Uint32Value();
+  unsigned baud      = info[5]->Uint32Value();
+  unsigned spi_flags = info[6]->Uint32Value();
+
+  static CallStats_t stats("bb_spi_open");
+  uint64_t start = uv_hrtime();
+
+  int rc = bb_spi_open(pi, CS, MISO, MOSI, SCLK, baud, spi_flags);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "bb_spi_open");
+  }
+  ResourceAdd(pi, RES_BB_SPI, CS);
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(bb_spi_close) {
+  if(info.Length() < 2    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32()    // CS
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_spi_close", ""));
+  }
+
+  int      pi = info[0]->Int32Value();
+  unsigned CS = info[1]->Uint32Value();
+
+  static CallStats_t stats("bb_spi_close");
+  uint64_t start = uv_hrtime();
+
+  int rc = bb_spi_close(pi, CS);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "bb_spi_close");
+  }
+  ResourceRemove(pi, RES_BB_SPI, CS);
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(bb_spi_xfer) {
+  if(info.Length() < 5    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // CS
+     !info[2]->IsObject() || // txBuf
+     !info[3]->IsObject() || // rxBuf    -> output buffer
+     !info[4]->IsUint32()    // count
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_spi_xfer", ""));
+  }
+
+  int      pi    = info[0]->Int32Value();
+  unsigned CS    = info[1]->Uint32Value();
+  char*    txBuf = node::Buffer::Data(info[2]->ToObject());
+  char*    rxBuf = node::Buffer::Data(info[3]->ToObject());
+  unsigned count = info[4]->Uint32Value();
+
+  if(count > node::Buffer::Length(info[2]->ToObject()) ||
+     count > node::Buffer::Length(info[3]->ToObject())
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_spi_xfer", ""));
+  }
+
+  static CallStats_t stats("bb_spi_xfer");
+  uint64_t start = uv_hrtime();
+
+  int rc = bb_spi_xfer(pi, CS, txBuf, rxBuf, count);
+  stats.Record(start, rc != (int) count);
+  if(rc != (int) count) {
+    return ThrowPigpiodError(rc, "bb_spi_xfer");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(bb_i2c_open) {
+  if(info.Length() < 4    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // SDA
+     !info[2]->IsUint32() || // SCL
+     !info[3]->IsUint32()    // baud
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_i2c_open", ""));
+  }
+
+  int      pi   = info[0]->Int32Value();
+  unsigned SDA  = info[1]->Uint32Value();
+  unsigned SCL  = info[2]->Uint32Value();
+  unsigned baud = info[3]->Uint32Value();
+
+  static CallStats_t stats("bb_i2c_open");
+  uint64_t start = uv_hrtime();
+
+  int rc = bb_i2c_open(pi, SDA, SCL, baud);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "bb_i2c_open");
+  }
+  ResourceAdd(pi, RES_BB_I2C, SDA);
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(bb_i2c_close) {
+  if(info.Length() < 2    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32()    // SDA
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_i2c_close", ""));
+  }
+
+  int      pi  = info[0]->Int32Value();
+  unsigned SDA = info[1]->Uint32Value();
+
+  static CallStats_t stats("bb_i2c_close");
+  uint64_t start = uv_hrtime();
+
+  int rc = bb_i2c_close(pi, SDA);
+  stats.Record(start, rc != 0);
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "bb_i2c_close");
+  }
+  ResourceRemove(pi, RES_BB_I2C, SDA);
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+// Returns the number of bytes read into outBuf.
+NAN_METHOD(bb_i2c_zip) {
+  if(info.Length() < 6    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // SDA
+     !info[2]->IsObject() || // inBuf, the commands
+     !info[3]->IsUint32() || // inLen
+     !info[4]->IsObject() || // outBuf    -> output buffer
+     !info[5]->IsUint32()    // outLen
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_i2c_zip", ""));
+  }
+
+  int      pi     = info[0]->Int32Value();
+  unsigned SDA    = info[1]->Uint32Value();
+  char*    inBuf  = node::Buffer::Data(info[2]->ToObject());
+  unsigned inLen  = info[3]->Uint32Value();
+  char*    outBuf = node::Buffer::Data(info[4]->ToObject());
+  unsigned outLen = info[5]->Uint32Value();
+
+  if(inLen > node::Buffer::Length(info[2]->ToObject()) ||
+     outLen > node::Buffer::Length(info[4]->ToObject())
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "bb_i2c_zip", ""));
+  }
+
+  static CallStats_t stats("bb_i2c_zip");
+  uint64_t start = uv_hrtime();
+
+  int rc = bb_i2c_zip(pi, SDA, inBuf, inLen, outBuf, outLen);
+  stats.Record(start, rc < 0);
+  if(rc < 0) {
+    return ThrowPigpiodError(rc, "bb_i2c_zip");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+
+// ###########################################################################
+// Transaction lists
+// Runs a whole list of bus transfers with one call, in the libuv thread
+// pool, and returns all results in one Buffer. This avoids a synchronous
+// javascript call (and event loop block) per transfer, e.g. for a bus scan.
+//
+// List, packed little endian, one entry per transfer:
+//   uint8  op         TX_OP_*
+//   uint8  flags      TX_FLAG_*
+//   uint16 txLen      length of the data following the entry header
+//   uint16 rxLen      bytes to read (TX_OP_SPI_XFER, TX_OP_BB_SPI_XFER:
+//                     ignored, as many as written)
+//   uint16 reserved
+//   uint32 handle     SPI handle, bit bang CS or SDA; delay [us], up to
+//                     TX_DELAY_MAX, as it blocks a thread pool thread
+//   uint8  tx[txLen]
+// Result, one entry per executed transfer:
+//   int32  rc         result of the pigpiod call
+//   uint32 length     of the data following
+//   uint8  rx[length]
+// ###########################################################################
+
+#define TX_OP_DELAY       0
+#define TX_OP_SPI_XFER    1
+#define TX_OP_BB_SPI_XFER 2
+#define TX_OP_BB_I2C_ZIP  3
+
+#define TX_FLAG_STOP_ON_ERROR 1 // skip the rest of the list on an error
+
+#define TX_ENTRY_SIZE  12
+#define TX_RESULT_SIZE 8
+#define TX_DELAY_MAX   1000000 // us
+
+class TransactionWorker : public Nan::AsyncWorker {
+public:
+  TransactionWorker(Nan::Callback *callback, int pi, const char *list,
+    size_t length) :
+    Nan::AsyncWorker(callback), pi_(pi), generation_(WorkBegin(pi)),
+    length_(length), result_(0), resultLength_(0), executed_(0)
+  {
+    list_ = (char *) malloc(length ? length : 1);
+    if (list_) {
+      memcpy(list_, list, length);
+    }
+  }
+
+  ~TransactionWorker() {
+    free(list_);
+    free(result_);
+  }
+
+  // Executed in a thread pool thread.
+  void Execute() {
+    Run();
+    WorkEnd(pi_);
+  }
+
+  // Calls handler(null, results, executed).
+  void HandleOKCallback() {
+    Nan::HandleScope scope;
+
+    char *result = result_;
+
+    result_ = 0; // owned by the Buffer now
+
+    v8::Local<v8::Value> args[3] = {
+      Nan::Null(),
+      Nan::NewBuffer(result, resultLength_).ToLocalChecked(),
+      Nan::New<v8::Number>(executed_)
+    };
+    callback->Call(3, args);
+  }
+
+private:
+  void Run() {
+    size_t   capacity = 0;
+    size_t   offset;
+
+    if (!list_) {
+      return SetErrorMessage("out of memory");
+    }
+
+    // validate the list and size the result
+    for (offset = 0; offset + TX_ENTRY_SIZE <= length_; ) {
+      unsigned op    = (uint8_t) list_[offset];
+      unsigned txLen = Get16(offset + 2);
+      unsigned rxLen = op == TX_OP_BB_I2C_ZIP ? Get16(offset + 4) :
+                       op == TX_OP_DELAY ? 0 : txLen;
+
+      if (op > TX_OP_BB_I2C_ZIP) {
+        return SetErrorMessage("bad transaction op");
+      }
+      if (op == TX_OP_DELAY && Get32(offset + 8) > TX_DELAY_MAX) {
+        return SetErrorMessage("transaction delay too long");
+      }
+
+      offset   += TX_ENTRY_SIZE + txLen;
+      capacity += TX_RESULT_SIZE + rxLen;
+    }
+    if (offset != length_) {
+      return SetErrorMessage("bad transaction list length");
+    }
+
+    result_ = (char *) malloc(capacity ? capacity : 1);
+    if (!result_) {
+      return SetErrorMessage("out of memory");
+    }
+
+    for (offset = 0; offset < length_; ) {
+      unsigned op     = (uint8_t) list_[offset];
+      unsigned flags  = (uint8_t) list_[offset + 1];
+      unsigned txLen  = Get16(offset + 2);
+      unsigned rxLen  = Get16(offset + 4);
+      unsigned handle = Get32(offset + 8);
+      char    *tx     = list_ + offset + TX_ENTRY_SIZE;
+      char    *rx     = result_ + resultLength_ + TX_RESULT_SIZE;
+      int      rc;
+      unsigned got    = 0;
+
+      if (WorkStopped(pi_, generation_)) {
+        return SetErrorMessage("transaction stopped by pigpio_stop()");
+      }
+
+      switch(op) {
+        case TX_OP_SPI_XFER:
+          rc  = spi_xfer(pi_, handle, tx, rx, txLen);
+          got = rc > 0 ? rc : 0;
+          break;
+
+        case TX_OP_BB_SPI_XFER:
+          rc  = bb_spi_xfer(pi_, handle, tx, rx, txLen);
+          got = rc > 0 ? rc : 0;
+          break;
+
+        case TX_OP_BB_I2C_ZIP:
+          rc  = bb_i2c_zip(pi_, handle, tx, txLen, rx, rxLen);
+          got = rc > 0 ? rc : 0;
+          break;
+
+        default:
+          if (!WorkSleep(pi_, generation_,
+                uv_hrtime() + (uint64_t) handle * 1000)
+          ) {
+            return SetErrorMessage("transaction stopped by pigpio_stop()");
+          }
+          rc = 0;
+          break;
+      }
+
+      Put32(resultLength_, rc);
+      Put32(resultLength_ + 4, got);
+      resultLength_ += TX_RESULT_SIZE + got;
+      executed_++;
+
+      offset += TX_ENTRY_SIZE + txLen;
+
+      if (rc < 0 && (flags & TX_FLAG_STOP_ON_ERROR)) {
+        break;
+      }
+    }
+  }
+
+  unsigned Get16(size_t offset) {
+    return (uint8_t) list_[offset] | (uint8_t) list_[offset + 1] << 8;
+  }
+
+  unsigned Get32(size_t offset) {
+    return Get16(offset) | Get16(offset + 2) << 16;
+  }
+
+  void Put32(size_t offset, uint32_t value) {
+    result_[offset]     = value;
+    result_[offset + 1] = value >> 8;
+    result_[offset + 2] = value >> 16;
+    result_[offset + 3] = value >> 24;
+  }
+
+  int       pi_;
+  unsigned  generation_;
+  char     *list_;
+  size_t    length_;
+  char     *result_;
+  size_t    resultLength_;
+  unsigned  executed_;
+};
+
+
+// Queues the list, handler(err, results, executed) is called when done.
+static NAN_METHOD(transaction_run) {
+  if(info.Length() < 3    ||
+     !info[0]->IsInt32()  || // pi
+     !node::Buffer::HasInstance(info[1]) || // list
+     !info[2]->IsFunction()  // handler
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "transaction_run", ""));
+  }
+
+  int                    pi   = info[0]->Int32Value();
+  v8::Local<v8::Object>  list = info[1]->ToObject();
+
+  // The chip handles have no bus transfers.
+  if(pi < 0 || pi >= MAX_PI) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "transaction_run", ""));
+  }
+
+  Nan::AsyncQueueWorker(new TransactionWorker(
+    new Nan::Callback(info[2].As<v8::Function>()),
+    pi, node::Buffer::Data(list), node::Buffer::Length(list)));
+}
+
+
+
+// ###########################################################################
+// Output scheduler
+// Runs a list of timed output changes of bank 1 in a dedicated thread. Each
+// entry sets the GPIOs of its mask to its levels, either a delay [us] after
+// the due time of the previous entry (or of the start), or at a daemon tick
+// (extended to 64 bit, see clock_get()), translated to the host clock by
+// the clock model. The thread sleeps until the absolute due time.
+// Entries closer together than the wave threshold, which the host can't
+// hit reliably, are sent to the daemon as one wave instead, timed by its
+// DMA. If the daemon can't create the wave, the thread runs them itself.
+// The daemon has a single wave engine (wave_tx_busy() and wave_tx_stop()
+// apply to whatever wave is sent), so the schedules of all pis take turns
+// on it, from creating a wave until deleting it.
+// The result of each entry holds its lateness: the time the write returned
+// (or the wave got started) minus the due time.
+//
+// List, packed little endian, one entry per change:
+//   uint8  flags      SCHED_FLAG_*
+//   uint8  reserved[3]
+//   uint32 mask       GPIOs to change
+//   uint32 levels     their new levels
+//   uint32 reserved
+//   uint64 time       delay [us], or extended tick with SCHED_FLAG_TICK
+// Result, one entry per executed change:
+//   int32  rc         result of the pigpiod call
+//   int32  lateness   [us]
+//   uint32 flags      SCHED_RESULT_*
+// ###########################################################################
+
+#define SCHED_FLAG_TICK   1 // time is an extended tick, not a delay
+#define SCHED_RESULT_WAVE 1 // executed as part of a wave
+
+#define SCHED_ENTRY_SIZE  24
+#define SCHED_RESULT_SIZE 12
+#define SCHED_WAVE_MAX    1000     // entries per wave
+#define SCHED_SLICE       50000000 // ns, longest sleep without a stop check
+
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void scheduleDoneHandler(uv_async_t* handle);
+#else
+static void scheduleDoneHandler(uv_async_t* handle, int status);
+#endif
+
+typedef struct
+{
+  uint32_t mask;
+  uint32_t levels;
+  uint64_t due; // uv_hrtime()
+} ScheduleEntry_t;
+
+typedef struct Schedule_s
+{
+  struct Schedule_s *next;
+  unsigned           id;
+  int                pi;
+  uint64_t           threshold; // ns, closer entries are sent as a wave
+  ScheduleEntry_t   *entries;
+  unsigned           count;
+  char              *results;
+  unsigned           executed;
+  volatile int       stop;
+  bool               joined;
+  uv_thread_t        thread;
+  uv_async_t         done;
+  Nan::Callback     *callback;
+} Schedule_t;
+
+static Schedule_t *schedules_g;
+static unsigned    scheduleNextId_g = 1;
+static uv_mutex_t  waveMutex_g;
+
+
+static void ScheduleResult(Schedule_t *self, int rc, uint64_t due,
+  uint64_t done, unsigned flags)
+{
+  char    *result   = self->results + self->executed * SCHED_RESULT_SIZE;
+  int32_t  lateness = (int32_t) ((int64_t) (done - due) / 1000);
+
+  memcpy(result,     &rc,       4);
+  memcpy(result + 4, &lateness, 4);
+  memcpy(result + 8, &flags,    4);
+  self->executed++;
+}
+
+
+// Sleeps until due, returns false if stopped meanwhile.
+static bool ScheduleWait(Schedule_t *self, uint64_t due) {
+  for (;;) {
+    if (self->stop) {
+      return false;
+    }
+
+    uint64_t now = uv_hrtime();
+
+    if (now >= due) {
+      return true;
+    }
+    SleepUntil(due - now > SCHED_SLICE ? now + SCHED_SLICE : due);
+  }
+}
+
+
+// The number of entries from <first> close enough to go into one wave.
+static unsigned ScheduleWaveLength(Schedule_t *self, unsigned first) {
+  unsigned last = first;
+
+  while (last + 1 < self->count &&
+         last + 1 - first < SCHED_WAVE_MAX &&
+         self->entries[last + 1].due - self->entries[last].due < self->threshold
+  ) {
+    last++;
+  }
+
+  return last - first + 1;
+}
+
+
+// Waits for the wave engine, returns false if stopped meanwhile.
+static bool ScheduleWaveLock(Schedule_t *self) {
+  while (uv_mutex_trylock(&waveMutex_g)) {
+    if (!ScheduleWait(self, uv_hrtime() + 1000000)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+// Creates the wave of the entries, returns its id, or a pigpiod error.
+// Called with the wave engine locked.
+static int ScheduleWaveCreate(Schedule_t *self, unsigned first, unsigned num) {
+  gpioPulse_t *pulses = (gpioPulse_t *) malloc(num * sizeof(gpioPulse_t));
+
+  if (!pulses) {
+    return PI_BAD_POINTER;
+  }
+
+  for (unsigned i = 0; i < num; i++) {
+    ScheduleEntry_t *entry = &self->entries[first + i];
+
+    pulses[i].gpioOn  = entry->mask & entry->levels;
+    pulses[i].gpioOff = entry->mask & ~entry->levels;
+    pulses[i].usDelay = i + 1 < num ?
+      (uint32_t) ((entry[1].due - entry->due) / 1000) : 0;
+  }
+
+  int rc = wave_add_new(self->pi);
+
+  if (rc >= 0) {
+    rc = wave_add_generic(self->pi, num, pulses);
+  }
+  if (rc >= 0) {
+    rc = wave_create(self->pi);
+  }
+  free(pulses);
+
+  return rc;
+}
+
+
+// Sends the wave at the due time of its first entry and waits for its end.
+// Returns false if stopped meanwhile. Called with the wave engine locked.
+static bool ScheduleWaveRun(Schedule_t *self, unsigned first, unsigned num,
+  int wave)
+{
+  bool ok = ScheduleWait(self, self->entries[first].due);
+
+  if (ok) {
+    int      rc   = wave_send_once(self->pi, wave);
+    uint64_t sent = uv_hrtime();
+
+    for (unsigned i = 0; i < num; i++) {
+      ScheduleResult(self, rc < 0 ? rc : 0, self->entries[first].due, sent,
+        SCHED_RESULT_WAVE);
+    }
+
+    ok = ScheduleWait(self, self->entries[first + num - 1].due);
+    while (ok && rc >= 0 && wave_tx_busy(self->pi) == 1) {
+      ok = ScheduleWait(self, uv_hrtime() + 1000000);
+    }
+  }
+
+  if (!ok) {
+    wave_tx_stop(self->pi);
+  }
+  wave_delete(self->pi, wave);
+
+  return ok;
+}
+
+
+static void ScheduleThread(void *arg) {
+  Schedule_t *self  = (Schedule_t *) arg;
+  bool        waves = self->threshold > 0;
+
+  for (unsigned i = 0; i < self->count; ) {
+    unsigned num = waves ? ScheduleWaveLength(self, i) : 1;
+
+    if (num > 1) {
+      if (!ScheduleWaveLock(self)) {
+        break;
+      }
+
+      // Created ahead of the due time, it takes a few daemon calls.
+      int wave = ScheduleWaveCreate(self, i, num);
+
+      if (wave >= 0) {
+        bool ok = ScheduleWaveRun(self, i, num, wave);
+
+        uv_mutex_unlock(&waveMutex_g);
+        if (!ok) {
+          break;
+        }
+        i += num;
+        continue;
+      }
+      uv_mutex_unlock(&waveMutex_g);
+
+      // No wave support (or resources), the thread does its best.
+      waves = false;
+    }
+
+    ScheduleEntry_t *entry = &self->entries[i];
+    uint32_t         set   = entry->mask & entry->levels;
+    uint32_t         clear = entry->mask & ~entry->levels;
+    int              rc    = 0;
+
+    if (!ScheduleWait(self, entry->due)) {
+      break;
+    }
+
+    if (clear) {
+      rc = clear_bank_1(self->pi, clear);
+    }
+    if (set && rc >= 0) {
+      rc = set_bank_1(self->pi, set);
+    }
+    ScheduleResult(self, rc, entry->due, uv_hrtime(), 0);
+    i++;
+  }
+
+  uv_async_send(&self->done);
+}
+
+
+// Ends the thread of the schedule, its handler still gets the results.
+static void ScheduleJoin(Schedule_t *self) {
+  if (!self->joined) {
+    self->stop = 1;
+    uv_thread_join(&self->thread);
+    self->joined = true;
+  }
+}
+
+
+static void ScheduleStopPi(int pi) {
+  for (Schedule_t *self = schedules_g; self; self = self->next) {
+    if (self->pi == pi) {
+      ScheduleJoin(self);
+    }
+  }
+}
+
+
+static void ScheduleFree(uv_handle_t *handle) {
+  Schedule_t *self = (Schedule_t *) handle->data;
+
+  free(self->entries);
+  free(self->results);
+  delete self->callback;
+  delete self;
+}
+
+
+// scheduleDoneHandler is executed in the event loop thread.
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void scheduleDoneHandler(uv_async_t* handle) {
+#else
+static void scheduleDoneHandler(uv_async_t* handle, int status) {
+#endif
+  Nan::HandleScope scope;
+
+  Schedule_t  *self = (Schedule_t *) handle->data;
+  Schedule_t **link;
+
+  ScheduleJoin(self);
+
+  for (link = &schedules_g; *link != self; link = &(*link)->next) {
+  }
+  *link = self->next;
+
+  char *results = self->results;
+
+  self->results = 0; // owned by the Buffer now
+
+  v8::Local<v8::Value> args[3] = {
+    Nan::Null(),
+    Nan::NewBuffer(results, self->executed * SCHED_RESULT_SIZE).ToLocalChecked(),
+    Nan::New<v8::Number>(self->executed)
+  };
+  self->callback->Call(3, args);
+
+  uv_close((uv_handle_t *) &self->done, ScheduleFree);
+}
+
+
+// Starts the list, handler(err, results, executed) is called when done, or
+// cancelled. waveThreshold [us]: entries closer together are sent as a
+// wave, 0 to never use waves. Returns the schedule id.
+static NAN_METHOD(schedule_run) {
+  if(info.Length() < 4    ||
+     !info[0]->IsInt32()  || // pi
+     !node::Buffer::HasInstance(info[1]) || // list
+     !info[2]->IsUint32() || // waveThreshold [us]
+     !info[3]->IsFunction()  // handler
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "schedule_run", ""));
+  }
+
+  int                    pi     = info[0]->Int32Value();
+  v8::Local<v8::Object>  list   = info[1]->ToObject();
+  const uint8_t         *data   = (const uint8_t *) node::Buffer::Data(list);
+  size_t                 length = node::Buffer::Length(list);
+  unsigned               count  = length / SCHED_ENTRY_SIZE;
+
+  // The chip handles have no bank writes.
+  if(pi < 0 || pi >= MAX_PI || !count || length % SCHED_ENTRY_SIZE) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "schedule_run", ""));
+  }
+
+  ScheduleEntry_t *entries =
+    (ScheduleEntry_t *) malloc(count * sizeof(ScheduleEntry_t));
+  char            *results = (char *) malloc(count * SCHED_RESULT_SIZE);
+
+  if(!entries || !results) {
+    free(entries);
+    free(results);
+    return Nan::ThrowError(Nan::ErrnoException(ENOMEM, "schedule_run", ""));
+  }
+
+  // The due times are fixed up front, so the delays don't add up lateness.
+  uint64_t due = uv_hrtime();
+
+  for (unsigned i = 0; i < count; i++) {
+    const uint8_t *entry = data + i * SCHED_ENTRY_SIZE;
+    uint64_t       time  = 0;
+
+    memcpy(&entries[i].mask,   entry + 4, 4);
+    memcpy(&entries[i].levels, entry + 8, 4);
+    memcpy(&time,              entry + 16, 8);
+
+    if (entry[0] & SCHED_FLAG_TICK) {
+      uv_mutex_lock(&clockMutex_g);
+      due = clockModel_g[pi].ToHost(time);
+      uv_mutex_unlock(&clockMutex_g);
+
+      if (!due) {
+        free(entries);
+        free(results);
+        return Nan::ThrowError(Nan::ErrnoException(EINVAL, "schedule_run",
+          "no clock observations for the pi yet"));
+      }
+    } else {
+      due += time * 1000;
+    }
+    entries[i].due = due;
+  }
+
+  Schedule_t *self = new Schedule_t();
+
+  self->id        = scheduleNextId_g++;
+  self->pi        = pi;
+  self->threshold = (uint64_t) info[2]->Uint32Value() * 1000;
+  self->entries   = entries;
+  self->count     = count;
+  self->results   = results;
+  self->executed  = 0;
+  self->stop      = 0;
+  self->joined    = false;
+  self->callback  = new Nan::Callback(info[3].As<v8::Function>());
+
+  uv_async_init(uv_default_loop(), &self->done, scheduleDoneHandler);
+  self->done.data = self;
+
+  self->next  = schedules_g;
+  schedules_g = self;
+  uv_thread_create(&self->thread, ScheduleThread, self);
+
+  info.GetReturnValue().Set(self->id);
+}
+
+
+// Skips the rest of the schedule; its handler gets the results so far.
+static NAN_METHOD(schedule_cancel) {
+  if(info.Length() < 1    ||
+     !info[0]->IsUint32()    // schedule id
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "schedule_cancel", ""));
+  }
+
+  for (Schedule_t *self = schedules_g; self; self = self->next) {
+    if (self->id == info[0]->Uint32Value()) {
+      self->stop = 1;
+    }
+  }
+}
+
+
+
+// ###########################################################################
+// Typed handles
+// Pin, SpiDevice and SerialPort objects hold a pi (or chip handle) and a
+// GPIO or device handle. The arguments are validated once, when the object
+// is constructed, and bind() caches the data pointers of the Buffers used
+// for the transfers, so the methods on the hot path neither re-validate
+// nor convert nor allocate.
+// SpiDevice and SerialPort close their device on close(), or when garbage
+// collected; pigpio_stop() closes them as well.
+// ###########################################################################
+
+class Pin : public Nan::ObjectWrap {
+public:
+  static NAN_MODULE_INIT(Init) {
+    v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+
+    tpl->SetClassName(Nan::New("Pin").ToLocalChecked());
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    Nan::SetPrototypeMethod(tpl, "read", Read);
+    Nan::SetPrototypeMethod(tpl, "write", Write);
+    Nan::SetPrototypeMethod(tpl, "setMode", SetMode);
+    Nan::SetPrototypeMethod(tpl, "getMode", GetMode);
+
+    Nan::Set(target, Nan::New("Pin").ToLocalChecked(),
+      Nan::GetFunction(tpl).ToLocalChecked());
+  }
+
+private:
+  Pin(int pi, unsigned gpio) : pi_(pi), gpio_(gpio) {
+  }
+
+  // new Pin(pi, gpio)
+  static NAN_METHOD(New) {
+    if(!info.IsConstructCall() ||
+       info.Length() < 2       ||
+       !info[0]->IsInt32()     || // pi
+       !info[1]->IsUint32()    || // gpio
+       info[1]->Uint32Value() > PI_MAX_GPIO
+    ) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "Pin", ""));
+    }
+
+    Pin *self = new Pin(info[0]->Int32Value(), info[1]->Uint32Value());
+
+    self->Wrap(info.This());
+    info.GetReturnValue().Set(info.This());
+  }
+
+  static NAN_METHOD(Read) {
+    Pin        *self = Nan::ObjectWrap::Unwrap<Pin>(info.Holder());
+    GpioChip_t *chip = GpioChip(self->pi_);
+
+    static CallStats_t stats("Pin.read");
+    uint64_t start = uv_hrtime();
+
+    int rc = chip ? chip->Read(self->gpio_) : gpio_read(self->pi_, self->gpio_);
+    stats.Record(start, rc < 0);
+    if(rc < 0) {
+      return ThrowGpioError(chip, rc, "Pin.read");
+    }
+
+    info.GetReturnValue().Set(rc);
+  }
+
+  // write(level), the daemon rejects levels other than 0 and 1
+  static NAN_METHOD(Write) {
+    if(info.Length() < 1    ||
+       !info[0]->IsUint32()    // level
+    ) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "Pin.write", ""));
+    }
+
+    Pin        *self  = Nan::ObjectWrap::Unwrap<Pin>(info.Holder());
+    GpioChip_t *chip  = GpioChip(self->pi_);
+    unsigned    level = info[0]->Uint32Value();
+
+    static CallStats_t stats("Pin.write");
+    uint64_t start = uv_hrtime();
+
+    int rc = chip ?
+      chip->Write(self->gpio_, level) : gpio_write(self->pi_, self->gpio_, level);
+    stats.Record(start, rc != 0);
+    if(rc != 0) {
+      return ThrowGpioError(chip, rc, "Pin.write");
+    }
+  }
+
+  static NAN_METHOD(SetMode) {
+    if(info.Length() < 1    ||
+       !info[0]->IsUint32()    // mode
+    ) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "Pin.setMode", ""));
+    }
+
+    Pin        *self = Nan::ObjectWrap::Unwrap<Pin>(info.Holder());
+    GpioChip_t *chip = GpioChip(self->pi_);
+    unsigned    mode = info[0]->Uint32Value();
+
+    static CallStats_t stats("Pin.setMode");
+    uint64_t start = uv_hrtime();
+
+    int rc = chip ?
+      chip->SetMode(self->gpio_, mode) : set_mode(self->pi_, self->gpio_, mode);
+    stats.Record(start, rc != 0);
+    if(rc != 0) {
+      return ThrowGpioError(chip, rc, "Pin.setMode");
+    }
+  }
+
+  static NAN_METHOD(GetMode) {
+    Pin        *self = Nan::ObjectWrap::Unwrap<Pin>(info.Holder());
+    GpioChip_t *chip = GpioChip(self->pi_);
+
+    static CallStats_t stats("Pin.getMode");
+    uint64_t start = uv_hrtime();
+
+    int rc = chip ? chip->GetMode(self->gpio_) : get_mode(self->pi_, self->gpio_);
+    stats.Record(start, rc < 0);
+    if(rc < 0) {
+      return ThrowGpioError(chip, rc, "Pin.getMode");
+    }
+
+    info.GetReturnValue().Set(rc);
+  }
+
+  int      pi_;
+  unsigned gpio_;
+};
+
+
+// Buffers bound to a device: the data pointers are cached, the Persistent
+// references keep the Buffers (and so the memory) alive.
+class BoundBuffers_t {
+public:
+  BoundBuffers_t() : txData_(0), txLength_(0), rxData_(0), rxLength_(0) {
+  }
+
+  // bind(txBuf, rxBuf), either may be null
+  bool Bind(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+    if(info.Length() < 2 ||
+       !(info[0]->IsNull() || node::Buffer::HasInstance(info[0])) ||
+       !(info[1]->IsNull() || node::Buffer::HasInstance(info[1]))
+    ) {
+      return false;
+    }
+
+    Unbind();
+    if(!info[0]->IsNull()) {
+      tx_.Reset(info[0]->ToObject());
+      txData_   = node::Buffer::Data(info[0]);
+      txLength_ = node::Buffer::Length(info[0]);
+    }
+    if(!info[1]->IsNull()) {
+      rx_.Reset(info[1]->ToObject());
+      rxData_   = node::Buffer::Data(info[1]);
+      rxLength_ = node::Buffer::Length(info[1]);
+    }
+
+    return true;
+  }
+
+  void Unbind() {
+    tx_.Reset();
+    rx_.Reset();
+    txData_   = 0;
+    txLength_ = 0;
+    rxData_   = 0;
+    rxLength_ = 0;
+  }
+
+  char   *txData_;
+  size_t  txLength_;
+  char   *rxData_;
+  size_t  rxLength_;
+
+private:
+  Nan::Persistent<v8::Object> tx_;
+  Nan::Persistent<v8::Object> rx_;
+};
+
+
+class SpiDevice : public Nan::ObjectWrap {
+public:
+  static NAN_MODULE_INIT(Init) {
+    v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+
+    tpl->SetClassName(Nan::New("SpiDevice").ToLocalChecked());
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    Nan::SetPrototypeMethod(tpl, "bind", Bind);
+    Nan::SetPrototypeMethod(tpl, "xfer", Xfer);
+    Nan::SetPrototypeMethod(tpl, "close", Close);
+
+    Nan::Set(target, Nan::New("SpiDevice").ToLocalChecked(),
+      Nan::GetFunction(tpl).ToLocalChecked());
+  }
+
+private:
+  SpiDevice(int pi, unsigned handle) :
+    pi_(pi), handle_(handle),
+    resourceId_(ResourceAdd(pi, RES_SPI, handle, 0, &resourceId_))
+  {
+  }
+
+  ~SpiDevice() {
+    DoClose();
+  }
+
+  void DoClose() {
+    // pigpio_stop() might have closed it already
+    if(resourceId_ && ResourceRemoveId(resourceId_)) {
+      spi_close(pi_, handle_);
+    }
+    resourceId_ = 0;
+    buffers_.Unbind();
+  }
+
+  // new SpiDevice(pi, spi_channel, baud, spi_flags)
+  static NAN_METHOD(New) {
+    if(!info.IsConstructCall() ||
+       info.Length() < 4       ||
+       !info[0]->IsInt32()     || // pi
+       !info[1]->IsUint32()    || // spi_channel
+       !info[2]->IsUint32()    || // baud
+       !info[3]->IsUint32()       // spi_flags
+    ) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "SpiDevice", ""));
+    }
+
+    int pi = info[0]->Int32Value();
+
+    static CallStats_t stats("spi_open");
+    uint64_t start = uv_hrtime();
+
+    int rc = spi_open(pi, info[1]->Uint32Value(), info[2]->Uint32Value(),
+      info[3]->Uint32Value());
+    stats.Record(start, rc < 0);
+    if(rc < 0) {
+      return ThrowPigpiodError(rc, "SpiDevice");
+    }
+
+    SpiDevice *self = new SpiDevice(pi, rc);
+
+    self->Wrap(info.This());
+    info.GetReturnValue().Set(info.This());
+  }
+
+  // bind(txBuf, rxBuf)
+  static NAN_METHOD(Bind) {
+    SpiDevice *self = Nan::ObjectWrap::Unwrap<SpiDevice>(info.Holder());
+
+    if(!self->buffers_.Bind(info)) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "SpiDevice.bind", ""));
+    }
+  }
+
+  // xfer([count]) transfers count (default: all) bytes of the bound Buffers
+  static NAN_METHOD(Xfer) {
+    SpiDevice      *self    = Nan::ObjectWrap::Unwrap<SpiDevice>(info.Holder());
+    BoundBuffers_t *buffers = &self->buffers_;
+    size_t          max     = buffers->txLength_ < buffers->rxLength_ ?
+                              buffers->txLength_ : buffers->rxLength_;
+    size_t          count   = info.Length() ? info[0]->Uint32Value() : max;
+
+    if(!self->resourceId_ || count > max) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "SpiDevice.xfer", ""));
+    }
+
+    static CallStats_t stats("SpiDevice.xfer");
+    uint64_t start = uv_hrtime();
+
+    int rc = spi_xfer(self->pi_, self->handle_,
+      buffers->txData_, buffers->rxData_, count);
+    stats.Record(start, rc != (int) count);
+    if(rc != (int) count) {
+      return ThrowPigpiodError(rc, "SpiDevice.xfer");
+    }
+
+    info.GetReturnValue().Set(rc);
+  }
+
+  static NAN_METHOD(Close) {
+    Nan::ObjectWrap::Unwrap<SpiDevice>(info.Holder())->DoClose();
+  }
+
+  int            pi_;
+  unsigned       handle_;
+  unsigned       resourceId_;
+  BoundBuffers_t buffers_;
+};
+
+
+class SerialPort : public Nan::ObjectWrap {
+public:
+  static NAN_MODULE_INIT(Init) {
+    v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+
+    tpl->SetClassName(Nan::New("SerialPort").ToLocalChecked());
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    Nan::SetPrototypeMethod(tpl, "bind", Bind);
+    Nan::SetPrototypeMethod(tpl, "read", Read);
+    Nan::SetPrototypeMethod(tpl, "write", Write);
+    Nan::SetPrototypeMethod(tpl, "readByte", ReadByte);
+    Nan::SetPrototypeMethod(tpl, "writeByte", WriteByte);
+    Nan::SetPrototypeMethod(tpl, "available", Available);
+    Nan::SetPrototypeMethod(tpl, "close", Close);
+
+    Nan::Set(target, Nan::New("SerialPort").ToLocalChecked(),
+      Nan::GetFunction(tpl).ToLocalChecked());
+  }
+
+private:
+  SerialPort(int pi, unsigned handle) :
+    pi_(pi), handle_(handle),
+    resourceId_(ResourceAdd(pi, RES_SERIAL, handle, 0, &resourceId_))
+  {
+  }
+
+  ~SerialPort() {
+    DoClose();
+  }
+
+  void DoClose() {
+    // pigpio_stop() might have closed it already
+    if(resourceId_ && ResourceRemoveId(resourceId_)) {
+      serial_close(pi_, handle_);
+    }
+    resourceId_ = 0;
+    buffers_.Unbind();
+  }
+
+  // new SerialPort(pi, ser_tty, baud, ser_flags)
+  static NAN_METHOD(New) {
+    if(!info.IsConstructCall() ||
+       info.Length() < 4       ||
+       !info[0]->IsInt32()     || // pi
+       !info[1]->IsString()    || // ser_tty
+       !info[2]->IsUint32()    || // baud
+       !info[3]->IsUint32()       // ser_flags
+    ) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "SerialPort", ""));
+    }
+
+    int   pi      = info[0]->Int32Value();
+    char *ser_tty = v8ToCharPtr(info[1]->ToString());
+
+    static CallStats_t stats("serial_open");
+    uint64_t start = uv_hrtime();
+
+    int rc = serial_open(pi, ser_tty, info[2]->Uint32Value(),
+      info[3]->Uint32Value());
+    stats.Record(start, rc < 0);
+    free(ser_tty);
+    if(rc < 0) {
+      return ThrowPigpiodError(rc, "SerialPort");
+    }
+
+    SerialPort *self = new SerialPort(pi, rc);
+
+    self->Wrap(info.This());
+    info.GetReturnValue().Set(info.This());
+  }
+
+  // bind(txBuf, rxBuf)
+  static NAN_METHOD(Bind) {
+    SerialPort *self = Nan::ObjectWrap::Unwrap<SerialPort>(info.Holder());
+
+    if(!self->buffers_.Bind(info)) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "SerialPort.bind", ""));
+    }
+  }
+
+  // read([count]) reads up to count (default: all) bytes into the bound
+  // rxBuf, returns the number of bytes read, 0 if none are available.
+  static NAN_METHOD(Read) {
+    SerialPort     *self    = Nan::ObjectWrap::Unwrap<SerialPort>(info.Holder());
+    BoundBuffers_t *buffers = &self->buffers_;
+    size_t          count   = info.Length() ?
+                              info[0]->Uint32Value() : buffers->rxLength_;
+
+    if(!self->resourceId_ || count > buffers->rxLength_) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "SerialPort.read", ""));
+    }
+
+    static CallStats_t stats("SerialPort.read");
+    uint64_t start = uv_hrtime();
+
+    int rc = serial_read(self->pi_, self->handle_, buffers->rxData_, count);
+    if(rc == PI_SER_READ_NO_DATA) {
+      rc = 0;
+    }
+    stats.Record(start, rc < 0);
+    if(rc < 0) {
+      return ThrowPigpiodError(rc, "SerialPort.read");
+    }
+
+    info.GetReturnValue().Set(rc);
+  }
+
+  // write([count]) writes count (default: all) bytes of the bound txBuf
+  static NAN_METHOD(Write) {
+    SerialPort     *self    = Nan::ObjectWrap::Unwrap<SerialPort>(info.Holder());
+    BoundBuffers_t *buffers = &self->buffers_;
+    size_t          count   = info.Length() ?
+                              info[0]->Uint32Value() : buffers->txLength_;
+
+    if(!self->resourceId_ || count > buffers->txLength_) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "SerialPort.write", ""));
+    }
+
+    static CallStats_t stats("SerialPort.write");
+    uint64_t start = uv_hrtime();
+
+    int rc = serial_write(self->pi_, self->handle_, buffers->txData_, count);
+    stats.Record(start, rc != 0);
+    if(rc != 0) {
+      return ThrowPigpiodError(rc, "SerialPort.write");
+    }
+  }
+
+  // readByte() returns the byte, or -1 if none is available
+  static NAN_METHOD(ReadByte) {
+    SerialPort *self = Nan::ObjectWrap::Unwrap<SerialPort>(info.Holder());
+
+    if(!self->resourceId_) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "SerialPort.readByte", ""));
+    }
+
+    static CallStats_t stats("SerialPort.readByte");
+    uint64_t start = uv_hrtime();
+
+    int rc = serial_read_byte(self->pi_, self->handle_);
+    if(rc == PI_SER_READ_NO_DATA) {
+      rc = -1;
+      stats.Record(start, false);
+    } else {
+      stats.Record(start, rc < 0);
+      if(rc < 0) {
+        return ThrowPigpiodError(rc, "SerialPort.readByte");
+      }
+    }
+
+    info.GetReturnValue().Set(rc);
+  }
+
+  static NAN_METHOD(WriteByte) {
+    SerialPort *self = Nan::ObjectWrap::Unwrap<SerialPort>(info.Holder());
+
+    if(info.Length() < 1    ||
+       !info[0]->IsUint32() || // byte
+       !self->resourceId_
+    ) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "SerialPort.writeByte", ""));
+    }
+
+    static CallStats_t stats("SerialPort.writeByte");
+    uint64_t start = uv_hrtime();
+
+    int rc = serial_write_byte(self->pi_, self->handle_, info[0]->Uint32Value());
+    stats.Record(start, rc != 0);
+    if(rc != 0) {
+      return ThrowPigpiodError(rc, "SerialPort.writeByte");
+    }
+  }
+
+  static NAN_METHOD(Available) {
+    SerialPort *self = Nan::ObjectWrap::Unwrap<SerialPort>(info.Holder());
+
+    if(!self->resourceId_) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "SerialPort.available", ""));
+    }
+
+    static CallStats_t stats("SerialPort.available");
+    uint64_t start = uv_hrtime();
+
+    int rc = serial_data_available(self->pi_, self->handle_);
+    stats.Record(start, rc < 0);
+    if(rc < 0) {
+      return ThrowPigpiodError(rc, "SerialPort.available");
+    }
+
+    info.GetReturnValue().Set(rc);
+  }
+
+  static NAN_METHOD(Close) {
+    Nan::ObjectWrap::Unwrap<SerialPort>(info.Holder())->DoClose();
+  }
+
+  int            pi_;
+  unsigned       handle_;
+  unsigned       resourceId_;
+  BoundBuffers_t buffers_;
+};
+
+
+
+// ###########################################################################
+// Display drivers
+// Native drivers for the PCA9685 (16 channel PWM, for servos or LEDs, on
+// I2C) and for chains of MAX7219 (8x8 LED matrices, on SPI).
+// The channel array or framebuffer lives in a Buffer, which javascript
+// writes into directly, and commit() publishes to the refreshes as a whole
+// (double buffered, so a refresh never sends a half-written frame, e.g. the
+// new on count of a PCA9685 channel with its old off count). refresh()
+// commits and sends only what changed since the last refresh, in as few
+// transfers as the device allows; start(fps) refreshes the committed frame
+// from a native thread at a fixed rate, so an animation doesn't depend on
+// the event loop. The Buffer owns the memory and the driver keeps a
+// reference to it, so the memory stays valid as long as either is in use.
+// ###########################################################################
+
+class FrameDevice_t;
+
+// Only used in the event loop thread.
+static FrameDevice_t *frameDevices_g;
+
+class FrameDevice_t : public Nan::ObjectWrap {
+public:
+  // Stops the refresh threads of the pi (or chip handle), before its
+  // resources get released.
+  static void StopPi(int pi, bool atExit) {
+    for (FrameDevice_t *self = frameDevices_g; self; self = self->next_) {
+      if (self->pi_ == pi) {
+        self->StopThread(!atExit);
+      }
+    }
+  }
+
+protected:
+  FrameDevice_t(int pi, int type, unsigned handle) :
+    pi_(pi), handle_(handle),
+    resourceId_(ResourceAdd(pi, type, handle, 0, &resourceId_)),
+    frame_(0), snapshot_(0), shadow_(0), size_(0), shadowValid_(false),
+    running_(false), stop_(false), refreshes_(0), bytes_(0), errors_(0),
+    missed_(0)
+  {
+    uv_mutex_init(&mutex_);
+
+    next_          = frameDevices_g;
+    frameDevices_g = this;
+  }
+
+  virtual ~FrameDevice_t() {
+    FrameDevice_t **link;
+
+    for (link = &frameDevices_g; *link != this; link = &(*link)->next_) {
+    }
+    *link = next_;
+
+    frameBuffer_.Reset();
+    free(snapshot_);
+    free(shadow_);
+    uv_mutex_destroy(&mutex_);
+  }
+
+  static void SetPrototypeMethods(v8::Local<v8::FunctionTemplate> tpl) {
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    Nan::SetPrototypeMethod(tpl, "frame", Frame);
+    Nan::SetPrototypeMethod(tpl, "commit", Commit);
+    Nan::SetPrototypeMethod(tpl, "refresh", Refresh);
+    Nan::SetPrototypeMethod(tpl, "start", Start);
+    Nan::SetPrototypeMethod(tpl, "stop", Stop);
+    Nan::SetPrototypeMethod(tpl, "stats", Stats);
+    Nan::SetPrototypeMethod(tpl, "close", Close);
+  }
+
+  // Allocates the frame, all 0, returns false if out of memory.
+  bool AllocFrame(size_t size) {
+    char *frame = (char *) calloc(size, 1);
+
+    snapshot_ = (uint8_t *) calloc(size, 1);
+    shadow_   = (uint8_t *) malloc(size);
+    if (!frame || !snapshot_ || !shadow_) {
+      free(frame);
+      return false;
+    }
+
+    // The Buffer takes over the memory.
+    frameBuffer_.Reset(Nan::NewBuffer(frame, size).ToLocalChecked());
+    frame_ = (uint8_t *) frame;
+    size_  = size;
+
+    return true;
+  }
+
+  // Sends the changes of frame against shadow (all if !valid), updates
+  // shadow with what was sent. Returns the bytes sent, or an error.
+  // Called with mutex_ locked.
+  virtual int Push(const uint8_t *frame, uint8_t *shadow, bool valid) = 0;
+
+  // The call statistics of refresh(), only recorded in the event loop; the
+  // refresh thread only counts into the statistics of the driver.
+  virtual CallStats_t *RefreshStats() = 0;
+
+  virtual void CloseHandle() = 0;
+
+  // To be called by the destructors of the derived classes, as CloseHandle()
+  // is gone by the time of the base destructor.
+  void DoClose() {
+    StopThread(true);
+
+    // pigpio_stop() might have closed it already
+    if (resourceId_ && ResourceRemoveId(resourceId_)) {
+      CloseHandle();
+    }
+    resourceId_ = 0;
+  }
+
+  // Takes over the frame written by javascript.
+  void DoCommit() {
+    uv_mutex_lock(&mutex_);
+    memcpy(snapshot_, frame_, size_);
+    uv_mutex_unlock(&mutex_);
+  }
+
+  // Sends the committed frame.
+  int DoRefresh() {
+    uint64_t start = uv_hrtime();
+
+    uv_mutex_lock(&mutex_);
+
+    int rc = Push(snapshot_, shadow_, shadowValid_);
+
+    refreshes_++;
+    if (rc < 0) {
+      errors_++;
+    } else {
+      bytes_      += rc;
+      shadowValid_ = true;
+    }
+    refreshTime_.Record(uv_hrtime() - start);
+
+    uv_mutex_unlock(&mutex_);
+
+    return rc;
+  }
+
+  int                         pi_;
+  unsigned                    handle_;
+  unsigned                    resourceId_;
+  uv_mutex_t                  mutex_;
+
+private:
+  static void RefreshThread(void *arg) {
+    FrameDevice_t *self = (FrameDevice_t *) arg;
+    uint64_t       due  = uv_hrtime();
+
+    for (;;) {
+      uv_mutex_lock(&self->mutex_);
+      bool stop = self->stop_;
+      uv_mutex_unlock(&self->mutex_);
+
+      if (stop) {
+        return;
+      }
+
+      self->DoRefresh();
+
+      // A late refresh skips the missed frames, instead of catching up.
+      uint64_t now = uv_hrtime();
+
+      due += self->period_;
+      if (due <= now) {
+        uint64_t behind = (now - due) / self->period_ + 1;
+
+        uv_mutex_lock(&self->mutex_);
+        self->missed_ += behind;
+        uv_mutex_unlock(&self->mutex_);
+        due += behind * self->period_;
+      }
+
+      SleepUntil(due);
+    }
+  }
+
+  void StopThread(bool unref) {
+    if (!running_) {
+      return;
+    }
+
+    uv_mutex_lock(&mutex_);
+    stop_ = true;
+    uv_mutex_unlock(&mutex_);
+
+    uv_thread_join(&thread_);
+    running_ = false;
+
+    if (unref) {
+      Unref();
+    }
+  }
+
+  static NAN_METHOD(Frame) {
+    FrameDevice_t *self = Nan::ObjectWrap::Unwrap<FrameDevice_t>(info.Holder());
+
+    info.GetReturnValue().Set(Nan::New(self->frameBuffer_));
+  }
+
+  // Publishes the frame to the refresh thread, to be called once javascript
+  // completed a frame.
+  static NAN_METHOD(Commit) {
+    Nan::ObjectWrap::Unwrap<FrameDevice_t>(info.Holder())->DoCommit();
+  }
+
+  // Commits the frame and sends it, returns the number of bytes sent.
+  static NAN_METHOD(Refresh) {
+    FrameDevice_t *self = Nan::ObjectWrap::Unwrap<FrameDevice_t>(info.Holder());
+
+    if (!self->resourceId_ || self->running_) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "refresh", ""));
+    }
+
+    uint64_t start = uv_hrtime();
+
+    self->DoCommit();
+
+    int rc = self->DoRefresh();
+    self->RefreshStats()->Record(start, rc < 0);
+    if (rc < 0) {
+      return ThrowPigpiodError(rc, "refresh");
+    }
+
+    info.GetReturnValue().Set(rc);
+  }
+
+  // start(fps), refreshes from a native thread until stop().
+  static NAN_METHOD(Start) {
+    FrameDevice_t *self = Nan::ObjectWrap::Unwrap<FrameDevice_t>(info.Holder());
+
+    if(info.Length() < 1    ||
+       !info[0]->IsUint32() || // fps
+       info[0]->Uint32Value() < 1 ||
+       info[0]->Uint32Value() > 1000 ||
+       !self->resourceId_ ||
+       self->running_
+    ) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "start", ""));
+    }
+
+    self->period_  = 1000000000 / info[0]->Uint32Value();
+    self->stop_    = false;
+    self->running_ = true;
+
+    // Keeps the display going, even when javascript drops the driver.
+    self->Ref();
+
+    uv_thread_create(&self->thread_, RefreshThread, self);
+  }
+
+  static NAN_METHOD(Stop) {
+    Nan::ObjectWrap::Unwrap<FrameDevice_t>(info.Holder())->StopThread(true);
+  }
+
+  // Returns {refreshes, bytes, errors, missed, refresh}, refresh as latency
+  // statistics [us], missed the frames skipped by a late refresh thread.
+  static NAN_METHOD(Stats) {
+    FrameDevice_t        *self   = Nan::ObjectWrap::Unwrap<FrameDevice_t>(info.Holder());
+    v8::Local<v8::Object> result = Nan::New<v8::Object>();
+
+    uv_mutex_lock(&self->mutex_);
+    SetNumber(result, "refreshes", self->refreshes_);
+    SetNumber(result, "bytes",     self->bytes_);
+    SetNumber(result, "errors",    self->errors_);
+    SetNumber(result, "missed",    self->missed_);
+    Nan::Set(result, Nan::New("refresh").ToLocalChecked(),
+      self->refreshTime_.ToObject());
+    uv_mutex_unlock(&self->mutex_);
+
+    info.GetReturnValue().Set(result);
+  }
+
+  static NAN_METHOD(Close) {
+    Nan::ObjectWrap::Unwrap<FrameDevice_t>(info.Holder())->DoClose();
+  }
+
+  FrameDevice_t              *next_;
+  Nan::Persistent<v8::Object> frameBuffer_;
+  uint8_t                    *frame_;    // written by javascript
+  uint8_t                    *snapshot_; // frame_ at the last commit
+  uint8_t                    *shadow_;   // as sent to the device
+  size_t                      size_;
+  bool                        shadowValid_;
+
+  uv_thread_t                 thread_;
+  bool                        running_;  // event loop only
+  bool                        stop_;
+  uint64_t                    period_;   // ns
+
+  double                      refreshes_;
+  double                      bytes_;
+  double                      errors_;
+  double                      missed_;
+  LatencyHistogram_t          refreshTime_;
+};
+
+
+#define PCA9685_MODE1      0x00
+#define PCA9685_MODE2      0x01
+#define PCA9685_LED0       0x06
+#define PCA9685_PRESCALE   0xfe
+#define PCA9685_CHANNELS   16
+#define PCA9685_FRAME      (PCA9685_CHANNELS * 4)
+#define PCA9685_SLEEP      0x10
+#define PCA9685_AI         0x20 // register auto increment
+#define PCA9685_RESTART    0x80
+#define PCA9685_OUTDRV     0x04 // totem pole outputs
+#define PCA9685_OSCILLATOR 25000000
+
+// The frame holds the LEDn_ON_L, _ON_H, _OFF_L, _OFF_H registers of the 16
+// channels, that is an on and an off count [0..4095] per channel, as little
+// endian uint16, bit 12 for full on or full off.
+// A refresh writes the range from the first to the last changed register in
+// one auto increment transfer; the outputs change together, at its stop.
+class Pca9685 : public FrameDevice_t {
+public:
+  static NAN_MODULE_INIT(Init) {
+    v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+
+    tpl->SetClassName(Nan::New("Pca9685").ToLocalChecked());
+    SetPrototypeMethods(tpl);
+
+    Nan::Set(target, Nan::New("Pca9685").ToLocalChecked(),
+      Nan::GetFunction(tpl).ToLocalChecked());
+  }
+
+private:
+  Pca9685(int pi, unsigned handle) : FrameDevice_t(pi, RES_I2C, handle) {
+  }
+
+  ~Pca9685() {
+    DoClose();
+  }
+
+  void CloseHandle() {
+    i2c_close(pi_, handle_);
+  }
+
+  CallStats_t *RefreshStats() {
+    static CallStats_t stats("Pca9685.refresh");
+
+    return &stats;
+  }
+
+  int Push(const uint8_t *frame, uint8_t *shadow, bool valid) {
+    int first = 0;
+    int last  = PCA9685_FRAME - 1;
+
+    if (valid) {
+      while (first < PCA9685_FRAME && frame[first] == shadow[first]) {
+        first++;
+      }
+      while (last > first && frame[last] == shadow[last]) {
+        last--;
+      }
+      if (first == PCA9685_FRAME) {
+        return 0;
+      }
+    }
+
+    char buf[1 + PCA9685_FRAME];
+    int  length = last - first + 1;
+
+    buf[0] = PCA9685_LED0 + first;
+    memcpy(buf + 1, frame + first, length);
+
+    int rc = i2c_write_device(pi_, handle_, buf, length + 1);
+    if (rc != 0) {
+      return rc;
+    }
+
+    memcpy(shadow + first, frame + first, length);
+
+    return length + 1;
+  }
+
+  // Sets up the PWM frequency, returns 0 or a pigpiod error.
+  int Setup(unsigned frequency) {
+    int prescale = (PCA9685_OSCILLATOR + 2048 * frequency) /
+                   (4096 * frequency) - 1;
+
+    if (prescale < 3) {
+      prescale = 3;
+    } else if (prescale > 255) {
+      prescale = 255;
+    }
+
+    // The prescaler can only be set in sleep mode.
+    int rc = i2c_write_byte_data(pi_, handle_, PCA9685_MODE1,
+      PCA9685_SLEEP | PCA9685_AI);
+    if (rc == 0) {
+      rc = i2c_write_byte_data(pi_, handle_, PCA9685_PRESCALE, prescale);
+    }
+    if (rc == 0) {
+      rc = i2c_write_byte_data(pi_, handle_, PCA9685_MODE2, PCA9685_OUTDRV);
+    }
+    if (rc == 0) {
+      rc = i2c_write_byte_data(pi_, handle_, PCA9685_MODE1, PCA9685_AI);
+    }
+    if (rc == 0) {
+      // oscillator start up
+      SleepUntil(uv_hrtime() + 500000);
+      rc = i2c_write_byte_data(pi_, handle_, PCA9685_MODE1,
+        PCA9685_RESTART | PCA9685_AI);
+    }
+
+    return rc;
+  }
+
+  // new Pca9685(pi, i2c_bus, i2c_addr, frequency [Hz])
+  static NAN_METHOD(New) {
+    if(!info.IsConstructCall() ||
+       info.Length() < 4       ||
+       !info[0]->IsInt32()     || // pi
+       !info[1]->IsUint32()    || // i2c_bus
+       !info[2]->IsUint32()    || // i2c_addr
+       !info[3]->IsUint32()    || // frequency
+       info[3]->Uint32Value() < 24 ||
+       info[3]->Uint32Value() > 1526
+    ) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "Pca9685", ""));
+    }
+
+    int pi = info[0]->Int32Value();
+
+    static CallStats_t stats("i2c_open");
+    uint64_t start = uv_hrtime();
+
+    int rc = i2c_open(pi, info[1]->Uint32Value(), info[2]->Uint32Value(), 0);
+    stats.Record(start, rc < 0);
+    if(rc < 0) {
+      return ThrowPigpiodError(rc, "Pca9685");
+    }
+
+    Pca9685 *self = new Pca9685(pi, rc);
+
+    self->Wrap(info.This());
+
+    if(!self->AllocFrame(PCA9685_FRAME)) {
+      self->DoClose();
+      return Nan::ThrowError(Nan::ErrnoException(ENOMEM, "Pca9685", ""));
+    }
+
+    rc = self->Setup(info[3]->Uint32Value());
+    if(rc != 0) {
+      self->DoClose();
+      return ThrowPigpiodError(rc, "Pca9685");
+    }
+
+    info.GetReturnValue().Set(info.This());
+  }
+};
+
+
+#define MAX7219_DIGIT0      0x01
+#define MAX7219_DECODE_MODE 0x09
+#define MAX7219_INTENSITY   0x0a
+#define MAX7219_SCAN_LIMIT  0x0b
+#define MAX7219_SHUTDOWN    0x0c
+#define MAX7219_TEST        0x0f
+#define MAX7219_ROWS        8
+#define MAX7219_DEVICES_MAX 32
+
+// The frame holds 8 bytes (rows) per device, device 0 being the first in
+// the chain, bit 7 of a row is its column 0.
+// All devices of the chain latch their register at the end of a transfer,
+// so a refresh takes one transfer per changed row, with the row of each
+// device, instead of one per device and row.
+class Max7219 : public FrameDevice_t {
+public:
+  static NAN_MODULE_INIT(Init) {
+    v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+
+    tpl->SetClassName(Nan::New("Max7219").ToLocalChecked());
+    SetPrototypeMethods(tpl);
+    Nan::SetPrototypeMethod(tpl, "setIntensity", SetIntensity);
+
+    Nan::Set(target, Nan::New("Max7219").ToLocalChecked(),
+      Nan::GetFunction(tpl).ToLocalChecked());
+  }
+
+private:
+  Max7219(int pi, unsigned handle, unsigned devices) :
+    FrameDevice_t(pi, RES_SPI, handle), devices_(devices)
+  {
+  }
+
+  ~Max7219() {
+    DoClose();
+  }
+
+  void CloseHandle() {
+    spi_close(pi_, handle_);
+  }
+
+  CallStats_t *RefreshStats() {
+    static CallStats_t stats("Max7219.refresh");
+
+    return &stats;
+  }
+
+  // Writes the register of all devices, to the same value or, with rows,
+  // to the row of each device. Returns the bytes sent, or an error.
+  int Send(unsigned reg, unsigned value, const uint8_t *rows) {
+    char buf[2 * MAX7219_DEVICES_MAX];
+
+    // The first bytes shifted out end up in the last device of the chain.
+    for (unsigned device = 0; device < devices_; device++) {
+      char *slot = buf + 2 * (devices_ - 1 - device);
+
+      slot[0] = reg;
+      slot[1] = rows ? rows[device * MAX7219_ROWS] : value;
+    }
+
+    int rc = spi_write(pi_, handle_, buf, 2 * devices_);
+
+    return rc == (int) (2 * devices_) ? rc : (rc < 0 ? rc : PI_SPI_XFER_FAILED);
+  }
+
+  int Push(const uint8_t *frame, uint8_t *shadow, bool valid) {
+    int sent = 0;
+
+    for (unsigned row = 0; row < MAX7219_ROWS; row++) {
+      bool changed = !valid;
+
+      for (unsigned device = 0; !changed && device < devices_; device++) {
+        unsigned index = device * MAX7219_ROWS + row;
+
+        changed = frame[index] != shadow[index];
+      }
+      if (!changed) {
+        continue;
+      }
+
+      int rc = Send(MAX7219_DIGIT0 + row, 0, frame + row);
+      if (rc < 0) {
+        return rc;
+      }
+      sent += rc;
+
+      for (unsigned device = 0; device < devices_; device++) {
+        shadow[device * MAX7219_ROWS + row] = frame[device * MAX7219_ROWS + row];
+      }
+    }
+
+    return sent;
+  }
+
+  // Returns 0 or a pigpiod error.
+  int Setup(unsigned intensity) {
+    int rc = Send(MAX7219_TEST, 0, 0);
+
+    if (rc >= 0) {
+      rc = Send(MAX7219_DECODE_MODE, 0, 0);
+    }
+    if (rc >= 0) {
+      rc = Send(MAX7219_SCAN_LIMIT, MAX7219_ROWS - 1, 0);
+    }
+    if (rc >= 0) {
+      rc = Send(MAX7219_INTENSITY, intensity, 0);
+    }
+    if (rc >= 0) {
+      rc = Send(MAX7219_SHUTDOWN, 1, 0);
+    }
+
+    return rc < 0 ? rc : 0;
+  }
+
+  // new Max7219(pi, spi_channel, baud, devices, intensity)
+  static NAN_METHOD(New) {
+    if(!info.IsConstructCall() ||
+       info.Length() < 5       ||
+       !info[0]->IsInt32()     || // pi
+       !info[1]->IsUint32()    || // spi_channel
+       !info[2]->IsUint32()    || // baud
+       !info[3]->IsUint32()    || // devices
+       info[3]->Uint32Value() < 1 ||
+       info[3]->Uint32Value() > MAX7219_DEVICES_MAX ||
+       !info[4]->IsUint32()    || // intensity
+       info[4]->Uint32Value() > 15
+    ) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "Max7219", ""));
+    }
+
+    int      pi      = info[0]->Int32Value();
+    unsigned devices = info[3]->Uint32Value();
+
+    static CallStats_t stats("spi_open");
+    uint64_t start = uv_hrtime();
+
+    int rc = spi_open(pi, info[1]->Uint32Value(), info[2]->Uint32Value(), 0);
+    stats.Record(start, rc < 0);
+    if(rc < 0) {
+      return ThrowPigpiodError(rc, "Max7219");
+    }
+
+    Max7219 *self = new Max7219(pi, rc, devices);
+
+    self->Wrap(info.This());
+
+    if(!self->AllocFrame(devices * MAX7219_ROWS)) {
+      self->DoClose();
+      return Nan::ThrowError(Nan::ErrnoException(ENOMEM, "Max7219", ""));
+    }
+
+    rc = self->Setup(info[4]->Uint32Value());
+    if(rc != 0) {
+      self->DoClose();
+      return ThrowPigpiodError(rc, "Max7219");
+    }
+
+    info.GetReturnValue().Set(info.This());
+  }
+
+  // setIntensity(intensity), 0..15
+  static NAN_METHOD(SetIntensity) {
+    Max7219 *self = Nan::ObjectWrap::Unwrap<Max7219>(info.Holder());
+
+    if(info.Length() < 1    ||
+       !info[0]->IsUint32() || // intensity
+       info[0]->Uint32Value() > 15 ||
+       !self->resourceId_
+    ) {
+      return Nan::ThrowError(Nan::ErrnoException(EINVAL, "setIntensity", ""));
+    }
+
+    uv_mutex_lock(&self->mutex_);
+    int rc = self->Send(MAX7219_INTENSITY, info[0]->Uint32Value(), 0);
+    uv_mutex_unlock(&self->mutex_);
+
+    if(rc < 0) {
+      return ThrowPigpiodError(rc, "setIntensity");
+    }
+  }
+
+  unsigned devices_;
+};
+
+
+
+// ###########################################################################
+// Utilities
+// ###########################################################################
+
+NAN_METHOD(get_current_tick) {
+  if(info.Length() < 1   ||
+     !info[0]->IsInt32()    // pi
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "get_current_tick", ""));
+  }
+
+  int pi = info[0]->Int32Value();
+
+  static CallStats_t stats("get_current_tick");
+  uint64_t start = uv_hrtime();
+
+  uint32_t tick = get_current_tick(pi);
+  uint64_t end  = uv_hrtime();
+  uint64_t host;
+
+  stats.Record(start, false);
+
+  // The tick was taken before the reply, so it is an observation as well.
+  ClockObserve(pi, tick, end, &host);
+
+  info.GetReturnValue().Set(tick);
+}
+
+
+NAN_METHOD(get_hardware_revision) {
+  if(info.Length() < 1   ||
+     !info[0]->IsInt32()    // pi
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "get_hardware_revision", ""));
+  }
+
+  int pi = info[0]->Int32Value();
+
+  static CallStats_t stats("get_hardware_revision");
+  uint64_t start = uv_hrtime();
+
+  int rc = get_hardware_revision(pi);
+  stats.Record(start, rc == 0);
+
+  if(rc == 0) {
+    return ThrowPigpiodError(rc, "get_hardware_revision");
+  }
+
+  info.GetReturnValue().Set(rc);
+}
+
+
+NAN_METHOD(get_pigpio_version) {
+  if(info.Length() < 1   ||
+     !info[0]->IsInt32()    // pi
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "get_pigpio_version", ""));
+  }
+
+  int pi = info[0]->Int32Value();
+
+  static CallStats_t stats("get_pigpio_version");
+  uint64_t start = uv_hrtime();
+
+  int rc = get_pigpio_version(pi);
+  stats.Record(start, rc < 0);
+
+  if(rc < 0) {
+    return ThrowPigpiodError(rc, "get_pigpio_version");
   }
 
   info.GetReturnValue().Set(rc);
@@ -392,559 +5086,2289 @@ NAN_METHOD(set_glitch_filter) {
 
 
 
-NAN_METHOD(set_noise_filter) {
-  if(info.Length() < 4    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // gpio
-     !info[2]->IsUint32() || // steady
-     !info[3]->IsUint32()    // active
+// ###########################################################################
+// DHT22
+// This is a synchronous C implementation, as I failed to code a reliable
+// js based implementation (as - due to node.js's nature - it's
+// async handling might be busy with other tasks, so the
+// interrupt/ callback handling needed to read the DHT22 data is too slow).
+// The code is based on the example code taken from
+// http://abyz.co.uk/rpi/pigpio/examples.html
+// and I shrunk it down to the pure DHT22 handling, to make it as
+// simple as possible to get it included here.
+// Note: the function _decode_dht22() calculates temperature and humidity,
+//       but in fact I'm returning the binary data and re-run that same
+//       calculation in js. This is as I failed to return float/ double
+//       data from C code back into js - let me know if you know...
+// ###########################################################################
+
+#define DHT_GOOD         0
+#define DHT_BAD_CHECKSUM 1
+#define DHT_BAD_DATA     2
+#define DHT_TIMEOUT      3
+
+struct DHT22_s;
+typedef struct DHT22_s DHT22_t;
+
+typedef struct
+{
+  float  temperature;
+  float  humidity;
+  int    status;
+} DHT22_data_t;
+typedef void (*DHT22_CB_t)(DHT22_data_t);
+
+struct DHT22_s
+{
+  int          _cb_id;
+  int          _in_code;
+  union
+  {
+    char      *_char[8];
+    uint8_t    _byte[8];
+    uint64_t   _code;
+  };
+  int          _bits;
+  int          _data_finished;
+  DHT22_data_t _data;
+  uint32_t     _last_edge_tick;
+};
+
+static void _decode_dht22(DHT22_t *self)
+{
+  uint8_t chksum;
+  float div;
+  float t, h;
+
+  chksum = (self->_byte[1] + self->_byte[2] +
+            self->_byte[3] + self->_byte[4]) & 0xFF;
+
+  if (chksum == self->_byte[0])
+  {
+    h = ((float)((self->_byte[4]<<8) + self->_byte[3])) / 10.0;
+
+    if (self->_byte[2] & 128)
+    {
+      div = -10.0;
+    }
+    else
+    {
+      div = 10.0;
+    }
+
+    t = ((float)(((self->_byte[2]&127)<<8) + self->_byte[1])) / div;
+
+    if ((h > 110.0) || (t < -50.0) || (t > 135.0))
+    {
+      self->_data.status = DHT_BAD_DATA;
+    }
+    else
+    {
+      self->_data.temperature = t;
+      self->_data.humidity    = h;
+      self->_data.status      = DHT_GOOD;
+    }
+  }
+  else
+  {
+    self->_data.status = DHT_BAD_CHECKSUM;
+  }
+
+  self->_data_finished = 1;
+}
+
+static void _cb(
+  int cbPi, unsigned cbGpio, unsigned level, uint32_t tick, void *user)
+{
+  DHT22_t *self = (DHT22_t *)user;
+  int edge_len;
+
+  edge_len = tick - self->_last_edge_tick;
+  self->_last_edge_tick = tick;
+
+  if (edge_len > 10000)
+  {
+    self->_in_code = 1;
+    self->_bits = -2;
+    self->_code = 0;
+  }
+  else if (self->_in_code)
+  {
+    self->_bits++;
+    if (self->_bits >= 1)
+    {
+      self->_code <<= 1;
+
+      if ((edge_len >= 60) && (edge_len <= 100))
+      {
+        /* 0 bit */
+      }
+      else if ((edge_len > 100) && (edge_len <= 150))
+      {
+        /* 1 bit */
+        self->_code += 1;
+      }
+      else
+      {
+        /* invalid bit */
+        self->_in_code = 0;
+      }
+
+      if (self->_in_code)
+      {
+        if (self->_bits == 40)
+        {
+          _decode_dht22(self);
+        }
+      }
+    }
+  }
+}
+
+void DHT22(int pi, int gpio, char *buf)
+{
+  int i;
+  DHT22_t *self;
+
+  self = (DHT22_t *)malloc(sizeof(DHT22_t));
+  if (!self) {
+    return;
+  }
+
+  self->_data.temperature = 0.0;
+  self->_data.humidity    = 0.0;
+  self->_data.status      = 0;
+  self->_in_code          = 0;
+  self->_data_finished    = 0;
+  self->_last_edge_tick = get_current_tick(pi) - 10000;
+
+  set_mode(pi, gpio, PI_INPUT);
+
+  self->_cb_id = callback_ex(pi, gpio, RISING_EDGE, _cb, self);
+
+  self->_data_finished = 0;
+
+  // Trigger read
+  set_mode(pi, gpio, PI_OUTPUT);
+  gpio_write(pi, gpio, 0);
+  time_sleep(0.018);
+  set_mode(pi, gpio, PI_INPUT);
+
+  // timeout if no new reading
+  for (i = 0; i < 5; i++) /* 0.25 seconds */
+  {
+    time_sleep(0.05);
+    if (self->_data_finished)
+    {
+      break;
+    }
+  }
+
+  if (!self->_data_finished)
+  {
+    memset((void *)buf, 0, 8);
+  }
+  else
+  {
+    memcpy((void *)buf, (void *)(&self->_code), 8);
+  }
+
+  if (self->_cb_id >= 0)
+  {
+    callback_cancel(self->_cb_id);
+    self->_cb_id = -1;
+  }
+  free(self);
+}
+
+
+static NAN_METHOD(dht22_get) {
+  if(info.Length() < 3    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // gpio
+     !info[2]->IsObject()    // buf    -> output buffer
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "get_dht22", ""));
+  }
+
+  int      pi   = info[0]->Int32Value();
+  unsigned gpio = info[1]->Uint32Value();
+  char*    buf  = node::Buffer::Data(info[2]->ToObject());
+
+  static CallStats_t stats("dht22_get");
+  uint64_t start = uv_hrtime();
+
+  DHT22(pi, gpio, buf);
+  stats.Record(start, false);
+}
+
+
+
+// ###########################################################################
+// DHT22 sweep
+// Reads many DHT22 sensors in one go: a single notification pipe
+// (notify_open() on /dev/pigpioN) watches all their GPIOs, one thread of
+// the libuv pool triggers the sensors in staggered slots and feeds the
+// rising edges of each GPIO to its own decoder (_cb). So the sweep time
+// grows with the bus time of the sensors, not with a callback registration
+// per read.
+// The notification pipe is a file on the Pi, so this needs a local daemon.
+// ###########################################################################
+
+#define DHT_TRIGGER_LOW  18000000  // ns the trigger pulls the line low
+#define DHT_DATA_TIMEOUT 250000000 // ns to wait for the data of a sensor
+
+class DHT22SweepWorker : public Nan::AsyncWorker {
+public:
+  DHT22SweepWorker(Nan::Callback *callback, int pi, uint32_t mask,
+    unsigned slot) :
+    Nan::AsyncWorker(callback), pi_(pi), generation_(WorkBegin(pi)),
+    mask_(mask), slot_((uint64_t) slot * 1000000), count_(0), sensors_(0),
+    result_(0)
+  {
+    for (unsigned gpio = 0; gpio < 32; gpio++) {
+      if (mask & (1u << gpio)) {
+        gpios_[count_++] = gpio;
+      }
+    }
+  }
+
+  ~DHT22SweepWorker() {
+    free(sensors_);
+    free(result_);
+  }
+
+  void Execute() {
+    Run();
+    WorkEnd(pi_);
+  }
+
+  // Calls handler(null, data), with 8 bytes of data per GPIO, as dht22_get.
+  void HandleOKCallback() {
+    Nan::HandleScope scope;
+
+    char *result = result_;
+
+    result_ = 0; // owned by the Buffer now
+
+    v8::Local<v8::Value> args[2] = {
+      Nan::Null(),
+      Nan::NewBuffer(result, count_ * 8).ToLocalChecked()
+    };
+    callback->Call(2, args);
+  }
+
+private:
+  void Run() {
+    char error[128];
+    int  handle;
+    int  fd;
+
+    if (WorkStopped(pi_, generation_)) {
+      SetErrorMessage("dht22_sweep stopped by pigpio_stop()");
+      return;
+    }
+
+    sensors_ = (DHT22_t *) calloc(count_, sizeof(DHT22_t));
+    result_  = (char *) calloc(count_, 8);
+    if (!sensors_ || !result_) {
+      SetErrorMessage("Out of memory in dht22_sweep");
+      return;
+    }
+
+    handle = notify_open(pi_);
+    if (handle < 0) {
+      snprintf(error, sizeof(error), "pigpiod error %d in dht22_sweep", handle);
+      SetErrorMessage(error);
+      return;
+    }
+
+    char path[32];
+
+    snprintf(path, sizeof(path), "/dev/pigpio%d", handle);
+    fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+      notify_close(pi_, handle);
+      snprintf(error, sizeof(error),
+        "dht22_sweep: can't open %s, is the daemon local?", path);
+      SetErrorMessage(error);
+      return;
+    }
+
+    uint32_t tick = get_current_tick(pi_);
+
+    for (unsigned i = 0; i < count_; i++) {
+      sensors_[i]._last_edge_tick = tick - 10000;
+      set_mode(pi_, gpios_[i], PI_INPUT);
+    }
+    int rc;
+
+    levels_ = read_bank_1(pi_);
+    if ((int) levels_ < 0 && (int) levels_ > PIGPIOD_ERROR_MIN) {
+      rc = (int) levels_;
+    } else {
+      rc = notify_begin(pi_, handle, mask_);
+    }
+    if (rc < 0) {
+      notify_close(pi_, handle);
+      close(fd);
+      snprintf(error, sizeof(error), "pigpiod error %d in dht22_sweep", rc);
+      SetErrorMessage(error);
+      return;
+    }
+
+    bool done = Sweep(fd);
+
+    notify_close(pi_, handle);
+    close(fd);
+
+    if (!done) {
+      SetErrorMessage("dht22_sweep stopped by pigpio_stop()");
+      return;
+    }
+
+    for (unsigned i = 0; i < count_; i++) {
+      if (sensors_[i]._data_finished) {
+        memcpy(result_ + i * 8, &sensors_[i]._code, 8);
+      }
+    }
+  }
+
+  // Triggers sensor i at start + i * slot, and decodes the reports until
+  // all sensors delivered, or the last one timed out. Returns false if
+  // pigpio_stop() ended the sweep.
+  bool Sweep(int fd) {
+    uint64_t start     = uv_hrtime();
+    uint64_t deadline  = start + (count_ - 1) * slot_ + DHT_TRIGGER_LOW +
+                         DHT_DATA_TIMEOUT;
+    unsigned triggered = 0;
+    unsigned released  = 0;
+    unsigned finished  = 0;
+    char     buf[64 * sizeof(gpioReport_t)];
+    size_t   length    = 0;
+    bool     stopped   = false;
+
+    for (;;) {
+      uint64_t now = uv_hrtime();
+
+      // Checked at least each WORK_SLICE, as the poll below is limited.
+      stopped = WorkStopped(pi_, generation_);
+      if (stopped) {
+        break;
+      }
+
+      while (triggered < count_ && now >= start + triggered * slot_) {
+        set_mode(pi_, gpios_[triggered], PI_OUTPUT);
+        gpio_write(pi_, gpios_[triggered], 0);
+        triggered++;
+      }
+      while (released < triggered &&
+             now >= start + released * slot_ + DHT_TRIGGER_LOW) {
+        set_mode(pi_, gpios_[released], PI_INPUT);
+        released++;
+      }
+
+      if (finished == count_ || now >= deadline) {
+        break;
+      }
+
+      uint64_t next = deadline;
+
+      if (triggered < count_ && start + triggered * slot_ < next) {
+        next = start + triggered * slot_;
+      }
+      if (released < count_ &&
+          start + released * slot_ + DHT_TRIGGER_LOW < next) {
+        next = start + released * slot_ + DHT_TRIGGER_LOW;
+      }
+      if (next > now + WORK_SLICE) {
+        next = now + WORK_SLICE;
+      }
+
+      struct pollfd pfd = {fd, POLLIN, 0};
+
+      poll(&pfd, 1, next > now ? (next - now + 999999) / 1000000 : 0);
+
+      ssize_t got = read(fd, buf + length, sizeof(buf) - length);
+
+      if (got <= 0) {
+        continue;
+      }
+      length += got;
+
+      size_t used = 0;
+
+      for (; length - used >= sizeof(gpioReport_t);
+           used += sizeof(gpioReport_t)) {
+        gpioReport_t report;
+
+        memcpy(&report, buf + used, sizeof(report));
+        finished += Decode(&report);
+      }
+      memmove(buf, buf + used, length - used);
+      length -= used;
+    }
+
+    // In case the sweep ended early, no line stays low.
+    for (; released < triggered; released++) {
+      set_mode(pi_, gpios_[released], PI_INPUT);
+    }
+
+    return !stopped;
+  }
+
+  // Feeds the rising edges of the report to the decoders, returns the
+  // number of sensors which completed their data with it.
+  unsigned Decode(gpioReport_t *report) {
+    unsigned finished = 0;
+
+    if (report->flags) {
+      return 0; // watchdog, keep alive or event
+    }
+
+    uint32_t rising = (report->level ^ levels_) & report->level & mask_;
+
+    levels_ = report->level;
+
+    for (unsigned i = 0; rising && i < count_; i++) {
+      if (rising & (1u << gpios_[i])) {
+        int done = sensors_[i]._data_finished;
+
+        _cb(pi_, gpios_[i], 1, report->tick, &sensors_[i]);
+        finished += !done && sensors_[i]._data_finished;
+      }
+    }
+
+    return finished;
+  }
+
+  int       pi_;
+  unsigned  generation_;
+  uint32_t  mask_;
+  uint64_t  slot_;
+  unsigned  gpios_[32];
+  unsigned  count_;
+  uint32_t  levels_;
+  DHT22_t  *sensors_;
+  char     *result_;
+};
+
+
+// Reads the DHT22 sensors on the GPIOs in mask (bank 1), triggering one
+// each slot [ms]. handler(err, data) gets 8 bytes per GPIO, in ascending
+// GPIO order, as dht22_get, all 0 for a sensor that didn't answer.
+static NAN_METHOD(dht22_sweep) {
+  if(info.Length() < 4    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // mask
+     !info[2]->IsUint32() || // slot [ms]
+     !info[3]->IsFunction()  // handler
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "dht22_sweep", ""));
+  }
+
+  int      pi   = info[0]->Int32Value();
+  uint32_t mask = info[1]->Uint32Value();
+
+  if(pi < 0 || pi >= MAX_PI || !mask) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "dht22_sweep", ""));
+  }
+
+  Nan::AsyncQueueWorker(new DHT22SweepWorker(
+    new Nan::Callback(info[3].As<v8::Function>()),
+    pi, mask, info[2]->Uint32Value()));
+}
+
+
+
+// ###########################################################################
+// Pulse statistics
+// Collects pulse width and period statistics for a GPIO natively, so js
+// only queries the results instead of processing every single edge.
+// Per GPIO this maintains min/max/mean of the high time, the low time and
+// the period (rising edge to rising edge), a histogram of the high and low
+// times with <bucketCount> buckets of <bucketWidth> us (the last bucket
+// collects everything longer) and a ring of the last <widthCount> widths.
+// ###########################################################################
+
+#define PULSE_MAX_BUCKETS 1024
+#define PULSE_MAX_WIDTHS  65536
+
+typedef struct
+{
+  double   count;
+  double   sum;
+  uint32_t min;
+  uint32_t max;
+} PulseWidthStats_t;
+
+typedef struct
+{
+  int               _pi;
+  int               _cb_id;
+  uv_mutex_t        _mutex;
+  unsigned          _bucket_width;
+  unsigned          _bucket_count;
+  unsigned          _width_count;
+  int               _have_edge;
+  unsigned          _last_level;
+  uint32_t          _last_tick;
+  int               _have_rising;
+  uint32_t          _last_rising_tick;
+  PulseWidthStats_t _high;
+  PulseWidthStats_t _low;
+  PulseWidthStats_t _period;
+  uint32_t         *_high_histogram;
+  uint32_t         *_low_histogram;
+  uint32_t         *_widths;
+  uint8_t          *_width_levels;
+  unsigned          _width_head;
+  unsigned          _width_num;
+} PulseStats_t;
+
+// The callbacks look their statistics up under the mutex, rather than
+// getting them passed, as callback_cancel() doesn't wait for a running one.
+static uv_mutex_t    pulseMutex_g;
+static PulseStats_t *pulseStats_g[PI_MAX_USER_GPIO + 1];
+
+static void _pulse_width_add(PulseWidthStats_t *stats, uint32_t width)
+{
+  if (!stats->count || width < stats->min)
+  {
+    stats->min = width;
+  }
+  if (!stats->count || width > stats->max)
+  {
+    stats->max = width;
+  }
+  stats->count++;
+  stats->sum += width;
+}
+
+static void _pulse_reset(PulseStats_t *self)
+{
+  memset(&self->_high,   0, sizeof(self->_high));
+  memset(&self->_low,    0, sizeof(self->_low));
+  memset(&self->_period, 0, sizeof(self->_period));
+  memset(self->_high_histogram, 0, self->_bucket_count * sizeof(uint32_t));
+  memset(self->_low_histogram,  0, self->_bucket_count * sizeof(uint32_t));
+  self->_width_head  = 0;
+  self->_width_num   = 0;
+  self->_have_edge   = 0;
+  self->_have_rising = 0;
+}
+
+static void _pulse_free(PulseStats_t *self)
+{
+  uv_mutex_destroy(&self->_mutex);
+  free(self->_high_histogram);
+  free(self->_low_histogram);
+  free(self->_widths);
+  free(self->_width_levels);
+  free(self);
+}
+
+static void _pulse_edge(PulseStats_t *self, unsigned level, uint32_t tick)
+{
+  uint32_t width;
+  unsigned bucket;
+
+  uv_mutex_lock(&self->_mutex);
+
+  if (level == PI_TIMEOUT)
+  {
+    /* watchdog, no edge since a while, so the current width is unknown */
+    self->_have_edge   = 0;
+    self->_have_rising = 0;
+  }
+  else
+  {
+    if (self->_have_edge && level != self->_last_level)
+    {
+      width  = tick - self->_last_tick;
+      bucket = width / self->_bucket_width;
+      if (bucket >= self->_bucket_count)
+      {
+        bucket = self->_bucket_count - 1;
+      }
+
+      if (self->_last_level)
+      {
+        _pulse_width_add(&self->_high, width);
+        self->_high_histogram[bucket]++;
+      }
+      else
+      {
+        _pulse_width_add(&self->_low, width);
+        self->_low_histogram[bucket]++;
+      }
+
+      self->_widths[self->_width_head]       = width;
+      self->_width_levels[self->_width_head] = self->_last_level;
+      self->_width_head = (self->_width_head + 1) % self->_width_count;
+      if (self->_width_num < self->_width_count)
+      {
+        self->_width_num++;
+      }
+    }
+
+    if (level && (!self->_have_edge || level != self->_last_level))
+    {
+      if (self->_have_rising)
+      {
+        _pulse_width_add(&self->_period, tick - self->_last_rising_tick);
+      }
+      self->_have_rising      = 1;
+      self->_last_rising_tick = tick;
+    }
+
+    self->_have_edge  = 1;
+    self->_last_level = level;
+    self->_last_tick  = tick;
+  }
+
+  uv_mutex_unlock(&self->_mutex);
+}
+
+static void _pulse_cb(
+  int cbPi, unsigned cbGpio, unsigned level, uint32_t tick, void *user)
+{
+  PulseStats_t *self;
+
+  uv_mutex_lock(&pulseMutex_g);
+
+  self = pulseStats_g[cbGpio];
+  if (self && self->_pi == cbPi)
+  {
+    _pulse_edge(self, level, tick);
+  }
+
+  uv_mutex_unlock(&pulseMutex_g);
+}
+
+// Ends the statistics of the GPIO, once its callback has been cancelled.
+static void _pulse_remove(unsigned gpio)
+{
+  PulseStats_t *self = pulseStats_g[gpio];
+
+  uv_mutex_lock(&pulseMutex_g);
+  pulseStats_g[gpio] = 0;
+  uv_mutex_unlock(&pulseMutex_g);
+
+  _pulse_free(self);
+}
+
+static v8::Local<v8::Object> PulseWidthStatsToObject(PulseWidthStats_t *stats) {
+  v8::Local<v8::Object> object = Nan::New<v8::Object>();
+
+  SetNumber(object, "count", stats->count);
+  SetNumber(object, "min",   stats->min);
+  SetNumber(object, "max",   stats->max);
+  SetNumber(object, "mean",  stats->count ? stats->sum / stats->count : 0);
+
+  return object;
+}
+
+static v8::Local<v8::Array> Uint32ArrayToArray(uint32_t *values, unsigned num) {
+  v8::Local<v8::Array> array = Nan::New<v8::Array>(num);
+
+  for (unsigned i = 0; i < num; i++) {
+    Nan::Set(array, i, Nan::New<v8::Number>(values[i]));
+  }
+
+  return array;
+}
+
+
+static NAN_METHOD(pulse_stats_start) {
+  if(info.Length() < 5    ||
+     !info[0]->IsInt32()  || // pi
+     !info[1]->IsUint32() || // gpio
+     !info[2]->IsUint32() || // bucketWidth
+     !info[3]->IsUint32() || // bucketCount
+     !info[4]->IsUint32()    // widthCount
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "pulse_stats_start", ""));
+  }
+
+  int      pi          = info[0]->Int32Value();
+  unsigned gpio        = info[1]->Uint32Value();
+  unsigned bucketWidth = info[2]->Uint32Value();
+  unsigned bucketCount = info[3]->Uint32Value();
+  unsigned widthCount  = info[4]->Uint32Value();
+
+  if(gpio > PI_MAX_USER_GPIO ||
+     pulseStats_g[gpio] ||
+     bucketWidth == 0 ||
+     bucketCount == 0 || bucketCount > PULSE_MAX_BUCKETS ||
+     widthCount == 0  || widthCount > PULSE_MAX_WIDTHS
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "pulse_stats_start", ""));
+  }
+
+  PulseStats_t *self = (PulseStats_t *)calloc(1, sizeof(PulseStats_t));
+  if (!self) {
+    return Nan::ThrowError(Nan::ErrnoException(ENOMEM, "pulse_stats_start", ""));
+  }
+
+  uv_mutex_init(&self->_mutex);
+  self->_bucket_width   = bucketWidth;
+  self->_bucket_count   = bucketCount;
+  self->_width_count    = widthCount;
+  self->_high_histogram = (uint32_t *)calloc(bucketCount, sizeof(uint32_t));
+  self->_low_histogram  = (uint32_t *)calloc(bucketCount, sizeof(uint32_t));
+  self->_widths         = (uint32_t *)calloc(widthCount, sizeof(uint32_t));
+  self->_width_levels   = (uint8_t *)calloc(widthCount, sizeof(uint8_t));
+
+  if (!self->_high_histogram || !self->_low_histogram ||
+      !self->_widths || !self->_width_levels
+  ) {
+    _pulse_free(self);
+    return Nan::ThrowError(Nan::ErrnoException(ENOMEM, "pulse_stats_start", ""));
+  }
+
+  self->_pi = pi;
+
+  // In place before the registration, so that no edge gets missed.
+  uv_mutex_lock(&pulseMutex_g);
+  pulseStats_g[gpio] = self;
+  uv_mutex_unlock(&pulseMutex_g);
+
+  self->_cb_id = callback_ex(pi, gpio, EITHER_EDGE, _pulse_cb, 0);
+  if (self->_cb_id < 0) {
+    int rc = self->_cb_id;
+    _pulse_remove(gpio);
+    return ThrowPigpiodError(rc, "pulse_stats_start");
+  }
+}
+
+
+static NAN_METHOD(pulse_stats_get) {
+  if(info.Length() < 1    ||
+     !info[0]->IsUint32() || // gpio
+     info[0]->Uint32Value() > PI_MAX_USER_GPIO ||
+     !pulseStats_g[info[0]->Uint32Value()]
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "pulse_stats_get", ""));
+  }
+
+  PulseStats_t *self = pulseStats_g[info[0]->Uint32Value()];
+  PulseWidthStats_t high, low, period;
+  unsigned  bucketCount = self->_bucket_count;
+  unsigned  widthCount  = self->_width_count;
+  unsigned  widthNum;
+  uint32_t *highHistogram = (uint32_t *)malloc(bucketCount * sizeof(uint32_t));
+  uint32_t *lowHistogram  = (uint32_t *)malloc(bucketCount * sizeof(uint32_t));
+  uint32_t *widths        = (uint32_t *)malloc(widthCount * sizeof(uint32_t));
+  uint32_t *levels        = (uint32_t *)malloc(widthCount * sizeof(uint32_t));
+
+  if (!highHistogram || !lowHistogram || !widths || !levels) {
+    free(highHistogram);
+    free(lowHistogram);
+    free(widths);
+    free(levels);
+    return Nan::ThrowError(Nan::ErrnoException(ENOMEM, "pulse_stats_get", ""));
+  }
+
+  // Take a snapshot, to keep the edge handler waiting as short as possible.
+  uv_mutex_lock(&self->_mutex);
+  high     = self->_high;
+  low      = self->_low;
+  period   = self->_period;
+  widthNum = self->_width_num;
+  memcpy(highHistogram, self->_high_histogram, bucketCount * sizeof(uint32_t));
+  memcpy(lowHistogram,  self->_low_histogram,  bucketCount * sizeof(uint32_t));
+  for (unsigned i = 0; i < widthNum; i++) {
+    unsigned index = (self->_width_head + widthCount - widthNum + i) % widthCount;
+
+    widths[i] = self->_widths[index];
+    levels[i] = self->_width_levels[index];
+  }
+  uv_mutex_unlock(&self->_mutex);
+
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+
+  Nan::Set(result, Nan::New("high").ToLocalChecked(),
+    PulseWidthStatsToObject(&high));
+  Nan::Set(result, Nan::New("low").ToLocalChecked(),
+    PulseWidthStatsToObject(&low));
+  Nan::Set(result, Nan::New("period").ToLocalChecked(),
+    PulseWidthStatsToObject(&period));
+  SetNumber(result, "bucketWidth", self->_bucket_width);
+  Nan::Set(result, Nan::New("highHistogram").ToLocalChecked(),
+    Uint32ArrayToArray(highHistogram, bucketCount));
+  Nan::Set(result, Nan::New("lowHistogram").ToLocalChecked(),
+    Uint32ArrayToArray(lowHistogram, bucketCount));
+  Nan::Set(result, Nan::New("widths").ToLocalChecked(),
+    Uint32ArrayToArray(widths, widthNum));
+  Nan::Set(result, Nan::New("levels").ToLocalChecked(),
+    Uint32ArrayToArray(levels, widthNum));
+
+  free(highHistogram);
+  free(lowHistogram);
+  free(widths);
+  free(levels);
+
+  info.GetReturnValue().Set(result);
+}
+
+
+static NAN_METHOD(pulse_stats_reset) {
+  if(info.Length() < 1    ||
+     !info[0]->IsUint32() || // gpio
+     info[0]->Uint32Value() > PI_MAX_USER_GPIO ||
+     !pulseStats_g[info[0]->Uint32Value()]
   ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "set_noise_filter", ""));
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "pulse_stats_reset", ""));
   }
 
-  int      pi     = info[0]->Int32Value();
-  unsigned gpio   = info[1]->Uint32Value();
-  unsigned steady = info[2]->Uint32Value();
-  unsigned active = info[3]->Uint32Value();
+  PulseStats_t *self = pulseStats_g[info[0]->Uint32Value()];
 
-  int rc = set_noise_filter(pi, gpio, steady, active);
-  if(rc != 0) {
-    return ThrowPigpiodError(rc, "set_noise_filter");
+  uv_mutex_lock(&self->_mutex);
+  _pulse_reset(self);
+  uv_mutex_unlock(&self->_mutex);
+}
+
+
+static NAN_METHOD(pulse_stats_stop) {
+  if(info.Length() < 1    ||
+     !info[0]->IsUint32() || // gpio
+     info[0]->Uint32Value() > PI_MAX_USER_GPIO ||
+     !pulseStats_g[info[0]->Uint32Value()]
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "pulse_stats_stop", ""));
   }
 
-  info.GetReturnValue().Set(rc);
+  unsigned gpio = info[0]->Uint32Value();
+
+  int rc = callback_cancel(pulseStats_g[gpio]->_cb_id);
+
+  _pulse_remove(gpio);
+
+  if(rc != 0) {
+    return ThrowPigpiodError(rc, "pulse_stats_stop");
+  }
 }
 
 
 
 // ###########################################################################
-// SPI
+// Wait for edge
+// Non-blocking variant of wait_for_edge(). A waiter watches a set of GPIOs
+// (bitmask) for an edge and calls its handler once, from the event loop,
+// either on the first matching edge, on a watchdog report (set_watchdog) for
+// one of the GPIOs, or when the timeout expires.
+// Waiting costs no thread and no polling: the daemon callbacks are shared by
+// all waiters on a GPIO, the timeouts are uv timers in the event loop.
 // ###########################################################################
 
-NAN_METHOD(spi_open) {
-  if(info.Length() < 4    ||
+#define WAIT_PENDING  0
+#define WAIT_EDGE     1
+#define WAIT_WATCHDOG 2
+#define WAIT_TIMEOUT  3
+
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void waitEventLoopHandler(uv_async_t* handle);
+static void waitTimerHandler(uv_timer_t* handle);
+#else
+static void waitEventLoopHandler(uv_async_t* handle, int status);
+static void waitTimerHandler(uv_timer_t* handle, int status);
+#endif
+
+typedef struct EdgeWaiter_s
+{
+  struct EdgeWaiter_s *next;
+  unsigned             id;
+  int                  pi;
+  uint32_t             mask;
+  unsigned             edge;
+  int                  result;
+  unsigned             gpio;
+  unsigned             level;
+  uint32_t             tick;
+  uint64_t             tick64;
+  uint64_t             host;
+  Nan::Callback       *callback;
+  uv_timer_t           timer;
+} EdgeWaiter_t;
+
+// The list of waiters is shared with the pigpiod callback thread.
+static uv_mutex_t    waitMutex_g;
+static uv_async_t    waitAsync_g;
+static EdgeWaiter_t *waiters_g;
+static unsigned      waitNextId_g = 1;
+static unsigned      waitCount_g;
+
+// Daemon callback registrations, shared by all waiters of a GPIO.
+// Only accessed in the event loop thread.
+static int           waitCbId_g[MAX_PI][PI_MAX_USER_GPIO + 1];
+static unsigned      waitCbRefs_g[MAX_PI][PI_MAX_USER_GPIO + 1];
+
+
+// Fires the waiters matching the edge.
+static void WaitEdge(int cbPi, unsigned cbGpio, unsigned level, uint32_t tick,
+  uint64_t tick64, uint64_t host)
+{
+  EdgeWaiter_t *waiter;
+  int           fired = 0;
+
+  uv_mutex_lock(&waitMutex_g);
+
+  for (waiter = waiters_g; waiter; waiter = waiter->next)
+  {
+    if (waiter->result != WAIT_PENDING ||
+        waiter->pi != cbPi ||
+        !(waiter->mask & (1u << cbGpio))
+    )
+    {
+      continue;
+    }
+
+    if (level == PI_TIMEOUT)
+    {
+      waiter->result = WAIT_WATCHDOG;
+    }
+    else if (waiter->edge == EITHER_EDGE ||
+             (waiter->edge == RISING_EDGE  && level == 1) ||
+             (waiter->edge == FALLING_EDGE && level == 0)
+    )
+    {
+      waiter->result = WAIT_EDGE;
+    }
+    else
+    {
+      continue;
+    }
+
+    waiter->gpio   = cbGpio;
+    waiter->level  = level;
+    waiter->tick   = tick;
+    waiter->tick64 = tick64;
+    waiter->host   = host;
+    fired = 1;
+  }
+
+  uv_mutex_unlock(&waitMutex_g);
+
+  if (fired)
+  {
+    uv_async_send(&waitAsync_g);
+  }
+}
+
+
+// _wait_cb is not executed in the event loop thread
+static void _wait_cb(
+  int cbPi, unsigned cbGpio, unsigned level, uint32_t tick, void *user)
+{
+  uint64_t host;
+  uint64_t tick64 = ClockObserve(cbPi, tick, uv_hrtime(), &host);
+
+  WaitEdge(cbPi, cbGpio, level, tick, tick64, host);
+}
+
+
+static void WaitRelease(EdgeWaiter_t *waiter) {
+  for (unsigned gpio = 0; gpio <= PI_MAX_USER_GPIO; gpio++) {
+    if (!(waiter->mask & (1u << gpio))) {
+      continue;
+    }
+
+    if (--waitCbRefs_g[waiter->pi][gpio] == 0) {
+      callback_cancel(waitCbId_g[waiter->pi][gpio]);
+    }
+  }
+
+  if (--waitCount_g == 0) {
+    uv_unref((uv_handle_t *) &waitAsync_g);
+  }
+}
+
+
+static void WaitFreeHandler(uv_handle_t *handle) {
+  EdgeWaiter_t *waiter = (EdgeWaiter_t *) handle->data;
+
+  delete waiter->callback;
+  free(waiter);
+}
+
+
+// Unlinks the waiters with a result, expects waitMutex_g to be locked.
+static EdgeWaiter_t *WaitTakeFinished() {
+  EdgeWaiter_t  *finished = 0;
+  EdgeWaiter_t **link     = &waiters_g;
+
+  while (*link) {
+    EdgeWaiter_t *waiter = *link;
+
+    if (waiter->result != WAIT_PENDING) {
+      *link        = waiter->next;
+      waiter->next = finished;
+      finished     = waiter;
+    } else {
+      link = &waiter->next;
+    }
+  }
+
+  return finished;
+}
+
+
+// Executed in the event loop thread.
+static void WaitDeliver(EdgeWaiter_t *finished) {
+  Nan::HandleScope scope;
+
+  while (finished) {
+    EdgeWaiter_t *waiter = finished;
+
+    finished = waiter->next;
+
+    uv_timer_stop(&waiter->timer);
+    WaitRelease(waiter);
+
+    v8::Local<v8::Value> args[6] = {
+      Nan::New<v8::Boolean>(waiter->result != WAIT_EDGE),
+      Nan::New<v8::Integer>(waiter->gpio),
+      Nan::New<v8::Integer>(waiter->level),
+      Nan::New<v8::Uint32>(waiter->tick),
+      Nan::New<v8::Number>(waiter->tick64),
+      Nan::New<v8::Number>(HostToTime(waiter->host, RealtimeOffset()))
+    };
+    if (waiter->result == WAIT_TIMEOUT) {
+      args[1] = Nan::Undefined();
+      args[2] = Nan::Undefined();
+      args[3] = Nan::Undefined();
+      args[4] = Nan::Undefined();
+      args[5] = Nan::Undefined();
+    }
+    waiter->callback->Call(6, args);
+
+    uv_close((uv_handle_t *) &waiter->timer, WaitFreeHandler);
+  }
+}
+
+
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void waitEventLoopHandler(uv_async_t* handle) {
+#else
+static void waitEventLoopHandler(uv_async_t* handle, int status) {
+#endif
+  uv_mutex_lock(&waitMutex_g);
+  EdgeWaiter_t *finished = WaitTakeFinished();
+  uv_mutex_unlock(&waitMutex_g);
+
+  WaitDeliver(finished);
+}
+
+
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void waitTimerHandler(uv_timer_t* handle) {
+#else
+static void waitTimerHandler(uv_timer_t* handle, int status) {
+#endif
+  EdgeWaiter_t *waiter = (EdgeWaiter_t *) handle->data;
+
+  uv_mutex_lock(&waitMutex_g);
+  if (waiter->result == WAIT_PENDING) {
+    waiter->result = WAIT_TIMEOUT;
+  }
+  EdgeWaiter_t *finished = WaitTakeFinished();
+  uv_mutex_unlock(&waitMutex_g);
+
+  WaitDeliver(finished);
+}
+
+
+static NAN_METHOD(wait_for_edge_async) {
+  if(info.Length() < 5    ||
      !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // spi_channel
-     !info[2]->IsUint32() || // baud
-     !info[3]->IsUint32()    // spi_flags
+     !info[1]->IsUint32() || // gpio bitmask
+     !info[2]->IsUint32() || // edge
+     !info[3]->IsUint32() || // timeout [ms], 0 for none
+     !info[4]->IsFunction()  // handler
   ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "spi_open", ""));
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "wait_for_edge_async", ""));
   }
 
-  int      pi          = info[0]->Int32Value();
-  unsigned spi_channel = info[1]->Uint32Value();
-  unsigned baud        = info[2]->Uint32Value();
-  unsigned spi_flags   = info[3]->Uint32Value();
+  int      pi      = info[0]->Int32Value();
+  uint32_t mask    = info[1]->Uint32Value();
+  unsigned edge    = info[2]->Uint32Value();
+  unsigned timeout = info[3]->Uint32Value();
+
+  if(pi < 0 || pi >= MAX_PI ||
+     mask == 0 ||
+     edge > EITHER_EDGE
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "wait_for_edge_async", ""));
+  }
+
+  // Register the daemon callbacks first, so no edge gets lost.
+  for (unsigned gpio = 0; gpio <= PI_MAX_USER_GPIO; gpio++) {
+    if (!(mask & (1u << gpio)) || waitCbRefs_g[pi][gpio]) {
+      continue;
+    }
+
+    int rc = callback_ex(pi, gpio, EITHER_EDGE, _wait_cb, 0);
+    if (rc < 0) {
+      // Undo the registrations done so far.
+      for (unsigned undo = 0; undo < gpio; undo++) {
+        if ((mask & (1u << undo)) && waitCbRefs_g[pi][undo] == 0 &&
+            waitCbId_g[pi][undo] >= 0
+        ) {
+          callback_cancel(waitCbId_g[pi][undo]);
+          waitCbId_g[pi][undo] = -1;
+        }
+      }
+      return ThrowPigpiodError(rc, "wait_for_edge_async");
+    }
+    waitCbId_g[pi][gpio] = rc;
+  }
+
+  for (unsigned gpio = 0; gpio <= PI_MAX_USER_GPIO; gpio++) {
+    if (mask & (1u << gpio)) {
+      waitCbRefs_g[pi][gpio]++;
+    }
+  }
+
+  EdgeWaiter_t *waiter = (EdgeWaiter_t *) calloc(1, sizeof(EdgeWaiter_t));
+
+  waiter->id       = waitNextId_g++;
+  waiter->pi       = pi;
+  waiter->mask     = mask;
+  waiter->edge     = edge;
+  waiter->result   = WAIT_PENDING;
+  waiter->callback = new Nan::Callback(info[4].As<v8::Function>());
+
+  uv_timer_init(uv_default_loop(), &waiter->timer);
+  waiter->timer.data = waiter;
+  if (timeout) {
+    uv_timer_start(&waiter->timer, waitTimerHandler, timeout, 0);
+  }
+
+  if (waitCount_g++ == 0) {
+    // Pending waits keep the event loop alive.
+    uv_ref((uv_handle_t *) &waitAsync_g);
+  }
+
+  uv_mutex_lock(&waitMutex_g);
+  waiter->next = waiters_g;
+  waiters_g    = waiter;
+  uv_mutex_unlock(&waitMutex_g);
+
+  info.GetReturnValue().Set(waiter->id);
+}
+
+
+static NAN_METHOD(wait_for_edge_cancel) {
+  if(info.Length() < 1    ||
+     !info[0]->IsUint32()    // waiter id
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "wait_for_edge_cancel", ""));
+  }
+
+  unsigned      id = info[0]->Uint32Value();
+  EdgeWaiter_t *waiter;
+
+  uv_mutex_lock(&waitMutex_g);
+  for (waiter = waiters_g; waiter; waiter = waiter->next) {
+    if (waiter->id == id && waiter->result == WAIT_PENDING) {
+      waiter->result = WAIT_TIMEOUT;
+    }
+  }
+  EdgeWaiter_t *finished = WaitTakeFinished();
+  uv_mutex_unlock(&waitMutex_g);
+
+  WaitDeliver(finished);
+}
+
+
+
+// ###########################################################################
+// Periodic sampler
+// Reads the levels of a set of GPIOs (bitmask of bank 1) at a fixed period,
+// for inputs without reliable edges. Each sampler has its own thread, which
+// sleeps until the absolute due time of the next sample (SleepUntil), so the
+// schedule doesn't drift with the read time. Only the samples with a changed
+// level are queued, and handed to javascript in batches, as a Buffer of
+// SamplerRecord_t.
+// The lateness of each wake-up against the schedule is recorded in a
+// histogram, as measure of the sampling jitter.
+// ###########################################################################
+
+#define SAMPLERS_MAX      8
+#define SAMPLER_BATCH_MAX 65536    // records
+#define SAMPLER_SLICE     50000000 // ns, longest sleep without a stop check
+
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void samplerEventLoopHandler(uv_async_t* handle);
+#else
+static void samplerEventLoopHandler(uv_async_t* handle, int status);
+#endif
+
+// Little endian, 16 bytes.
+typedef struct
+{
+  uint64_t time;    // uv_hrtime() of the sample [us]
+  uint32_t levels;  // levels of the sampled GPIOs
+  uint32_t changed; // GPIOs changed since the previous record
+} SamplerRecord_t;
+
+typedef struct
+{
+  bool                used;     // event loop only
+  unsigned            id;       // event loop only, unique, slots get reused
+  Nan::Callback      *callback; // event loop only
+  uv_thread_t         thread;
+  int                 pi;
+  uint32_t            mask;
+  uint64_t            period;   // ns
+  uint64_t            maxDelay; // ns a record may wait for its batch
+  unsigned            batch;
+  bool                stop;
+  int                 error;
+  SamplerRecord_t    *ring;
+  unsigned            size;
+  unsigned            head;
+  unsigned            count;
+  uint32_t            last;     // levels of the last queued record
+  double              samples;
+  double              records;
+  double              dropped;
+  double              missed;   // periods skipped, as the thread was late
+  LatencyHistogram_t  jitter;
+  LatencyHistogram_t  read;
+} Sampler_t;
+
+static uv_mutex_t samplerMutex_g;
+static uv_async_t samplerAsync_g;
+static Sampler_t  samplers_g[SAMPLERS_MAX];
+static unsigned   samplerActive_g;
+static unsigned   samplerNextId_g = 1;
+
+
+static void SamplerThread(void *arg) {
+  Sampler_t *self    = (Sampler_t *) arg;
+  uint64_t   due     = uv_hrtime();
+  uint64_t   flushed = due;
+  bool       first   = true;
+
+  for (;;) {
+    uv_mutex_lock(&samplerMutex_g);
+    bool stop = self->stop;
+    uv_mutex_unlock(&samplerMutex_g);
+
+    if (stop) {
+      return;
+    }
+
+    // Sleep in slices, to notice a stop request in time.
+    uint64_t now = uv_hrtime();
+
+    if (now < due) {
+      SleepUntil(due - now > SAMPLER_SLICE ? now + SAMPLER_SLICE : due);
+      continue;
+    }
+
+    uint32_t levels = read_bank_1(self->pi);
+    uint64_t end    = uv_hrtime();
+    bool     notify = false;
+
+    uv_mutex_lock(&samplerMutex_g);
+    self->jitter.Record(now - due);
+    self->read.Record(end - now);
+
+    if ((int) levels < 0 && (int) levels > PIGPIOD_ERROR_MIN) {
+      self->error = (int) levels;
+      uv_mutex_unlock(&samplerMutex_g);
+      uv_async_send(&samplerAsync_g);
+      return;
+    }
+
+    levels &= self->mask;
+    self->samples++;
+
+    if (first || levels != self->last) {
+      if (self->count == self->size) {
+        // The change stays pending against <last>, so it gets reported
+        // with the next record queued.
+        self->dropped++;
+      } else {
+        SamplerRecord_t *record =
+          &self->ring[(self->head + self->count) % self->size];
+
+        record->time    = now / 1000;
+        record->levels  = levels;
+        record->changed = first ? self->mask : levels ^ self->last;
+        self->count++;
+        self->records++;
+        self->last = levels;
+        first      = false;
+      }
+    }
+
+    if (self->count &&
+        (self->count >= self->batch || end - flushed >= self->maxDelay)
+    ) {
+      flushed = end;
+      notify  = true;
+    }
+
+    // A late thread skips the missed periods, instead of catching up.
+    due += self->period;
+    if (due <= end) {
+      uint64_t behind = (end - due) / self->period + 1;
+
+      self->missed += behind;
+      due          += behind * self->period;
+    }
+    uv_mutex_unlock(&samplerMutex_g);
+
+    if (notify) {
+      uv_async_send(&samplerAsync_g);
+    }
+  }
+}
+
+
+// Ends the thread and frees the sampler. At exit javascript can't be called
+// any more, so the handler is left alone then.
+static void SamplerStop(int slot, bool atExit) {
+  Sampler_t *self = &samplers_g[slot];
+
+  uv_mutex_lock(&samplerMutex_g);
+  self->stop = true;
+  uv_mutex_unlock(&samplerMutex_g);
+  uv_thread_join(&self->thread);
+
+  free(self->ring);
+  self->ring = 0;
+  self->used = false;
+
+  if (!atExit) {
+    delete self->callback;
+    self->callback = 0;
+
+    if (--samplerActive_g == 0) {
+      uv_unref((uv_handle_t *) &samplerAsync_g);
+    }
+  }
+}
+
+
+// The slot of the sampler with the id, or -1 if it has been stopped.
+static int SamplerSlot(unsigned id) {
+  for (int slot = 0; slot < SAMPLERS_MAX; slot++) {
+    if (samplers_g[slot].used && samplers_g[slot].id == id) {
+      return slot;
+    }
+  }
+
+  return -1;
+}
+
+
+static void SamplerStopPi(int pi, bool atExit) {
+  for (int slot = 0; slot < SAMPLERS_MAX; slot++) {
+    if (samplers_g[slot].used && samplers_g[slot].pi == pi) {
+      SamplerStop(slot, atExit);
+    }
+  }
+}
+
+
+// samplerEventLoopHandler is executed in the event loop thread.
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void samplerEventLoopHandler(uv_async_t* handle) {
+#else
+static void samplerEventLoopHandler(uv_async_t* handle, int status) {
+#endif
+  Nan::HandleScope scope;
+
+  for (int slot = 0; slot < SAMPLERS_MAX; slot++) {
+    Sampler_t *self  = &samplers_g[slot];
+    unsigned   id    = self->id;
+    char      *data  = 0;
+    unsigned   count = 0;
+    int        error = 0;
+
+    if (!self->used) {
+      continue;
+    }
+
+    uv_mutex_lock(&samplerMutex_g);
+    if (self->count) {
+      data = (char *) malloc(self->count * sizeof(SamplerRecord_t));
+      if (data) {
+        count = self->count;
+        for (unsigned i = 0; i < count; i++) {
+          memcpy(data + i * sizeof(SamplerRecord_t),
+            &self->ring[(self->head + i) % self->size], sizeof(SamplerRecord_t));
+        }
+        self->head  = (self->head + count) % self->size;
+        self->count = 0;
+      }
+    }
+    error = self->error;
+    uv_mutex_unlock(&samplerMutex_g);
+
+    if (count) {
+      v8::Local<v8::Value> args[2] = {
+        Nan::Null(),
+        Nan::NewBuffer(data, count * sizeof(SamplerRecord_t)).ToLocalChecked()
+      };
+      self->callback->Call(2, args);
+    }
+
+    // The handler might have stopped the sampler meanwhile, and started
+    // another one in its slot.
+    if (error && self->used && self->id == id) {
+      char buf[128];
+
+      snprintf(buf, sizeof(buf), "pigpiod error %d in sampler", error);
 
-  int rc = spi_open(pi, spi_channel, baud, spi_flags);
-  if(rc < 0) {
-    return ThrowPigpiodError(rc, "spi_open");
-  }
+      Nan::Callback *callback = self->callback;
 
-  info.GetReturnValue().Set(rc);
+      self->callback = 0;
+      SamplerStop(slot, false);
+
+      v8::Local<v8::Value> args[1] = {
+        Nan::Error(buf)
+      };
+      callback->Call(1, args);
+      delete callback;
+    }
+  }
 }
 
 
-NAN_METHOD(spi_close) {
-  if(info.Length() < 2    ||
+// Samples the GPIOs in mask each period [us]. handler(err, records) gets the
+// changed samples as Buffer of 16 byte records
+//   time    uint64 [us], on the clock of uv_hrtime() / process.hrtime()
+//   levels  uint32
+//   changed uint32, the first record has all bits of mask set
+// once <batch> records are queued, or the oldest waited maxDelay [ms].
+// On a read error the sampler stops, and handler gets the error.
+// Returns the sampler id, not reused after the sampler stopped (e.g. on
+// pigpio_stop()). batch is limited to SAMPLER_BATCH_MAX.
+static NAN_METHOD(sampler_start) {
+  if(info.Length() < 6    ||
      !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32()    // handle
+     !info[1]->IsUint32() || // mask
+     !info[2]->IsUint32() || // period [us]
+     !info[3]->IsUint32() || // batch [records]
+     !info[4]->IsUint32() || // maxDelay [ms]
+     !info[5]->IsFunction()  // handler
   ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "spi_close", ""));
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "sampler_start", ""));
   }
 
   int      pi     = info[0]->Int32Value();
-  unsigned handle = info[1]->Uint32Value();
-
-  int rc = spi_close(pi, handle);
-  if(rc != 0) {
-    return ThrowPigpiodError(rc, "spi_close");
+  uint32_t mask   = info[1]->Uint32Value();
+  unsigned period = info[2]->Uint32Value();
+  unsigned batch  = info[3]->Uint32Value();
+  int      slot;
+
+  // The chip handles have no bank read.
+  if(pi < 0 || pi >= MAX_PI || !mask || !period ||
+     !batch || batch > SAMPLER_BATCH_MAX
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "sampler_start", ""));
   }
 
-  info.GetReturnValue().Set(rc);
-}
+  for (slot = 0; slot < SAMPLERS_MAX && samplers_g[slot].used; slot++) {
+  }
+  if(slot == SAMPLERS_MAX) {
+    return Nan::ThrowError(Nan::ErrnoException(EMFILE, "sampler_start", ""));
+  }
 
+  Sampler_t *self = &samplers_g[slot];
+  unsigned   size = batch < 256 ? 1024 : batch * 4;
 
-// printBits() - helper function for dumping binary values
-void printBits(int numBytes, char *bytePtr) {
-  char byte;
-  int i, j;
+  self->ring = (SamplerRecord_t *) malloc(size * sizeof(SamplerRecord_t));
+  if(!self->ring) {
+    return Nan::ThrowError(Nan::ErrnoException(ENOMEM, "sampler_start", ""));
+  }
 
-  for(i = 0; i < numBytes; i++) {
-    for(j = 7; j >= 0; j--) {
-      byte = bytePtr[i] & (1<<j);
-      byte >>= j;
-      printf("%u", byte);
-    }
+  self->used     = true;
+  self->id       = samplerNextId_g++;
+  self->callback = new Nan::Callback(info[5].As<v8::Function>());
+  self->pi       = pi;
+  self->mask     = mask;
+  self->period   = (uint64_t) period * 1000;
+  self->maxDelay = (uint64_t) info[4]->Uint32Value() * 1000000;
+  self->batch    = batch;
+  self->stop     = false;
+  self->error    = 0;
+  self->size     = size;
+  self->head     = 0;
+  self->count    = 0;
+  self->last     = 0;
+  self->samples  = 0;
+  self->records  = 0;
+  self->dropped  = 0;
+  self->missed   = 0;
+  self->jitter.Reset();
+  self->read.Reset();
+
+  if (samplerActive_g++ == 0) {
+    uv_ref((uv_handle_t *) &samplerAsync_g);
   }
-  printf("\n");
+
+  uv_thread_create(&self->thread, SamplerThread, self);
+
+  info.GetReturnValue().Set(self->id);
 }
 
 
-NAN_METHOD(spi_xfer) {
-  if(info.Length() < 5    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // handle
-     !info[2]->IsObject() || // txBuf
-     !info[3]->IsObject() || // rxBuf    -> output buffer
-     !info[4]->IsUint32()    // count
+static NAN_METHOD(sampler_stop) {
+  if(info.Length() < 1    ||
+     !info[0]->IsUint32() || // sampler id
+     SamplerSlot(info[0]->Uint32Value()) < 0
   ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "spi_xfer", ""));
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "sampler_stop", ""));
   }
 
-  int      pi     = info[0]->Int32Value();
-  unsigned handle = info[1]->Uint32Value();
-  char*    txBuf  = node::Buffer::Data(info[2]->ToObject());
-  char*    rxBuf  = node::Buffer::Data(info[3]->ToObject());
-  int      count  = (int)info[4]->Uint32Value();
+  SamplerStop(SamplerSlot(info[0]->Uint32Value()), false);
+}
 
-//  printBits(count, txBuf); // debugging
 
-  int rc = spi_xfer(pi, handle, txBuf, rxBuf, count);
-  if(rc != count) {
-    printf("Error from spi_xfer count=%d, rc=%d\n", count, rc);
-    printBits(count, rxBuf); // debugging
-    return ThrowPigpiodError(rc, "spi_xfer");
+// Returns {samples, records, dropped, missed, buffered, jitter, read}, with
+// jitter the lateness of the samples against the schedule and read the
+// duration of the daemon reads, as latency statistics [us].
+static NAN_METHOD(sampler_stats) {
+  if(info.Length() < 1    ||
+     !info[0]->IsUint32() || // sampler id
+     SamplerSlot(info[0]->Uint32Value()) < 0
+  ) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "sampler_stats", ""));
   }
 
-//  printBits(count, rxBuf); // debugging
+  Sampler_t            *self   = &samplers_g[SamplerSlot(info[0]->Uint32Value())];
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
 
-  info.GetReturnValue().Set(rc);
+  uv_mutex_lock(&samplerMutex_g);
+  SetNumber(result, "samples",  self->samples);
+  SetNumber(result, "records",  self->records);
+  SetNumber(result, "dropped",  self->dropped);
+  SetNumber(result, "missed",   self->missed);
+  SetNumber(result, "buffered", self->count);
+  Nan::Set(result, Nan::New("jitter").ToLocalChecked(), self->jitter.ToObject());
+  Nan::Set(result, Nan::New("read").ToLocalChecked(), self->read.ToObject());
+  uv_mutex_unlock(&samplerMutex_g);
+
+  info.GetReturnValue().Set(result);
 }
 
 
 
 // ###########################################################################
-// Serial
+// Statistics snapshot
 // ###########################################################################
 
-NAN_METHOD(serial_open) {
-  if(info.Length() < 4    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsString() || // ser_tty
-     !info[2]->IsUint32() || // baud
-     !info[3]->IsUint32()    // ser_flags
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_open", ""));
-  }
+static NAN_METHOD(stats_get) {
+  v8::Local<v8::Object> result    = Nan::New<v8::Object>();
+  v8::Local<v8::Object> calls     = Nan::New<v8::Object>();
+  v8::Local<v8::Object> callbacks = Nan::New<v8::Object>();
+  v8::Local<v8::Object> waits     = Nan::New<v8::Object>();
 
-  int      pi        = info[0]->Int32Value();
-  char*    ser_tty   = v8ToCharPtr(info[1]->ToString());
-  unsigned baud      = info[2]->Uint32Value();
-  unsigned ser_flags = info[3]->Uint32Value();
+  for (CallStats_t *stats = CallStats_t::First(); stats; stats = stats->Next()) {
+    Nan::Set(calls, Nan::New(stats->Name()).ToLocalChecked(), stats->ToObject());
+  }
 
-  int rc = serial_open(pi, ser_tty, baud, ser_flags);
-  free(ser_tty);
-  if(rc < 0) {
-    return ThrowPigpiodError(rc, "serial_open");
+  for (unsigned gpio = 0; gpio <= PI_MAX_USER_GPIO; gpio++) {
+    if (gpioISR_g[gpio].Used()) {
+      Nan::Set(callbacks, gpio, gpioISR_g[gpio].Stats());
+    }
   }
 
-  info.GetReturnValue().Set(rc);
-}
+  SetNumber(waits, "pending", waitCount_g);
 
+  Nan::Set(result, Nan::New("resources").ToLocalChecked(), ResourcesToObject());
 
-NAN_METHOD(serial_close) {
-  if(info.Length() < 2    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32()    // handle
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_close", ""));
-  }
+  Nan::Set(result, Nan::New("calls").ToLocalChecked(), calls);
+  Nan::Set(result, Nan::New("callbacks").ToLocalChecked(), callbacks);
+  Nan::Set(result, Nan::New("waits").ToLocalChecked(), waits);
 
-  int      pi     = info[0]->Int32Value();
-  unsigned handle = info[1]->Uint32Value();
+  info.GetReturnValue().Set(result);
+}
 
-  int rc = serial_close(pi, handle);
-  if(rc != 0) {
-    return ThrowPigpiodError(rc, "serial_close");
+
+static NAN_METHOD(stats_reset) {
+  for (CallStats_t *stats = CallStats_t::First(); stats; stats = stats->Next()) {
+    stats->Reset();
   }
 
-  info.GetReturnValue().Set(rc);
+  for (unsigned gpio = 0; gpio <= PI_MAX_USER_GPIO; gpio++) {
+    gpioISR_g[gpio].ResetStats();
+  }
 }
 
 
-NAN_METHOD(serial_write_byte) {
-  if(info.Length() < 3    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // handle
-     !info[2]->IsUint32()    // bVal
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_write_byte", ""));
-  }
 
-  int      pi     = info[0]->Int32Value();
-  unsigned handle = info[1]->Uint32Value();
-  unsigned bVal   = info[2]->Uint32Value();
+// ###########################################################################
+// Edge trace
+// Records the edges of a set of GPIOs natively into a memory-mapped file of
+// fixed-size records, for offline debugging, and replays a recorded file
+// through the normal callback paths, at the original or an accelerated speed.
+//
+// File layout (little endian, as written by the Pi):
+//   header  TraceHeader_t
+//   records TraceRecord_t[capacity], of which <count> are valid
+// The ticks are extended to 64 bit by the clock model of the pi (see Clock
+// correlation), so they stay monotonic across the 32 bit wrap, also after
+// long pauses between the edges.
+// ###########################################################################
 
-  int rc = serial_write_byte(pi, handle, bVal);
-  if(rc != 0) {
-    return ThrowPigpiodError(rc, "serial_write_byte");
+#define TRACE_MAGIC      "PGPTRACE"
+#define TRACE_VERSION    1
+#define TRACE_QUEUE_SIZE 1024
+#define TRACE_SLICE      50000000 // ns, longest sleep without a stop check
+#define TRACE_WAIT_MAX   1e18     // ns, caps the replay time of a record
+
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void traceReplayEventLoopHandler(uv_async_t* handle);
+#else
+static void traceReplayEventLoopHandler(uv_async_t* handle, int status);
+#endif
+
+typedef struct
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t capacity;
+  uint64_t count;        // incremented for each record appended
+  uint64_t start_host;   // uv_hrtime() at the start of the recording
+  uint64_t start_time;   // wall clock [us since the epoch] at the start
+  uint8_t  reserved[16];
+} TraceHeader_t;
+
+typedef struct
+{
+  uint64_t tick;
+  uint8_t  pi;
+  uint8_t  gpio;
+  uint8_t  level;
+  uint8_t  reserved[5];
+} TraceRecord_t;
+
+typedef struct
+{
+  int             fd;
+  size_t          size;
+  TraceHeader_t  *header;
+  TraceRecord_t  *records;
+} TraceFile_t;
+
+typedef struct
+{
+  int             pi;
+  uint32_t        mask;
+  TraceFile_t     file;
+  int             cb_id[PI_MAX_USER_GPIO + 1];
+  uint64_t        dropped;
+} TraceRecorder_t;
+
+typedef struct
+{
+  TraceRecord_t   record;
+  uint64_t        host;     // uv_hrtime() of the replay
+} TraceReplayEdge_t;
+
+typedef struct
+{
+  TraceFile_t     file;
+  double          speed;
+  volatile int    stop;
+  uint64_t        replayed;
+  uv_thread_t     thread;
+  uv_async_t      async;
+
+  // The replay thread hands the edges over to the event loop.
+  uv_mutex_t         mutex;
+  TraceReplayEdge_t  queue[TRACE_QUEUE_SIZE];
+  unsigned           head;
+  unsigned           count;
+  int                finished;
+
+  Nan::Callback  *callback;
+} TraceReplay_t;
+
+// Only changed in the event loop thread, under traceMutex_g, so that
+// _trace_cb never writes to a stopped recording.
+static TraceRecorder_t *traceRecorder_g;
+static uv_mutex_t       traceMutex_g;
+
+static TraceReplay_t   *traceReplay_g;
+
+
+// Passes an edge to all the consumers of the callback path, as if it was
+// received from the daemon. The recorded ticks stay out of the clock model;
+// the edges carry the time of their replay.
+// Executed in the event loop thread, as the consumers get released there.
+// The DHT22 readers decode their own callbacks or notifications and don't
+// see replayed edges.
+static void DispatchEdge(
+  int pi, unsigned gpio, unsigned level, uint64_t tick64, uint64_t now)
+{
+  uint32_t tick = (uint32_t) tick64;
+
+  if (gpio > PI_MAX_USER_GPIO) {
+    return;
   }
 
-  info.GetReturnValue().Set(rc);
+  if (gpioISR_g[gpio].Callback()) {
+    GpioEvent_t event;
+
+    event.level    = level;
+    event.tick     = tick;
+    event.tick64   = tick64;
+    event.host     = now;
+    event.received = now;
+    gpioISR_g[gpio].Push(event);
+  }
+  uv_mutex_lock(&pulseMutex_g);
+  if (pulseStats_g[gpio]) {
+    _pulse_edge(pulseStats_g[gpio], level, tick);
+  }
+  uv_mutex_unlock(&pulseMutex_g);
+  WaitEdge(pi, gpio, level, tick, tick64, now);
 }
 
 
-NAN_METHOD(serial_read_byte) {
-  if(info.Length() < 2    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32()    // handle
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_read_byte", ""));
+static void TraceFileClose(TraceFile_t *file) {
+  if (file->header) {
+    munmap(file->header, file->size);
+    file->header = 0;
+  }
+  if (file->fd >= 0) {
+    close(file->fd);
+    file->fd = -1;
   }
+}
 
-  int      pi     = info[0]->Int32Value();
-  unsigned handle = info[1]->Uint32Value();
 
-  int rc = serial_read_byte(pi, handle);
-  if(rc < 0) {
-    return ThrowPigpiodError(rc, "serial_read_byte");
+static void TraceStop(uint64_t *records, uint64_t *dropped);
+
+
+// _trace_cb is not executed in the event loop thread.
+// callback_cancel() doesn't wait for a callback already running, so the
+// recorder is looked up under traceMutex_g instead of taken from user; a
+// late callback finds it gone (or finds a new recording, not of its GPIO).
+static void _trace_cb(
+  int cbPi, unsigned cbGpio, unsigned level, uint32_t tick, void *user)
+{
+  TraceRecorder_t *self;
+  TraceRecord_t   *record;
+  uint64_t         index;
+  uint64_t         host;
+  uint64_t         tick64 = ClockObserve(cbPi, tick, uv_hrtime(), &host);
+
+  uv_mutex_lock(&traceMutex_g);
+
+  self = traceRecorder_g;
+  if (!self || self->pi != cbPi || !(self->mask & (1u << cbGpio)))
+  {
+    uv_mutex_unlock(&traceMutex_g);
+    return;
   }
 
-  info.GetReturnValue().Set(rc);
+  index = self->file.header->count;
+  if (index >= self->file.header->capacity)
+  {
+    self->dropped++;
+    uv_mutex_unlock(&traceMutex_g);
+    return;
+  }
+
+  record = &self->file.records[index];
+  record->tick  = tick64;
+  record->pi    = cbPi;
+  record->gpio  = cbGpio;
+  record->level = level;
+  self->file.header->count = index + 1;
+
+  uv_mutex_unlock(&traceMutex_g);
 }
 
 
-NAN_METHOD(serial_write) {
+static NAN_METHOD(trace_start) {
   if(info.Length() < 4    ||
      !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // handle
-     !info[2]->IsString() || // buf
-     !info[3]->IsUint32()    // count
+     !info[1]->IsUint32() || // gpio bitmask
+     !info[2]->IsString() || // path
+     !info[3]->IsUint32()    // capacity [records]
   ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_write", ""));
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "trace_start", ""));
   }
 
-  int      pi     = info[0]->Int32Value();
-  unsigned handle = info[1]->Uint32Value();
-  char*    buf    = v8ToCharPtr(info[2]->ToString());
-  unsigned count  = info[3]->Uint32Value();
+  int      pi       = info[0]->Int32Value();
+  uint32_t mask     = info[1]->Uint32Value();
+  unsigned capacity = info[3]->Uint32Value();
 
-  int rc = serial_write(pi, handle, buf, count);
-  free(buf);
-  if(rc != 0) {
-    return ThrowPigpiodError(rc, "serial_write");
+  if(traceRecorder_g || mask == 0 || capacity == 0) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "trace_start", ""));
   }
 
-  info.GetReturnValue().Set(rc);
+  TraceRecorder_t *self = new TraceRecorder_t();
+  char            *path = v8ToCharPtr(info[2]->ToString());
+  struct timeval   now;
+
+  self->pi        = pi;
+  self->mask      = mask;
+  self->dropped   = 0;
+  self->file.size = sizeof(TraceHeader_t) + (size_t) capacity * sizeof(TraceRecord_t);
+  self->file.fd   = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  self->file.header = 0;
+
+  if (self->file.fd < 0 ||
+      ftruncate(self->file.fd, self->file.size) != 0 ||
+      (self->file.header = (TraceHeader_t *) mmap(NULL, self->file.size,
+        PROT_READ | PROT_WRITE, MAP_SHARED, self->file.fd, 0)) == MAP_FAILED
+  ) {
+    int err = errno;
+
+    if (self->file.header == MAP_FAILED) {
+      self->file.header = 0;
+    }
+    TraceFileClose(&self->file);
+    delete self;
+    Nan::ThrowError(Nan::ErrnoException(err, "trace_start", "", path));
+    free(path);
+    return;
+  }
+  free(path);
+
+  gettimeofday(&now, NULL);
+  memcpy(self->file.header->magic, TRACE_MAGIC, 8);
+  self->file.header->version     = TRACE_VERSION;
+  self->file.header->record_size = sizeof(TraceRecord_t);
+  self->file.header->capacity    = capacity;
+  self->file.header->count       = 0;
+  self->file.header->start_host  = uv_hrtime();
+  self->file.header->start_time  = (uint64_t) now.tv_sec * 1000000 + now.tv_usec;
+  self->file.records = (TraceRecord_t *) (self->file.header + 1);
+
+  for (unsigned gpio = 0; gpio <= PI_MAX_USER_GPIO; gpio++) {
+    self->cb_id[gpio] = -1;
+  }
+
+  uv_mutex_lock(&traceMutex_g);
+  traceRecorder_g = self;
+  uv_mutex_unlock(&traceMutex_g);
+
+  for (unsigned gpio = 0; gpio <= PI_MAX_USER_GPIO; gpio++) {
+    if (!(mask & (1u << gpio))) {
+      continue;
+    }
+
+    int rc = callback_ex(pi, gpio, EITHER_EDGE, _trace_cb, self);
+    if (rc < 0) {
+      TraceStop(0, 0);
+      return ThrowPigpiodError(rc, "trace_start");
+    }
+    self->cb_id[gpio] = rc;
+  }
 }
 
 
-NAN_METHOD(serial_read) {
-  if(info.Length() < 4    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // handle
-     !info[2]->IsObject() || // buf    -> output buffer
-     !info[3]->IsUint32()    // count
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_read", ""));
+// Ends the recording, returns the number of records and drops.
+static void TraceStop(uint64_t *records, uint64_t *dropped) {
+  TraceRecorder_t *self = traceRecorder_g;
+
+  // Waits for a callback writing right now, later ones find no recorder.
+  uv_mutex_lock(&traceMutex_g);
+  traceRecorder_g = 0;
+  uv_mutex_unlock(&traceMutex_g);
+
+  for (unsigned gpio = 0; gpio <= PI_MAX_USER_GPIO; gpio++) {
+    if (self->cb_id[gpio] >= 0) {
+      callback_cancel(self->cb_id[gpio]);
+    }
   }
 
-  int      pi     = info[0]->Int32Value();
-  unsigned handle = info[1]->Uint32Value();
-  char*    buf    = node::Buffer::Data(info[2]->ToObject());
-  unsigned count  = info[3]->Uint32Value();
+  if (records) {
+    *records = self->file.header->count;
+  }
+  if (dropped) {
+    *dropped = self->dropped;
+  }
 
-  int rc = serial_read(pi, handle, buf, count);
-  if(rc <= 0) {
-    return ThrowPigpiodError(rc, "serial_read");
+  msync(self->file.header, self->file.size, MS_SYNC);
+  TraceFileClose(&self->file);
+
+  delete self;
+}
+
+
+// Returns {records, dropped}.
+static NAN_METHOD(trace_stop) {
+  if(!traceRecorder_g) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "trace_stop", ""));
   }
 
-  info.GetReturnValue().Set(rc);
+  uint64_t records;
+  uint64_t dropped;
+
+  TraceStop(&records, &dropped);
+
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+
+  SetNumber(result, "records", records);
+  SetNumber(result, "dropped", dropped);
+
+  info.GetReturnValue().Set(result);
 }
 
 
-NAN_METHOD(serial_data_available) {
-  if(info.Length() < 2    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32()    // handle
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "serial_data_available", ""));
+// Sleeps until due, returns false if stopped meanwhile.
+static bool TraceReplayWait(TraceReplay_t *self, uint64_t due) {
+  for (;;) {
+    if (self->stop) {
+      return false;
+    }
+
+    uint64_t now = uv_hrtime();
+
+    if (now >= due) {
+      return true;
+    }
+    SleepUntil(due - now > TRACE_SLICE ? now + TRACE_SLICE : due);
+  }
+}
+
+
+// The replay thread, timing the recorded edges and handing them over to
+// the event loop, which feeds them into the callback paths.
+static void TraceReplayThread(void *arg) {
+  TraceReplay_t *self  = (TraceReplay_t *) arg;
+  uint64_t       count = self->file.header->count;
+  uint64_t       start = uv_hrtime();
+  uint64_t       first = count ? self->file.records[0].tick : 0;
+  uint64_t       last  = first;
+
+  for (uint64_t i = 0; i < count && !self->stop; i++) {
+    TraceRecord_t *record = &self->file.records[i];
+
+    // A tick going backwards (a damaged file) replays right away.
+    if (record->tick > last) {
+      last = record->tick;
+    }
+
+    if (self->speed > 0) {
+      double wait = (double) (last - first) * 1000 / self->speed;
+
+      if (!TraceReplayWait(self,
+            start + (uint64_t) (wait < TRACE_WAIT_MAX ? wait : TRACE_WAIT_MAX))
+      ) {
+        break;
+      }
+    }
+
+    uv_mutex_lock(&self->mutex);
+    while (self->count == TRACE_QUEUE_SIZE && !self->stop) {
+      // The event loop is behind, wait for it.
+      uv_mutex_unlock(&self->mutex);
+      uv_async_send(&self->async);
+      SleepUntil(uv_hrtime() + 1000000);
+      uv_mutex_lock(&self->mutex);
+    }
+    if (self->count < TRACE_QUEUE_SIZE) {
+      TraceReplayEdge_t *edge =
+        &self->queue[(self->head + self->count) % TRACE_QUEUE_SIZE];
+
+      edge->record = *record;
+      edge->host   = uv_hrtime();
+      self->count++;
+    }
+    uv_mutex_unlock(&self->mutex);
+
+    uv_async_send(&self->async);
   }
 
-  int      pi     = info[0]->Int32Value();
-  unsigned handle = info[1]->Uint32Value();
+  uv_mutex_lock(&self->mutex);
+  self->finished = 1;
+  uv_mutex_unlock(&self->mutex);
+
+  uv_async_send(&self->async);
+}
+
 
-  int rc = serial_data_available(pi, handle);
-  if(rc < 0) {
-    return ThrowPigpiodError(rc, "serial_data_available");
-  }
+static void TraceReplayFree(uv_handle_t *handle) {
+  TraceReplay_t *self = (TraceReplay_t *) handle->data;
 
-  info.GetReturnValue().Set(rc);
+  uv_mutex_destroy(&self->mutex);
+  delete self->callback;
+  delete self;
 }
 
 
+// Dispatches the edges handed over by the replay thread, and ends the
+// replay once the thread is finished.
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+static void traceReplayEventLoopHandler(uv_async_t* handle) {
+#else
+static void traceReplayEventLoopHandler(uv_async_t* handle, int status) {
+#endif
+  Nan::HandleScope scope;
 
+  TraceReplay_t     *self = (TraceReplay_t *) handle->data;
+  TraceReplayEdge_t  edges[TRACE_QUEUE_SIZE];
+  unsigned           num;
+  int                finished;
 
+  uv_mutex_lock(&self->mutex);
+  for (num = 0; num < self->count; num++) {
+    edges[num] = self->queue[(self->head + num) % TRACE_QUEUE_SIZE];
+  }
+  self->head  = (self->head + num) % TRACE_QUEUE_SIZE;
+  self->count = 0;
+  finished    = self->finished;
+  uv_mutex_unlock(&self->mutex);
 
-// ###########################################################################
-// Utilities
-// ###########################################################################
+  for (unsigned i = 0; i < num; i++) {
+    TraceRecord_t *record = &edges[i].record;
 
-NAN_METHOD(get_current_tick) {
-  if(info.Length() < 1   ||
-     !info[0]->IsInt32()    // pi
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "get_current_tick", ""));
+    DispatchEdge(record->pi, record->gpio, record->level, record->tick,
+      edges[i].host);
+    self->replayed++;
   }
 
-  int pi = info[0]->Int32Value();
+  if (!finished) {
+    return;
+  }
 
-  int rc = get_current_tick(pi);
+  uv_thread_join(&self->thread);
+  TraceFileClose(&self->file);
+  traceReplay_g = 0;
 
-  info.GetReturnValue().Set(rc);
+  v8::Local<v8::Value> args[2] = {
+    Nan::Null(),
+    Nan::New<v8::Number>(self->replayed)
+  };
+  self->callback->Call(2, args);
+
+  uv_close((uv_handle_t *) &self->async, TraceReplayFree);
 }
 
 
-NAN_METHOD(get_hardware_revision) {
-  if(info.Length() < 1   ||
-     !info[0]->IsInt32()    // pi
+// speed: 1 for the original timing, >1 for faster, 0 for as fast as possible
+static NAN_METHOD(trace_replay) {
+  if(info.Length() < 3    ||
+     !info[0]->IsString() || // path
+     !info[1]->IsNumber() || // speed
+     !info[2]->IsFunction()  // handler, called when done
   ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "get_hardware_revision", ""));
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "trace_replay", ""));
   }
 
-  int pi = info[0]->Int32Value();
-
-  int rc = get_hardware_revision(pi);
+  double speed = info[1]->NumberValue();
 
-  if(rc == 0) {
-    return ThrowPigpiodError(rc, "get_hardware_revision");
+  if(traceReplay_g || speed < 0) {
+    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "trace_replay", ""));
   }
 
-  info.GetReturnValue().Set(rc);
-}
+  TraceReplay_t *self = new TraceReplay_t();
+  char          *path = v8ToCharPtr(info[0]->ToString());
+  struct stat    st;
 
+  self->file.header = 0;
+  self->file.fd     = open(path, O_RDONLY);
 
-NAN_METHOD(get_pigpio_version) {
-  if(info.Length() < 1   ||
-     !info[0]->IsInt32()    // pi
+  if (self->file.fd < 0 ||
+      fstat(self->file.fd, &st) != 0 ||
+      (size_t) st.st_size < sizeof(TraceHeader_t) ||
+      (self->file.header = (TraceHeader_t *) mmap(NULL, st.st_size,
+        PROT_READ, MAP_SHARED, self->file.fd, 0)) == MAP_FAILED
   ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "get_pigpio_version", ""));
-  }
+    int err = self->file.fd < 0 || self->file.header == MAP_FAILED ? errno : EINVAL;
 
-  int pi = info[0]->Int32Value();
+    if (self->file.header == MAP_FAILED) {
+      self->file.header = 0;
+    }
+    TraceFileClose(&self->file);
+    delete self;
+    Nan::ThrowError(Nan::ErrnoException(err, "trace_replay", "", path));
+    free(path);
+    return;
+  }
+  self->file.size    = st.st_size;
+  self->file.records = (TraceRecord_t *) (self->file.header + 1);
+
+  if (memcmp(self->file.header->magic, TRACE_MAGIC, 8) != 0 ||
+      self->file.header->version != TRACE_VERSION ||
+      self->file.header->record_size != sizeof(TraceRecord_t) ||
+      self->file.header->count >
+        (self->file.size - sizeof(TraceHeader_t)) / sizeof(TraceRecord_t)
+  ) {
+    TraceFileClose(&self->file);
+    delete self;
+    Nan::ThrowError(Nan::ErrnoException(EINVAL, "trace_replay", "not a trace file", path));
+    free(path);
+    return;
+  }
+  free(path);
+
+  self->speed    = speed;
+  self->stop     = 0;
+  self->replayed = 0;
+  self->head     = 0;
+  self->count    = 0;
+  self->finished = 0;
+  self->callback = new Nan::Callback(info[2].As<v8::Function>());
+
+  uv_mutex_init(&self->mutex);
+  uv_async_init(uv_default_loop(), &self->async, traceReplayEventLoopHandler);
+  self->async.data = self;
+
+  traceReplay_g = self;
+  uv_thread_create(&self->thread, TraceReplayThread, self);
+}
 
-  int rc = get_pigpio_version(pi);
 
-  if(rc < 0) {
-    return ThrowPigpiodError(rc, "get_pigpio_version");
+static NAN_METHOD(trace_replay_stop) {
+  if(traceReplay_g) {
+    traceReplay_g->stop = 1;
   }
-
-  info.GetReturnValue().Set(rc);
 }
 
 
 
 // ###########################################################################
-// DHT22
-// This is a synchronous C implementation, as I failed to code a reliable
-// js based implementation (as - due to node.js's nature - it's
-// async handling might be busy with other tasks, so the
-// interrupt/ callback handling needed to read the DHT22 data is too slow).
-// The code is based on the example code taken from
-// http://abyz.co.uk/rpi/pigpio/examples.html
-// and I shrunk it down to the pure DHT22 handling, to make it as
-// simple as possible to get it included here.
-// Note: the function _decode_dht22() calculates temperature and humidity,
-//       but in fact I'm returning the binary data and re-run that same
-//       calculation in js. This is as I failed to return float/ double
-//       data from C code back into js - let me know if you know...
+// Resource release
 // ###########################################################################
 
-#define DHT_GOOD         0
-#define DHT_BAD_CHECKSUM 1
-#define DHT_BAD_DATA     2
-#define DHT_TIMEOUT      3
-
-struct DHT22_s;
-typedef struct DHT22_s DHT22_t;
+// Releases everything registered for the pi or chip handle, and stops its
+// thread pool work, serial readers, samplers, schedules, display refreshes,
+// pulse statistics, waiters and trace recording.
+// At exit javascript can't be called any more, so only the daemon and
+// kernel side gets released then.
+static void ResourceReleasePi(int pi, bool atExit) {
+  GpioChip_t *chip = GpioChip(pi);
+  Resource_t  res;
+
+  WorkStopPi(pi);
+  SerialReaderStopPi(pi, atExit);
+  SamplerStopPi(pi, atExit);
+  ScheduleStopPi(pi);
+  FrameDevice_t::StopPi(pi, atExit);
+
+  while (resources_g) {
+    Resource_t *next;
+
+    for (next = resources_g; next && next->pi != pi; next = next->next) {
+    }
+    if (!next) {
+      break;
+    }
+    ResourceRemove(pi, next->type, next->handle, &res);
+
+    switch(res.type) {
+      case RES_CALLBACK:
+        if (chip) {
+          chip->SetEdge(res.gpio, -1);
+        } else {
+          callback_cancel(res.handle);
+        }
+        if (!atExit) {
+          GpioISRRelease(res.gpio);
+        }
+        break;
 
-typedef struct
-{
-  float  temperature;
-  float  humidity;
-  int    status;
-} DHT22_data_t;
-typedef void (*DHT22_CB_t)(DHT22_data_t);
+      case RES_SPI:
+        spi_close(pi, res.handle);
+        break;
 
-struct DHT22_s
-{
-  int          _cb_id;
-  int          _in_code;
-  union
-  {
-    char      *_char[8];
-    uint8_t    _byte[8];
-    uint64_t   _code;
-  };
-  int          _bits;
-  int          _data_finished;
-  DHT22_data_t _data;
-  uint32_t     _last_edge_tick;
-};
+      case RES_SERIAL:
+        serial_close(pi, res.handle);
+        break;
 
-static void _decode_dht22(DHT22_t *self)
-{
-  uint8_t chksum;
-  float div;
-  float t, h;
+      case RES_I2C:
+        i2c_close(pi, res.handle);
+        break;
 
-  chksum = (self->_byte[1] + self->_byte[2] +
-            self->_byte[3] + self->_byte[4]) & 0xFF;
+      case RES_BB_SERIAL:
+        bb_serial_read_close(pi, res.handle);
+        break;
 
-  if (chksum == self->_byte[0])
-  {
-    h = ((float)((self->_byte[4]<<8) + self->_byte[3])) / 10.0;
+      case RES_BB_SPI:
+        bb_spi_close(pi, res.handle);
+        break;
 
-    if (self->_byte[2] & 128)
-    {
-      div = -10.0;
-    }
-    else
-    {
-      div = 10.0;
+      case RES_BB_I2C:
+        bb_i2c_close(pi, res.handle);
+        break;
     }
+  }
 
-    t = ((float)(((self->_byte[2]&127)<<8) + self->_byte[1])) / div;
+  for (unsigned gpio = 0; gpio <= PI_MAX_USER_GPIO; gpio++) {
+    PulseStats_t *self = pulseStats_g[gpio];
 
-    if ((h > 110.0) || (t < -50.0) || (t > 135.0))
-    {
-      self->_data.status = DHT_BAD_DATA;
-    }
-    else
-    {
-      self->_data.temperature = t;
-      self->_data.humidity    = h;
-      self->_data.status      = DHT_GOOD;
+    if (self && self->_pi == pi) {
+      callback_cancel(self->_cb_id);
+      _pulse_remove(gpio);
     }
   }
-  else
-  {
-    self->_data.status = DHT_BAD_CHECKSUM;
-  }
-
-  self->_data_finished = 1;
-}
-
-static void _cb(
-  int cbPi, unsigned cbGpio, unsigned level, uint32_t tick, void *user)
-{
-  DHT22_t *self = (DHT22_t *)user;
-  int edge_len;
 
-  edge_len = tick - self->_last_edge_tick;
-  self->_last_edge_tick = tick;
-
-  if (edge_len > 10000)
-  {
-    self->_in_code = 1;
-    self->_bits = -2;
-    self->_code = 0;
+  if (traceRecorder_g && traceRecorder_g->pi == pi) {
+    TraceStop(0, 0);
   }
-  else if (self->_in_code)
-  {
-    self->_bits++;
-    if (self->_bits >= 1)
-    {
-      self->_code <<= 1;
 
-      if ((edge_len >= 60) && (edge_len <= 100))
-      {
-        /* 0 bit */
-      }
-      else if ((edge_len > 100) && (edge_len <= 150))
-      {
-        /* 1 bit */
-        self->_code += 1;
-      }
-      else
-      {
-        /* invalid bit */
-        self->_in_code = 0;
-      }
+  if (!atExit && pi >= 0 && pi < MAX_PI) {
+    // The waiters of the pi end as if they were cancelled.
+    EdgeWaiter_t *waiter;
 
-      if (self->_in_code)
-      {
-        if (self->_bits == 40)
-        {
-          _decode_dht22(self);
-        }
+    uv_mutex_lock(&waitMutex_g);
+    for (waiter = waiters_g; waiter; waiter = waiter->next) {
+      if (waiter->pi == pi && waiter->result == WAIT_PENDING) {
+        waiter->result = WAIT_TIMEOUT;
       }
     }
+    EdgeWaiter_t *finished = WaitTakeFinished();
+    uv_mutex_unlock(&waitMutex_g);
+
+    WaitDeliver(finished);
   }
 }
 
-void DHT22(int pi, int gpio, char *buf)
-{
-  int i;
-  DHT22_t *self;
 
-  self = (DHT22_t *)malloc(sizeof(DHT22_t));
-  if (!self) {
-    return;
+static void ResourceReleaseAtExit(void *arg) {
+  for (int pi = 0; pi < MAX_PI; pi++) {
+    if (piOpen_g[pi]) {
+      ResourceReleasePi(pi, true);
+      pigpio_stop(pi);
+      piOpen_g[pi] = false;
+    }
   }
 
-  self->_data.temperature = 0.0;
-  self->_data.humidity    = 0.0;
-  self->_data.status      = 0;
-  self->_in_code          = 0;
-  self->_data_finished    = 0;
-  self->_last_edge_tick = get_current_tick(pi) - 10000;
-
-  set_mode(pi, gpio, PI_INPUT);
-
-  self->_cb_id = callback_ex(pi, gpio, RISING_EDGE, _cb, self);
-
-  self->_data_finished = 0;
-
-  // Trigger read
-  set_mode(pi, gpio, PI_OUTPUT);
-  gpio_write(pi, gpio, 0);
-  time_sleep(0.018);
-  set_mode(pi, gpio, PI_INPUT);
-
-  // timeout if no new reading
-  for (i = 0; i < 5; i++) /* 0.25 seconds */
-  {
-    time_sleep(0.05);
-    if (self->_data_finished)
-    {
-      break;
+  for (unsigned index = 0; index < GPIOCHIP_MAX; index++) {
+    if (gpioChip_g[index]) {
+      ResourceReleasePi(GPIOCHIP_BASE + index, true);
+      delete gpioChip_g[index];
+      gpioChip_g[index] = 0;
     }
   }
+}
 
-  if (!self->_data_finished)
-  {
-    memset((void *)buf, 0, 8);
-  }
-  else
-  {
-    memcpy((void *)buf, (void *)(&self->_code), 8);
-  }
 
-  if (self->_cb_id >= 0)
-  {
-    callback_cancel(self->_cb_id);
-    self->_cb_id = -1;
-  }
-  free(self);
-}
+// Live resources per pi or chip handle.
+static v8::Local<v8::Object> ResourcesToObject() {
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
 
+  for (int pi = 0; pi < GPIOCHIP_BASE + GPIOCHIP_MAX; pi++) {
+    if (pi < MAX_PI ? !piOpen_g[pi] : !GpioChip(pi)) {
+      continue;
+    }
 
-static NAN_METHOD(dht22_get) {
-  if(info.Length() < 3    ||
-     !info[0]->IsInt32()  || // pi
-     !info[1]->IsUint32() || // gpio
-     !info[2]->IsObject()    // buf    -> output buffer
-  ) {
-    return Nan::ThrowError(Nan::ErrnoException(EINVAL, "get_dht22", ""));
-  }
+    v8::Local<v8::Object> counts = Nan::New<v8::Object>();
 
-  int      pi   = info[0]->Int32Value();
-  unsigned gpio = info[1]->Uint32Value();
-  char*    buf  = node::Buffer::Data(info[2]->ToObject());
+    for (int type = 0; type < RES_TYPES; type++) {
+      SetNumber(counts, resourceNames_g[type], ResourceCount(pi, type));
+    }
+    Nan::Set(result, pi, counts);
+  }
 
-  DHT22(pi, gpio, buf);
+  return result;
 }
 
 
@@ -978,7 +7402,30 @@ static void SetFunction(
 
 
 NAN_MODULE_INIT(InitAll) {
-  uv_sem_init(&sem_g, 1);
+  uv_mutex_init(&clockMutex_g);
+
+  uv_mutex_init(&pulseMutex_g);
+
+  uv_mutex_init(&workMutex_g);
+  uv_cond_init(&workCond_g);
+
+  uv_mutex_init(&waitMutex_g);
+  uv_async_init(uv_default_loop(), &waitAsync_g, waitEventLoopHandler);
+  uv_unref((uv_handle_t *) &waitAsync_g);
+
+  uv_mutex_init(&serialMutex_g);
+  uv_async_init(uv_default_loop(), &serialAsync_g, serialReaderEventLoopHandler);
+  uv_unref((uv_handle_t *) &serialAsync_g);
+
+  uv_mutex_init(&samplerMutex_g);
+  uv_async_init(uv_default_loop(), &samplerAsync_g, samplerEventLoopHandler);
+  uv_unref((uv_handle_t *) &samplerAsync_g);
+
+  uv_mutex_init(&traceMutex_g);
+
+  uv_mutex_init(&waveMutex_g);
+
+  node::AtExit(ResourceReleaseAtExit);
 
   /* mode constants */
   SetConst(target, "PI_INPUT", PI_INPUT);
@@ -1021,6 +7468,27 @@ NAN_MODULE_INIT(InitAll) {
   /* error code constants */
   SetConst(target, "PI_INIT_FAILED", PI_INIT_FAILED);
 
+  /* serial reader source constants */
+  SetConst(target, "SERIAL_SOURCE_TTY", SERIAL_SOURCE_TTY);
+  SetConst(target, "SERIAL_SOURCE_BB", SERIAL_SOURCE_BB);
+
+  /* transaction list constants */
+  SetConst(target, "TX_OP_DELAY", TX_OP_DELAY);
+  SetConst(target, "TX_OP_SPI_XFER", TX_OP_SPI_XFER);
+  SetConst(target, "TX_OP_BB_SPI_XFER", TX_OP_BB_SPI_XFER);
+  SetConst(target, "TX_OP_BB_I2C_ZIP", TX_OP_BB_I2C_ZIP);
+  SetConst(target, "TX_FLAG_STOP_ON_ERROR", TX_FLAG_STOP_ON_ERROR);
+
+  /* output scheduler constants */
+  SetConst(target, "SCHED_FLAG_TICK", SCHED_FLAG_TICK);
+  SetConst(target, "SCHED_RESULT_WAVE", SCHED_RESULT_WAVE);
+
+  /* callback policy constants */
+  SetConst(target, "CB_POLICY_QUEUE", CB_POLICY_QUEUE);
+  SetConst(target, "CB_POLICY_COALESCE", CB_POLICY_COALESCE);
+  SetConst(target, "CB_POLICY_RATE", CB_POLICY_RATE);
+  SetConst(target, "CB_POLICY_DEBOUNCE", CB_POLICY_DEBOUNCE);
+
   /* gpioCfgClock cfgPeripheral constants */
   SetConst(target, "PI_CLOCK_PWM", PI_CLOCK_PWM);
   SetConst(target, "PI_CLOCK_PCM", PI_CLOCK_PCM);
@@ -1028,14 +7496,19 @@ NAN_MODULE_INIT(InitAll) {
   /* functions */
   SetFunction(target, "callback", callback);
   SetFunction(target, "callback_cancel", callback_cancel);
+  SetFunction(target, "callback_stats", callback_stats);
+  SetFunction(target, "callback_stats_reset", callback_stats_reset);
   SetFunction(target, "pigpio_start", pigpio_start);
   SetFunction(target, "pigpio_stop", pigpio_stop);
+  SetFunction(target, "gpiochip_open", gpiochip_open);
+  SetFunction(target, "gpiochip_close", gpiochip_close);
   SetFunction(target, "set_mode", set_mode);
   SetFunction(target, "get_mode", get_mode);
   SetFunction(target, "set_pull_up_down", set_pull_up_down);
   SetFunction(target, "gpio_read", gpio_read);
   SetFunction(target, "gpio_write", gpio_write);
   SetFunction(target, "set_watchdog", set_watchdog);
+  SetFunction(target, "gpio_trigger", gpio_trigger);
   SetFunction(target, "set_glitch_filter", set_glitch_filter);
   SetFunction(target, "set_noise_filter", set_noise_filter);
   SetFunction(target, "spi_open", spi_open);
@@ -1048,10 +7521,51 @@ NAN_MODULE_INIT(InitAll) {
   SetFunction(target, "serial_write", serial_write);
   SetFunction(target, "serial_read", serial_read);
   SetFunction(target, "serial_data_available", serial_data_available);
+  SetFunction(target, "bb_serial_read_open", bb_serial_read_open);
+  SetFunction(target, "bb_serial_read", bb_serial_read);
+  SetFunction(target, "bb_serial_read_close", bb_serial_read_close);
+  SetFunction(target, "bb_serial_invert", bb_serial_invert);
+  SetFunction(target, "serial_reader_start", serial_reader_start);
+  SetFunction(target, "serial_reader_stop", serial_reader_stop);
+  SetFunction(target, "serial_reader_stats", serial_reader_stats);
+  SetFunction(target, "bb_spi_open", bb_spi_open);
+  SetFunction(target, "bb_spi_close", bb_spi_close);
+  SetFunction(target, "bb_spi_xfer", bb_spi_xfer);
+  SetFunction(target, "bb_i2c_open", bb_i2c_open);
+  SetFunction(target, "bb_i2c_close", bb_i2c_close);
+  SetFunction(target, "bb_i2c_zip", bb_i2c_zip);
+  SetFunction(target, "transaction_run", transaction_run);
+  SetFunction(target, "schedule_run", schedule_run);
+  SetFunction(target, "schedule_cancel", schedule_cancel);
   SetFunction(target, "get_current_tick", get_current_tick);
+  SetFunction(target, "clock_get", clock_get);
+  SetFunction(target, "clock_tick_to_time", clock_tick_to_time);
   SetFunction(target, "get_hardware_revision", get_hardware_revision);
   SetFunction(target, "get_pigpio_version", get_pigpio_version);
   SetFunction(target, "dht22_get", dht22_get);
+  SetFunction(target, "dht22_sweep", dht22_sweep);
+  SetFunction(target, "pulse_stats_start", pulse_stats_start);
+  SetFunction(target, "pulse_stats_get", pulse_stats_get);
+  SetFunction(target, "pulse_stats_reset", pulse_stats_reset);
+  SetFunction(target, "pulse_stats_stop", pulse_stats_stop);
+  SetFunction(target, "wait_for_edge_async", wait_for_edge_async);
+  SetFunction(target, "wait_for_edge_cancel", wait_for_edge_cancel);
+  SetFunction(target, "sampler_start", sampler_start);
+  SetFunction(target, "sampler_stop", sampler_stop);
+  SetFunction(target, "sampler_stats", sampler_stats);
+  SetFunction(target, "stats_get", stats_get);
+  SetFunction(target, "stats_reset", stats_reset);
+  SetFunction(target, "trace_start", trace_start);
+  SetFunction(target, "trace_stop", trace_stop);
+  SetFunction(target, "trace_replay", trace_replay);
+  SetFunction(target, "trace_replay_stop", trace_replay_stop);
+
+  /* classes */
+  Pin::Init(target);
+  SpiDevice::Init(target);
+  SerialPort::Init(target);
+  Pca9685::Init(target);
+  Max7219::Init(target);
 }
 
 NODE_MODULE(pigpio, InitAll)
@@ -0,0 +1,352 @@
+'use strict';
+
+/* eslint-env mocha */
+/* eslint-disable no-bitwise */
+
+// The bindings (pigpiod_if2), against the stand-in in a child process.
+
+const assert       = require('assert');
+const childProcess = require('child_process');
+const path         = require('path');
+
+const pigpiod       = require('../lib/pigpiod.js');
+const {delay, fork} = require('./helpers/standin');
+
+const GPIO_OUT       = 4;
+const GPIO_CALLBACK  = 25;
+const GPIO_DHT22     = 18;
+const GPIO_BB_SERIAL = 17;
+const GPIO_SAMPLE    = 22;
+const GPIO_TRIGGER   = 23;
+const GPIO_SCHEDULE  = 24;
+
+describe('bindings', function() {
+  let standIn;
+  let port;
+  let pi;
+
+  this.timeout(5000);
+
+  before(() =>
+    fork()
+    .then(result => {
+      standIn = result.process;
+      port    = String(result.port);
+      pi      = pigpiod.pigpio_start('127.0.0.1', port);
+    }));
+
+  after(() => {
+    pigpiod.pigpio_stop(pi);
+    standIn.kill();
+  });
+
+  it('connects to the daemon', () => {
+    assert.ok(pi >= 0);
+    assert.strictEqual(pigpiod.get_hardware_revision(pi), 0xa02082);
+    assert.strictEqual(pigpiod.get_pigpio_version(pi), 79);
+  });
+
+  it('sets modes and levels', () => {
+    pigpiod.set_mode(pi, GPIO_OUT, pigpiod.PI_OUTPUT);
+    assert.strictEqual(pigpiod.get_mode(pi, GPIO_OUT), pigpiod.PI_OUTPUT);
+
+    pigpiod.gpio_write(pi, GPIO_OUT, 1);
+    assert.strictEqual(pigpiod.gpio_read(pi, GPIO_OUT), 1);
+    pigpiod.gpio_write(pi, GPIO_OUT, 0);
+    assert.strictEqual(pigpiod.gpio_read(pi, GPIO_OUT), 0);
+  });
+
+  it('throws the daemon errors', () => {
+    assert.throws(() => pigpiod.gpio_read(pi, 99));
+    assert.throws(() => pigpiod.spi_close(pi, 99));
+  });
+
+  it('throws on invalid arguments', () => {
+    assert.throws(() => pigpiod.gpio_read(pi), /EINVAL/);
+    assert.throws(() => pigpiod.gpio_write(pi, 'x', 1), /EINVAL/);
+  });
+
+  it('transfers on SPI', () => {
+    const spi   = pigpiod.spi_open(pi, 0, 1000000, 0);
+    const rxBuf = Buffer.alloc(3);
+
+    pigpiod.spi_xfer(pi, spi, Buffer.from([1, 2, 3]), rxBuf, 3);
+    pigpiod.spi_close(pi, spi);
+
+    assert.deepStrictEqual(Array.from(rxBuf), [1, 2, 3]);
+  });
+
+  it('writes and reads serial data', () => {
+    const serial = pigpiod.serial_open(pi, '/dev/ttyAMA0', 115200, 0);
+    const rxBuf  = Buffer.alloc(16);
+
+    pigpiod.serial_write(pi, serial, 'ping', 4);
+    assert.strictEqual(pigpiod.serial_data_available(pi, serial), 4);
+    assert.strictEqual(pigpiod.serial_read(pi, serial, rxBuf, 16), 4);
+    assert.strictEqual(rxBuf.toString('utf8', 0, 4), 'ping');
+    pigpiod.serial_close(pi, serial);
+  });
+
+  it('streams bit bang serial data', () => {
+    const reader = pigpiod.bbSerialReader(pi, GPIO_BB_SERIAL, 9600,
+      {interval: 5});
+    const chunks = [];
+
+    reader.on('data', data => chunks.push(data));
+    standIn.send({cmd: 'bbSerialData', gpio: GPIO_BB_SERIAL, data: 'hello'});
+    standIn.send({cmd: 'bbSerialData', gpio: GPIO_BB_SERIAL, data: ' world'});
+
+    return delay(200)
+    .then(() => {
+      const stats = reader.stats();
+
+      reader.close();
+
+      assert.strictEqual(Buffer.concat(chunks).toString(), 'hello world');
+      assert.strictEqual(stats.received, 11);
+      assert.strictEqual(stats.dropped, 0);
+      assert.strictEqual(stats.buffered, 0);
+      // released, so it can be opened again
+      pigpiod.bb_serial_read_open(pi, GPIO_BB_SERIAL, 9600, 8);
+      pigpiod.bb_serial_read_close(pi, GPIO_BB_SERIAL);
+    });
+  });
+
+  it('calls back on edges', () => {
+    const edges = [];
+
+    pigpiod.set_mode(pi, GPIO_CALLBACK, pigpiod.PI_INPUT);
+
+    const callbackId = pigpiod.callback(pi, GPIO_CALLBACK,
+      pigpiod.EITHER_EDGE, (gpio, level, tick) => {
+        edges.push({gpio, level, tick});
+      });
+
+    standIn.send({cmd: 'setLevel', gpio: GPIO_CALLBACK, level: 1});
+    standIn.send({cmd: 'setLevel', gpio: GPIO_CALLBACK, level: 0});
+
+    return delay(200)
+    .then(() => {
+      pigpiod.callback_cancel(callbackId);
+
+      assert.deepStrictEqual(edges.map(edge => edge.level), [1, 0]);
+      assert.strictEqual(edges[0].gpio, GPIO_CALLBACK);
+      assert.ok(((edges[1].tick - edges[0].tick) >>> 0) < 1000000);
+      assert.strictEqual(pigpiod.callback_stats(GPIO_CALLBACK).dropped, 0);
+    });
+  });
+
+  it('waits for an edge without blocking', () => {
+    pigpiod.set_mode(pi, GPIO_CALLBACK, pigpiod.PI_INPUT);
+
+    const wait = pigpiod.waitForEdge(pi, GPIO_CALLBACK,
+      pigpiod.RISING_EDGE, 1000);
+
+    setTimeout(() => {
+      standIn.send({cmd: 'setLevel', gpio: GPIO_CALLBACK, level: 1});
+    }, 20);
+
+    return wait
+    .then(result => {
+      standIn.send({cmd: 'setLevel', gpio: GPIO_CALLBACK, level: 0});
+
+      assert.strictEqual(result.timeout, false);
+      assert.strictEqual(result.gpio, GPIO_CALLBACK);
+      assert.strictEqual(result.level, 1);
+    });
+  });
+
+  it('times out waiting for an edge', () =>
+    pigpiod.waitForEdge(pi, GPIO_CALLBACK, pigpiod.RISING_EDGE, 50)
+    .then(result => assert.strictEqual(result.timeout, true)));
+
+  it('samples levels periodically', () => {
+    const mask    = 1 << GPIO_SAMPLE;
+    const changes = [];
+    let   stats;
+
+    standIn.send({cmd: 'setLevel', gpio: GPIO_SAMPLE, level: 0});
+
+    return delay(50)
+    .then(() => {
+      const sampler = pigpiod.sampler(pi, GPIO_SAMPLE, 1000, {maxDelay: 10});
+
+      sampler.on('change', change => changes.push(change));
+
+      return delay(50)
+      .then(() => {
+        standIn.send({cmd: 'setLevel', gpio: GPIO_SAMPLE, level: 1});
+
+        return delay(100);
+      })
+      .then(() => {
+        stats = sampler.stats();
+        sampler.stop();
+      });
+    })
+    .then(() => {
+      assert.strictEqual(changes.length, 2);
+      assert.strictEqual(changes[0].changed, mask);
+      assert.strictEqual(changes[0].levels & mask, 0);
+      assert.strictEqual(changes[1].changed, mask);
+      assert.strictEqual(changes[1].levels & mask, mask);
+      assert.ok(changes[1].time > changes[0].time);
+      assert.ok(stats.samples > 2);
+      assert.strictEqual(stats.records, 2);
+      assert.strictEqual(stats.dropped, 0);
+    });
+  });
+
+  it('sends trigger pulses', () => {
+    const edges = [];
+
+    pigpiod.set_mode(pi, GPIO_TRIGGER, pigpiod.PI_OUTPUT);
+    pigpiod.gpio_write(pi, GPIO_TRIGGER, 0);
+
+    const callbackId = pigpiod.callback(pi, GPIO_TRIGGER,
+      pigpiod.EITHER_EDGE, (gpio, level, tick) => edges.push({level, tick}));
+
+    pigpiod.gpio_trigger(pi, GPIO_TRIGGER, 100, 1);
+
+    return delay(100)
+    .then(() => {
+      pigpiod.callback_cancel(callbackId);
+
+      assert.deepStrictEqual(edges.map(edge => edge.level), [1, 0]);
+      assert.strictEqual((edges[1].tick - edges[0].tick) >>> 0, 100);
+    });
+  });
+
+  it('runs output schedules', () => {
+    const levels = [];
+
+    pigpiod.set_mode(pi, GPIO_OUT, pigpiod.PI_OUTPUT);
+    pigpiod.set_mode(pi, GPIO_SCHEDULE, pigpiod.PI_OUTPUT);
+    pigpiod.gpio_write(pi, GPIO_OUT, 0);
+    pigpiod.gpio_write(pi, GPIO_SCHEDULE, 0);
+
+    const callbackId = pigpiod.callback(pi, GPIO_OUT,
+      pigpiod.EITHER_EDGE, (gpio, level) => levels.push(level));
+
+    return pigpiod.schedule()
+    .after(0, {[GPIO_OUT]: 1})
+    .after(20000, {[GPIO_OUT]: 0, [GPIO_SCHEDULE]: 1})
+    .run(pi, {waveThreshold: 0})
+    .then(results => {
+      assert.strictEqual(results.length, 2);
+      for(const result of results) {
+        assert.strictEqual(result.rc, 0);
+        assert.strictEqual(result.wave, false);
+        assert.ok(result.lateness >= 0);
+      }
+
+      return delay(100);
+    })
+    .then(() => {
+      pigpiod.callback_cancel(callbackId);
+
+      assert.deepStrictEqual(levels, [1, 0]);
+      assert.strictEqual(pigpiod.gpio_read(pi, GPIO_OUT), 0);
+      assert.strictEqual(pigpiod.gpio_read(pi, GPIO_SCHEDULE), 1);
+    });
+  });
+
+  it('reads a DHT22', () => {
+    standIn.send({cmd: 'dht22', gpio: GPIO_DHT22,
+      temperature: 21.3, humidity: 45.2});
+
+    return delay(100)
+    .then(() => {
+      const result = pigpiod.dht22(pi, GPIO_DHT22);
+
+      assert.strictEqual(result.status, pigpiod.DHT_GOOD);
+      assert.strictEqual(result.temperature, 21.3);
+      assert.strictEqual(result.humidity, 45.2);
+    });
+  });
+
+  it('runs transaction lists', () => {
+    const spi = pigpiod.spi_open(pi, 0, 1000000, 0);
+
+    return pigpiod.transaction()
+    .spiXfer(spi, [1, 2])
+    .delay(100)
+    .spiXfer(spi, [3])
+    .run(pi)
+    .then(results => {
+      pigpiod.spi_close(pi, spi);
+
+      assert.strictEqual(results.length, 3);
+      assert.deepStrictEqual(Array.from(results[0].data), [1, 2]);
+      assert.deepStrictEqual(Array.from(results[2].data), [3]);
+    });
+  });
+
+  it('counts the resources per pi', () => {
+    const other    = pigpiod.pigpio_start('127.0.0.1', port);
+    const spi      = pigpiod.spi_open(other, 0, 1000000, 0);
+    const serial   = pigpiod.serial_open(other, '/dev/ttyAMA0', 115200, 0);
+    const callback = pigpiod.callback(other, GPIO_CALLBACK,
+      pigpiod.EITHER_EDGE, () => {});
+
+    let counts = pigpiod.getStats().resources[other];
+
+    assert.strictEqual(counts.callbacks, 1);
+    assert.strictEqual(counts.spi, 1);
+    assert.strictEqual(counts.serial, 1);
+    assert.strictEqual(counts.i2c, 0);
+
+    pigpiod.callback_cancel(callback);
+    pigpiod.spi_close(other, spi);
+    counts = pigpiod.getStats().resources[other];
+
+    assert.strictEqual(counts.callbacks, 0);
+    assert.strictEqual(counts.spi, 0);
+    assert.strictEqual(counts.serial, 1);
+
+    pigpiod.serial_close(other, serial);
+    pigpiod.pigpio_stop(other);
+  });
+
+  it('releases the resources on pigpio_stop()', () => {
+    const other  = pigpiod.pigpio_start('127.0.0.1', port);
+    const spi    = pigpiod.spi_open(other, 0, 1000000, 0);
+    const levels = [];
+
+    pigpiod.set_mode(other, GPIO_CALLBACK, pigpiod.PI_INPUT);
+    pigpiod.callback(other, GPIO_CALLBACK, pigpiod.EITHER_EDGE,
+      (gpio, level) => levels.push(level));
+
+    pigpiod.pigpio_stop(other);
+
+    assert.strictEqual(pigpiod.getStats().resources[other], undefined);
+    // closed in the daemon, not only forgotten
+    assert.throws(() => pigpiod.spi_close(pi, spi));
+
+    standIn.send({cmd: 'setLevel', gpio: GPIO_CALLBACK, level: 1});
+    standIn.send({cmd: 'setLevel', gpio: GPIO_CALLBACK, level: 0});
+
+    return delay(200)
+    .then(() => assert.deepStrictEqual(levels, []));
+  });
+
+  it('leaves nothing behind after a failed callback()', done => {
+    // In a separate process, which has to exit on its own.
+    const script = `
+      const pigpiod = require(${JSON.stringify(path.join(__dirname, '..'))});
+
+      try {
+        pigpiod.callback(0, ${GPIO_CALLBACK}, pigpiod.EITHER_EDGE, () => {});
+      } catch(err) {
+        console.log(JSON.stringify(pigpiod.getStats().callbacks));
+      }
+    `;
+
+    childProcess.execFile(process.execPath, ['-e', script], {timeout: 3000},
+      (err, stdout) => {
+        assert.ifError(err);
+        assert.deepStrictEqual(JSON.parse(stdout), {});
+        done();
+      });
+  });
+});
@@ -0,0 +1,104 @@
+'use strict';
+
+/* eslint-env mocha */
+
+// The GPIO character device backend, against the gpio-sim kernel module.
+// Runs only with GPIO_SIM naming a live gpio-sim device with 8 lines,
+// set up (as root) with
+//   modprobe gpio-sim
+//   mkdir -p /sys/kernel/config/gpio-sim/pigpiod/bank0
+//   echo 8 > /sys/kernel/config/gpio-sim/pigpiod/bank0/num_lines
+//   echo 1 > /sys/kernel/config/gpio-sim/pigpiod/live
+// and the chip made accessible to the test user, e.g.
+//   GPIO_SIM=pigpiod npm test
+
+const assert = require('assert');
+const fs     = require('fs');
+const path   = require('path');
+
+const pigpiod = require('../lib/pigpiod.js');
+const {delay} = require('./helpers/standin');
+
+const CONFIGFS = '/sys/kernel/config/gpio-sim';
+
+const describeSim = process.env.GPIO_SIM ? describe : describe.skip;
+
+describeSim('gpiochip', () => {
+  let chip;
+  let sysfs;
+
+  const read = function(file) {
+    return fs.readFileSync(path.join(sysfs, file), 'utf8').trim();
+  };
+
+  // Drives an input line, as external hardware would.
+  const pull = function(line, level) {
+    fs.writeFileSync(path.join(sysfs, `sim_gpio${line}`, 'pull'),
+      level ? 'pull-up' : 'pull-down');
+  };
+
+  before(() => {
+    const device   = path.join(CONFIGFS, process.env.GPIO_SIM);
+    const devName  = fs.readFileSync(path.join(device, 'dev_name'), 'utf8')
+      .trim();
+    const chipName = fs.readFileSync(path.join(device, 'bank0', 'chip_name'),
+      'utf8').trim();
+
+    sysfs = path.join('/sys/devices/platform', devName, chipName);
+    chip  = pigpiod.gpiochip_open(`/dev/${chipName}`);
+  });
+
+  after(() => {
+    pigpiod.gpiochip_close(chip);
+  });
+
+  it('drives outputs', () => {
+    pigpiod.gpio_write(chip, 0, 1);
+    assert.strictEqual(read('sim_gpio0/value'), '1');
+    assert.strictEqual(pigpiod.get_mode(chip, 0), pigpiod.PI_OUTPUT);
+
+    pigpiod.gpio_write(chip, 0, 0);
+    assert.strictEqual(read('sim_gpio0/value'), '0');
+  });
+
+  it('reads inputs without changing their mode', () => {
+    pull(1, 1);
+    assert.strictEqual(pigpiod.gpio_read(chip, 1), 1);
+    pull(1, 0);
+    assert.strictEqual(pigpiod.gpio_read(chip, 1), 0);
+    assert.strictEqual(pigpiod.get_mode(chip, 1), pigpiod.PI_INPUT);
+  });
+
+  it('reads outputs without changing their mode', () => {
+    pigpiod.gpio_write(chip, 3, 1);
+    assert.strictEqual(pigpiod.gpio_read(chip, 3), 1);
+    assert.strictEqual(pigpiod.get_mode(chip, 3), pigpiod.PI_OUTPUT);
+    assert.strictEqual(read('sim_gpio3/value'), '1');
+  });
+
+  it('keeps outputs and edges while adding lines', () => {
+    const levels = [];
+
+    pigpiod.gpio_write(chip, 0, 1);
+    pull(2, 0);
+
+    const callbackId = pigpiod.callback(chip, 2, pigpiod.EITHER_EDGE,
+      (gpio, level) => levels.push(level));
+
+    pull(2, 1);
+
+    // the first use of another line must not touch the others
+    pigpiod.gpio_read(chip, 5);
+    pigpiod.set_pull_up_down(chip, 6, pigpiod.PI_PUD_UP);
+
+    pull(2, 0);
+
+    return delay(100)
+    .then(() => {
+      pigpiod.callback_cancel(callbackId);
+
+      assert.deepStrictEqual(levels, [1, 0]);
+      assert.strictEqual(read('sim_gpio0/value'), '1');
+    });
+  });
+});
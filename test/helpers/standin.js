@@ -0,0 +1,115 @@
+'use strict';
+
+// Helpers to run tests against the pigpiod stand-in (lib/standin.js).
+
+const childProcess = require('child_process');
+const net          = require('net');
+const path         = require('path');
+
+const HEADER_SIZE = 16;
+
+// Starts bin/pigpiod-standin.js as a child process, on a free local port,
+// as the bindings block the event loop while waiting for the daemon.
+// Resolves with {process, port}; the process takes the IPC messages of
+// bin/pigpiod-standin.js (setLevel, edgeStream, dht22, bbSerialData).
+const fork = function() {
+  return new Promise((resolve, reject) => {
+    const standIn = childProcess.fork(
+      path.join(__dirname, '..', '..', 'bin', 'pigpiod-standin.js'),
+      ['--port', '0', '--host', '127.0.0.1'],
+      {stdio: ['ignore', 'ignore', 'inherit', 'ipc']});
+
+    standIn.once('message', message => {
+      if(message.listening) {
+        resolve({process: standIn, port: message.listening.port});
+      }
+    });
+    standIn.once('error', reject);
+  });
+};
+
+// Minimal pigpiod socket protocol client, one command at a time.
+class Client {
+  constructor(port) {
+    this.port    = port;
+    this.socket  = null;
+    this.buffer  = Buffer.alloc(0);
+    this.waiting = null;
+    this.reports = [];
+  }
+
+  connect() {
+    return new Promise((resolve, reject) => {
+      this.socket = net.connect(this.port, '127.0.0.1', resolve);
+      this.socket.once('error', reject);
+      this.socket.on('data', data => {
+        this.buffer = Buffer.concat([this.buffer, data]);
+        this.receive();
+      });
+    });
+  }
+
+  close() {
+    this.socket.destroy();
+  }
+
+  receive() {
+    if(!this.waiting) {
+      // notification reports, 12 bytes each
+      while(this.buffer.length >= 12) {
+        this.reports.push({
+          flags: this.buffer.readUInt16LE(2),
+          tick:  this.buffer.readUInt32LE(4),
+          level: this.buffer.readUInt32LE(8)
+        });
+        this.buffer = this.buffer.slice(12);
+      }
+
+      return;
+    }
+    if(this.buffer.length < HEADER_SIZE) {
+      return;
+    }
+
+    const res     = this.buffer.readInt32LE(12);
+    const dataLen = this.waiting.extended && res > 0 ? res : 0;
+
+    if(this.buffer.length < HEADER_SIZE + dataLen) {
+      return;
+    }
+
+    const data    = this.buffer.slice(HEADER_SIZE, HEADER_SIZE + dataLen);
+    const resolve = this.waiting.resolve;
+
+    this.buffer  = this.buffer.slice(HEADER_SIZE + dataLen);
+    this.waiting = null;
+    resolve({res, data});
+  }
+
+  // Resolves with {res, data}, data for the commands returning extended
+  // data (extended: true).
+  command(cmd, p1, p2, ext, extended) {
+    const extBuf  = ext ? Buffer.from(ext) : Buffer.alloc(0);
+    const request = Buffer.alloc(HEADER_SIZE);
+
+    request.writeUInt32LE(cmd, 0);
+    request.writeUInt32LE(p1 >>> 0, 4);
+    request.writeUInt32LE(p2 >>> 0, 8);
+    request.writeUInt32LE(extBuf.length, 12);
+
+    return new Promise(resolve => {
+      this.waiting = {resolve, extended};
+      this.socket.write(Buffer.concat([request, extBuf]));
+    });
+  }
+}
+
+const delay = function(ms) {
+  return new Promise(resolve => setTimeout(resolve, ms));
+};
+
+module.exports = {
+  Client,
+  delay,
+  fork
+};
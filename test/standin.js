@@ -0,0 +1,155 @@
+'use strict';
+
+/* eslint-env mocha */
+/* eslint-disable no-bitwise */
+
+// The stand-in on the socket protocol level, without the bindings.
+
+const assert = require('assert');
+
+const {StandIn}       = require('../lib/standin');
+const {Client, delay} = require('./helpers/standin');
+
+const PI_CMD_MODES = 0;
+const PI_CMD_MODEG = 1;
+const PI_CMD_READ  = 3;
+const PI_CMD_WRITE = 4;
+const PI_CMD_BR1   = 10;
+const PI_CMD_TICK  = 16;
+const PI_CMD_HWVER = 17;
+const PI_CMD_NO    = 18;
+const PI_CMD_NB    = 19;
+const PI_CMD_NOIB  = 99;
+const PI_CMD_SPIO  = 71;
+const PI_CMD_SPIX  = 75;
+const PI_CMD_SERO  = 76;
+const PI_CMD_SERR  = 80;
+const PI_CMD_SERW  = 81;
+
+const PI_BAD_GPIO         = -3;
+const PI_BAD_HANDLE       = -25;
+const PI_SER_READ_NO_DATA = -87;
+const PI_UNKNOWN_COMMAND  = -88;
+
+describe('stand-in', () => {
+  let standIn;
+  let client;
+
+  beforeEach(() => {
+    standIn = new StandIn();
+
+    return new Promise(resolve => standIn.listen(0, '127.0.0.1', resolve))
+    .then(() => {
+      client = new Client(standIn.server.address().port);
+
+      return client.connect();
+    });
+  });
+
+  afterEach(done => {
+    client.close();
+    standIn.close(done);
+  });
+
+  it('reports the hardware revision', () =>
+    client.command(PI_CMD_HWVER, 0, 0)
+    .then(result => assert.strictEqual(result.res, 0xa02082)));
+
+  it('sets and gets modes', () =>
+    client.command(PI_CMD_MODES, 4, 1)
+    .then(() => client.command(PI_CMD_MODEG, 4, 0))
+    .then(result => assert.strictEqual(result.res, 1)));
+
+  it('writes and reads levels', () =>
+    client.command(PI_CMD_WRITE, 4, 1)
+    .then(() => client.command(PI_CMD_READ, 4, 0))
+    .then(result => {
+      assert.strictEqual(result.res, 1);
+
+      return client.command(PI_CMD_BR1, 0, 0);
+    })
+    .then(result => assert.strictEqual(result.res & (1 << 4), 1 << 4)));
+
+  it('rejects bad GPIOs and unknown commands', () =>
+    client.command(PI_CMD_READ, 99, 0)
+    .then(result => {
+      assert.strictEqual(result.res, PI_BAD_GPIO);
+
+      return client.command(1000, 0, 0);
+    })
+    .then(result => assert.strictEqual(result.res, PI_UNKNOWN_COMMAND)));
+
+  it('counts ticks', () => {
+    let first;
+
+    return client.command(PI_CMD_TICK, 0, 0)
+    .then(result => {
+      first = result.res >>> 0;
+
+      return delay(5);
+    })
+    .then(() => client.command(PI_CMD_TICK, 0, 0))
+    .then(result => assert.ok((result.res >>> 0) - first >= 4000));
+  });
+
+  it('loops SPI back', () =>
+    client.command(PI_CMD_SPIO, 0, 1000000, [0, 0, 0, 0])
+    .then(result => {
+      assert.ok(result.res >= 0);
+
+      return client.command(PI_CMD_SPIX, result.res, 0, [1, 2, 3], true);
+    })
+    .then(result => {
+      assert.strictEqual(result.res, 3);
+      assert.deepStrictEqual(Array.from(result.data), [1, 2, 3]);
+    }));
+
+  it('echos serial data', () => {
+    let handle;
+
+    return client.command(PI_CMD_SERO, 115200, 0, '/dev/ttyAMA0')
+    .then(result => {
+      handle = result.res;
+
+      return client.command(PI_CMD_SERR, handle, 16, null, true);
+    })
+    .then(result => {
+      assert.strictEqual(result.res, PI_SER_READ_NO_DATA);
+
+      return client.command(PI_CMD_SERW, handle, 0, 'ping');
+    })
+    .then(() => client.command(PI_CMD_SERR, handle, 16, null, true))
+    .then(result => {
+      assert.strictEqual(result.data.toString(), 'ping');
+
+      return client.command(PI_CMD_SERR, handle + 1, 16, null, true);
+    })
+    .then(result => assert.strictEqual(result.res, PI_BAD_HANDLE));
+  });
+
+  it('reports level changes to notification handles', () => {
+    const reports = new Client(standIn.server.address().port);
+
+    return reports.connect()
+    .then(() => reports.command(PI_CMD_NOIB, 0, 0))
+    .then(result => client.command(PI_CMD_NB, result.res, 1 << 25))
+    .then(() => {
+      standIn.pulseTrain(25, [[1, 0], [0, 100]]);
+
+      return delay(20);
+    })
+    .then(() => {
+      reports.close();
+
+      assert.strictEqual(reports.reports.length, 2);
+      assert.strictEqual(reports.reports[0].level & (1 << 25), 1 << 25);
+      assert.strictEqual(reports.reports[1].level & (1 << 25), 0);
+      assert.strictEqual(
+        (reports.reports[1].tick - reports.reports[0].tick) >>> 0, 100);
+    });
+  });
+
+  it('rejects notification pipes', () =>
+    client.command(PI_CMD_NO, 0, 0)
+    .then(result => assert.strictEqual(result.res, PI_UNKNOWN_COMMAND)));
+});